@@ -0,0 +1,160 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorAllocations.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// Per thread so other threads' allocations don't count; plain integers so
+// they need no allocation themselves
+thread_local std::size_t counting = 0;
+thread_local std::size_t allocations = 0;
+thread_local std::size_t allocated = 0;
+
+void* allocate(std::size_t n, std::size_t alignment = 0) noexcept
+{
+    if (counting) {
+        ++allocations;
+        allocated += n;
+    }
+    if (n==0) n = 1;
+    if (alignment<=alignof(std::max_align_t)) return std::malloc(n);
+    // aligned_alloc needs a multiple of the alignment
+    return std::aligned_alloc(alignment, (n+alignment-1) / alignment * alignment);
+}
+
+void* allocateOrThrow(std::size_t n, std::size_t alignment = 0)
+{
+    if (auto p = allocate(n, alignment)) return p;
+    throw std::bad_alloc{};
+}
+
+}
+
+namespace selector::bench {
+
+AllocationCounter::AllocationCounter() :
+    start(allocations),
+    startBytes(allocated)
+{
+    ++counting;
+}
+
+AllocationCounter::~AllocationCounter()
+{
+    --counting;
+}
+
+std::size_t AllocationCounter::count() const
+{
+    return allocations-start;
+}
+
+std::size_t AllocationCounter::bytes() const
+{
+    return allocated-startBytes;
+}
+
+}
+
+void* operator new(std::size_t n)
+{
+    return allocateOrThrow(n);
+}
+
+void* operator new[](std::size_t n)
+{
+    return allocateOrThrow(n);
+}
+
+void* operator new(std::size_t n, std::align_val_t a)
+{
+    return allocateOrThrow(n, std::size_t(a));
+}
+
+void* operator new[](std::size_t n, std::align_val_t a)
+{
+    return allocateOrThrow(n, std::size_t(a));
+}
+
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept
+{
+    return allocate(n);
+}
+
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept
+{
+    return allocate(n);
+}
+
+void* operator new(std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept
+{
+    return allocate(n, std::size_t(a));
+}
+
+void* operator new[](std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept
+{
+    return allocate(n, std::size_t(a));
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
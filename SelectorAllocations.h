@@ -0,0 +1,57 @@
+#ifndef SELECTOR_ALLOCATIONS_H
+#define SELECTOR_ALLOCATIONS_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Counting heap allocations in tests and benchmarks: this is not part of the
+// library. A program using it links SelectorAllocations.cpp, which replaces
+// the global operator new and delete.
+
+#include <cstddef>
+
+namespace selector::bench {
+
+/**
+ * Counts the allocations the calling thread makes through operator new
+ * (including those the selector library makes) while the counter exists.
+ *
+ * Counters on the same thread nest: each sees the allocations made during
+ * its own lifetime.
+ */
+class AllocationCounter {
+    std::size_t start;
+    std::size_t startBytes;
+
+public:
+    AllocationCounter();
+    ~AllocationCounter();
+
+    AllocationCounter(const AllocationCounter&) = delete;
+    AllocationCounter& operator=(const AllocationCounter&) = delete;
+
+    std::size_t count() const;
+    std::size_t bytes() const;
+};
+
+}
+
+#endif
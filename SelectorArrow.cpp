@@ -0,0 +1,217 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorArrow.h"
+
+#include "SelectorBatch.h"
+#include "SelectorValue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::make_unique;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace selector {
+
+namespace {
+
+bool bit(const void* bitmap, int64_t i)
+{
+    return static_cast<const uint8_t*>(bitmap)[i>>3] >> (i&7) & 1;
+}
+
+// Arrays with no nulls needn't have a validity bitmap
+const void* validity(const ArrowArray& a)
+{
+    return a.null_count==0 ? nullptr : a.buffers[0];
+}
+
+bool format(const ArrowSchema& s, const char* f)
+{
+    return s.format && std::strcmp(s.format, f)==0;
+}
+
+// A primitive or string Arrow array read in place: row r is element
+// r+offset of the array's buffers
+class ArrowColumn : public Column {
+public:
+    enum Type {INT64, DOUBLE, BOOL, UTF8, LARGE_UTF8};
+
+private:
+    Type type;
+    const void* validity_;
+    const void* values;
+    const char* data;
+    int64_t offset;
+
+public:
+    ArrowColumn(Type t, const ArrowArray& a, int64_t o) :
+        type(t),
+        validity_(validity(a)),
+        values(a.buffers[1]),
+        data(t==UTF8 || t==LARGE_UTF8 ? static_cast<const char*>(a.buffers[2]) : nullptr),
+        offset(o)
+    {}
+
+    Value value(size_t row) const override {
+        auto i = int64_t(row)+offset;
+        if (validity_ && !bit(validity_, i)) return Value{};
+        switch (type) {
+        case INT64:
+            return Value{static_cast<const int64_t*>(values)[i]};
+        case DOUBLE:
+            return Value{static_cast<const double*>(values)[i]};
+        case BOOL:
+            return Value{bit(values, i)};
+        case UTF8: {
+            auto o = static_cast<const int32_t*>(values);
+            return Value{string_view{data+o[i], size_t(o[i+1]-o[i])}};
+        }
+        default: {
+            auto o = static_cast<const int64_t*>(values);
+            return Value{string_view{data+o[i], size_t(o[i+1]-o[i])}};
+        }
+        }
+    }
+};
+
+// Strings from a dictionary array indexed by signed integers of any width
+class ArrowDictionaryColumn : public Column {
+    const void* validity_;
+    const void* indices;
+    int width;
+    int64_t offset;
+    ArrowColumn dictionary;
+    int64_t entries;
+
+public:
+    ArrowDictionaryColumn(const ArrowArray& a, int w, int64_t o, ArrowColumn::Type t) :
+        validity_(validity(a)),
+        indices(a.buffers[1]),
+        width(w),
+        offset(o),
+        dictionary(t, *a.dictionary, a.dictionary->offset),
+        entries(a.dictionary->length)
+    {}
+
+    Value value(size_t row) const override {
+        auto i = int64_t(row)+offset;
+        if (validity_ && !bit(validity_, i)) return Value{};
+        int64_t k;
+        switch (width) {
+        case 1:  k = static_cast<const int8_t*>(indices)[i]; break;
+        case 2:  k = static_cast<const int16_t*>(indices)[i]; break;
+        case 4:  k = static_cast<const int32_t*>(indices)[i]; break;
+        default: k = static_cast<const int64_t*>(indices)[i]; break;
+        }
+        if (k<0 || k>=entries) return Value{};
+        return dictionary.value(k);
+    }
+};
+
+bool stringType(const ArrowSchema& s, ArrowColumn::Type& t)
+{
+    if (format(s, "u")) t = ArrowColumn::UTF8;
+    else if (format(s, "U")) t = ArrowColumn::LARGE_UTF8;
+    else return false;
+    return true;
+}
+
+int indexWidth(const ArrowSchema& s)
+{
+    if (format(s, "c")) return 1;
+    if (format(s, "s")) return 2;
+    if (format(s, "i")) return 4;
+    if (format(s, "l")) return 8;
+    return 0;
+}
+
+}
+
+ArrowBatch::ArrowBatch(const ArrowSchema& schema, const ArrowArray& array) :
+    batch_(array.length<0 ? 0 : size_t(array.length))
+{
+    if (!format(schema, "+s")) throw std::invalid_argument("Arrow batch is not a struct array");
+    if (schema.n_children!=array.n_children) throw std::invalid_argument("Arrow batch schema doesn't match its array");
+    for (int64_t i = 0; i<schema.n_children; ++i) {
+        auto& field = *schema.children[i];
+        auto& column = *array.children[i];
+        if (column.length<array.offset+array.length) throw std::invalid_argument("Arrow batch column is too short");
+        add(field, column, array.offset+column.offset);
+    }
+}
+
+ArrowBatch::~ArrowBatch() = default;
+
+void ArrowBatch::add(const ArrowSchema& field, const ArrowArray& column, int64_t offset)
+{
+    if (!field.name) return;
+    auto skip = [&] { skipped_.emplace_back(field.name); };
+    ArrowColumn::Type t;
+
+    if (field.dictionary) {
+        auto width = indexWidth(field);
+        if (!width || !column.dictionary || !stringType(*field.dictionary, t)) return skip();
+        auto& d = *column.dictionary;
+        // Gather the dictionary's strings (not copying them) for the
+        // evaluation by dictionary entry that filter() can do
+        if (width==4 && d.null_count==0) {
+            ArrowColumn entries{t, d, d.offset};
+            auto& views = dictionaries.emplace_back();
+            views.reserve(d.length);
+            for (int64_t i = 0; i<d.length; ++i) views.push_back(std::get<string_view>(entries.value(i).value));
+            auto codes = static_cast<const int32_t*>(column.buffers[1]) + offset;
+            auto bitmap = static_cast<const uint8_t*>(validity(column));
+            columns.push_back(make_unique<DictionaryColumn>(views.data(), views.size(), codes, bitmap, offset));
+        } else {
+            columns.push_back(make_unique<ArrowDictionaryColumn>(column, width, offset, t));
+        }
+    } else if (format(field, "l")) {
+        columns.push_back(make_unique<ArrowColumn>(ArrowColumn::INT64, column, offset));
+    } else if (format(field, "g")) {
+        columns.push_back(make_unique<ArrowColumn>(ArrowColumn::DOUBLE, column, offset));
+    } else if (format(field, "b")) {
+        columns.push_back(make_unique<ArrowColumn>(ArrowColumn::BOOL, column, offset));
+    } else if (stringType(field, t)) {
+        columns.push_back(make_unique<ArrowColumn>(t, column, offset));
+    } else {
+        return skip();
+    }
+    batch_.add(field.name, *columns.back());
+}
+
+void filter(const Expression& exp, const ArrowSchema& schema, const ArrowArray& array, vector<uint64_t>& selection)
+{
+    ArrowBatch batch{schema, array};
+    filter(exp, batch.batch(), selection);
+}
+
+}
@@ -0,0 +1,132 @@
+#ifndef SELECTOR_ARROW_H
+#define SELECTOR_ARROW_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include "SelectorBatch.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "selectors_export.h"
+
+// The Arrow C data interface, as the Arrow specification defines it: any
+// other definition of it is the same
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    // Array type description
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowSchema*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+struct ArrowArray {
+    // Array data description
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowArray*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
+
+namespace selector {
+
+class Expression;
+
+/**
+ * An Arrow record batch, exported through the C data interface as a struct
+ * array, as a Batch whose columns are the struct's fields by name.
+ *
+ * The columns read the Arrow buffers in place. Fields of type int64, double,
+ * bool, utf8, large utf8 and utf8 dictionary encoded with any signed index
+ * are supported; a null is a missing property. Other fields are skipped, so
+ * selectors see them as missing too. A dictionary with int32 indices becomes
+ * a DictionaryColumn so that filter() evaluates parts of the selector that
+ * depend on it once per dictionary entry.
+ *
+ * The struct's own validity is ignored: a record batch has none. The schema
+ * and array are not released, and must outlive the batch.
+ *
+ * Throws std::invalid_argument if the schema is not of a struct or doesn't
+ * match the array.
+ */
+class ArrowBatch {
+    Batch batch_;
+    std::vector<std::unique_ptr<Column>> columns;
+    std::vector<std::vector<std::string_view>> dictionaries;
+    std::vector<std::string> skipped_;
+
+    void add(const ArrowSchema&, const ArrowArray&, int64_t offset);
+
+public:
+    SELECTORS_EXPORT ArrowBatch(const ArrowSchema&, const ArrowArray&);
+    SELECTORS_EXPORT ~ArrowBatch();
+
+    ArrowBatch(const ArrowBatch&) = delete;
+    ArrowBatch& operator=(const ArrowBatch&) = delete;
+
+    const Batch& batch() const {
+        return batch_;
+    }
+
+    // The names of the fields of unsupported types
+    const std::vector<std::string>& skipped() const {
+        return skipped_;
+    }
+};
+
+// Filter the rows of an Arrow record batch (see ArrowBatch and filter())
+SELECTORS_EXPORT void filter(const Expression&, const ArrowSchema&, const ArrowArray&, std::vector<uint64_t>& selection);
+
+}
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorBatch.h"
+
+#include "SelectorEnv.h"
+#include "SelectorExpression.h"
+#include "SelectorNode.h"
+#include "SelectorProbes.h"
+#include "SelectorValue.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::make_unique;
+using std::ostream;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::unique_ptr;
+using std::vector;
+
+namespace selector {
+
+Column::~Column() noexcept = default;
+
+Value ValueColumn::value(size_t row) const
+{
+    return values[row];
+}
+
+Value DictionaryColumn::value(size_t row) const
+{
+    auto c = code(row);
+    if (c<0) return Value{};
+    return dictionary[c];
+}
+
+const Column* Batch::column(string_view name) const
+{
+    for (auto& [n, c] : columns) {
+        if (n==name) return c;
+    }
+    return nullptr;
+}
+
+namespace {
+
+// The current row of a batch
+class RowEnv : public Env {
+    const Batch& batch;
+    const size_t& row;
+    mutable Value scratch;
+
+public:
+    RowEnv(const Batch& b, const size_t& r) :
+        batch(b),
+        row(r)
+    {}
+
+    const Value& value(const string_view name) const override {
+        auto c = batch.column(name);
+        scratch = c ? c->value(row) : Value{};
+        return scratch;
+    }
+};
+
+// A single property
+class PropertyEnv : public Env {
+    string_view name;
+    Value v;
+
+public:
+    PropertyEnv(string_view n, const Value& v0) :
+        name(n),
+        v(v0)
+    {}
+
+    const Value& value(const string_view n) const override {
+        static const Value EMPTY{};
+        return n==name ? v : EMPTY;
+    }
+};
+
+// A subexpression depending only on a dictionary column, evaluated in advance
+// for each dictionary entry (and for a missing value) and looked up by the
+// row's code.
+class DictionaryLookup : public ValueExpression {
+    const DictionaryColumn& column;
+    const size_t& row;
+    vector<Value> values; // Indexed by code+1
+    string repr_;
+
+public:
+    DictionaryLookup(const ValueExpression& e, const string& name, const DictionaryColumn& c, const size_t& r) :
+        column(c),
+        row(r)
+    {
+        values.reserve(c.size()+1);
+        values.push_back(e.eval(PropertyEnv{name, Value{}}));
+        for (size_t i = 0; i<c.size(); ++i) {
+            values.push_back(e.eval(PropertyEnv{name, c.entry(i)}));
+        }
+        std::ostringstream o;
+        o << "DICTIONARY(" << e << ")";
+        repr_ = o.str();
+    }
+
+    void repr(ostream& os) const {
+        os << repr_;
+    }
+
+    Value eval(const Env&) const {
+        return values[column.code(row)+1];
+    }
+
+    // Which codes (+1) make the subexpression true
+    vector<uint64_t> matching() const {
+        vector<uint64_t> m((values.size()+63)/64);
+        for (size_t i = 0; i<values.size(); ++i) {
+            if (BoolOrNone(values[i])==BN_TRUE) m[i/64] |= uint64_t(1) << (i%64);
+        }
+        return m;
+    }
+
+    bool same(const ValueExpression& o) const {
+        return this==&o;
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn&) const {
+        return make_unique<DictionaryLookup>(*this);
+    }
+
+    unique_ptr<ValueExpression> simplified(Context) const {
+        return make_unique<DictionaryLookup>(*this);
+    }
+};
+
+}
+
+void filter(const Expression& exp, const Batch& batch, vector<uint64_t>& selection)
+{
+    selection.resize((batch.size()+63)/64);
+    filter(exp, batch, selection.data());
+}
+
+void filter(const Expression& exp, const Batch& batch, uint64_t* selection)
+{
+    size_t rows = batch.size();
+    std::fill_n(selection, (rows+63)/64, 0);
+
+    size_t row = 0;
+    ValueExpression::CopyFn lookups = [&](const ValueExpression& e) -> unique_ptr<ValueExpression> {
+        if (!isLiteral(e)) {
+            vector<string> ids;
+            collectIdentifiers(e, ids);
+            if (ids.size()==1) {
+                if (auto c = dynamic_cast<const DictionaryColumn*>(batch.column(ids[0]))) {
+                    return make_unique<DictionaryLookup>(e, ids[0], *c, row);
+                }
+            }
+        }
+        return e.copy(lookups);
+    };
+    auto plan = lookups(static_cast<const ValueExpression&>(exp));
+
+    // The whole expression depends on one dictionary column: just gather
+    // the result for each row's code
+    if (auto l = dynamic_cast<const DictionaryLookup*>(plan.get())) {
+        auto m = l->matching();
+        auto c = dynamic_cast<const DictionaryColumn*>(batch.column(identifiers(exp)[0]));
+        for (size_t r = 0; r<rows; ++r) {
+            size_t i = c->code(r)+1;
+            selection[r/64] |= ((m[i/64] >> (i%64)) & 1) << (r%64);
+        }
+        return;
+    }
+
+    // Rows evaluated by the plan fire the eval probes for the expression;
+    // gathered ones above don't
+    RowEnv env{batch, row};
+    for (; row<rows; ++row) {
+        SELECTOR_PROBE1(eval_start, &exp);
+        auto r = plan->eval_bool(env);
+        SELECTOR_PROBE2(eval_end, &exp, int(r));
+        if (r==BN_TRUE) selection[row/64] |= uint64_t(1) << (row%64);
+    }
+}
+
+}
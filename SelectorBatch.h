@@ -0,0 +1,145 @@
+#ifndef SELECTOR_BATCH_H
+#define SELECTOR_BATCH_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorValue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+class Expression;
+
+/**
+ * The values of one property for every row (message) of a batch.
+ *
+ * Columns are views: they don't own the data they refer to.
+ */
+class SELECTORS_EXPORT Column {
+public:
+    virtual ~Column() noexcept;
+
+    // The value of a missing property is unknown
+    virtual Value value(std::size_t row) const = 0;
+};
+
+// Any values, one per row
+class SELECTORS_EXPORT ValueColumn : public Column {
+    const Value* values;
+
+public:
+    explicit ValueColumn(const Value* v) :
+        values(v)
+    {}
+
+    Value value(std::size_t row) const override;
+};
+
+/**
+ * Strings encoded as codes into a dictionary of the distinct strings.
+ *
+ * A row is missing if its code isn't an entry of the dictionary (so is
+ * negative or too big) or its bit in the (optional) validity bitmap is clear. The bit for row r is bit r+validityOffset of the
+ * bitmap, as for an Arrow array that is a slice of another.
+ */
+class SELECTORS_EXPORT DictionaryColumn : public Column {
+    const std::string_view* dictionary;
+    std::size_t entries;
+    const int32_t* codes;
+    const uint8_t* validity;
+    std::size_t validityOffset;
+
+public:
+    DictionaryColumn(const std::string_view* d, std::size_t n, const int32_t* c, const uint8_t* v = nullptr, std::size_t vo = 0) :
+        dictionary(d),
+        entries(n),
+        codes(c),
+        validity(v),
+        validityOffset(vo)
+    {}
+
+    std::size_t size() const {
+        return entries;
+    }
+
+    std::string_view entry(std::size_t i) const {
+        return dictionary[i];
+    }
+
+    // The code of the row or -1 if it is missing
+    int32_t code(std::size_t row) const {
+        auto bit = row+validityOffset;
+        if (validity && !(validity[bit>>3] & (1u << (bit&7)))) return -1;
+        auto c = codes[row];
+        return c>=0 && std::size_t(c)<entries ? c : -1;
+    }
+
+    Value value(std::size_t row) const override;
+};
+
+/**
+ * A set of messages stored as named property columns.
+ */
+class Batch {
+    std::size_t rows;
+    std::vector<std::pair<std::string, const Column*>> columns;
+
+public:
+    explicit Batch(std::size_t n) :
+        rows(n)
+    {}
+
+    // The column must outlive the batch
+    void add(std::string_view name, const Column& c) {
+        columns.emplace_back(name, &c);
+    }
+
+    std::size_t size() const {
+        return rows;
+    }
+
+    SELECTORS_EXPORT const Column* column(std::string_view name) const;
+};
+
+/**
+ * Evaluate an expression for every row in the batch setting the selection
+ * bit of each row that it matches (bit i of selection[i/64]).
+ *
+ * Parts of the expression that only depend on a single dictionary encoded
+ * column are evaluated once for each distinct value in the dictionary, rather
+ * than for each row.
+ */
+SELECTORS_EXPORT void filter(const Expression&, const Batch&, std::vector<uint64_t>& selection);
+// Overwrites the (rows+63)/64 words at selection
+SELECTORS_EXPORT void filter(const Expression&, const Batch&, uint64_t* selection);
+
+}
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef SELECTOR_BENCH_H
+#define SELECTOR_BENCH_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+// Support for the benchmark programs: this is not part of the library
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace selector::bench {
+
+// Hardware events counted around a benchmark
+enum Event { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, EVENTS };
+
+// Counts of each event: negative where the event couldn't be counted
+struct Counts {
+    std::array<double, EVENTS> events{-1, -1, -1, -1, -1};
+
+    bool counted() const {
+        return events[CYCLES]>=0;
+    }
+
+    Counts& operator+=(const Counts& o) {
+        for (int e = 0; e<EVENTS; ++e) {
+            events[e] = events[e]<0 || o.events[e]<0 ? -1 : events[e]+o.events[e];
+        }
+        return *this;
+    }
+};
+
+// Whether run() and Counters count events: off unless a benchmark turns it on
+inline bool countEvents = false;
+
+/**
+ * Linux hardware performance counters for the calling thread, user space
+ * only, read with perf_event_open.
+ *
+ * Counters may be missing: without a PMU (in many containers and virtual
+ * machines), when perf_event_paranoid forbids them or off Linux. Then
+ * available() is false and stop() returns empty Counts, so benchmarks just
+ * report times; the reason is reported once on standard error.
+ */
+class Counters {
+    int fds[EVENTS] = {-1, -1, -1, -1, -1};
+
+#ifdef __linux__
+    static int open(uint32_t type, uint64_t config, int group) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = group<0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    }
+
+    static uint64_t cache(uint64_t cache, uint64_t result) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+    }
+#endif
+
+    static void unavailable(const char* why) {
+        static std::atomic<bool> reported{false};
+        if (reported.exchange(true)) return;
+        std::cerr << "Hardware counters unavailable: " << why << "\n";
+    }
+
+public:
+    Counters() {
+        if (!countEvents) return;
+#ifdef __linux__
+        fds[CYCLES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+        if (fds[CYCLES]<0) {
+            unavailable(std::strerror(errno));
+            return;
+        }
+        // The others are optional: not every PMU has them all
+        fds[INSTRUCTIONS] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, fds[CYCLES]);
+        fds[BRANCH_MISSES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, fds[CYCLES]);
+        fds[L1D_MISSES] = open(PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS), fds[CYCLES]);
+        fds[LLC_MISSES] = open(PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_MISS), fds[CYCLES]);
+#else
+        unavailable("not supported on this platform");
+#endif
+    }
+
+    ~Counters() {
+#ifdef __linux__
+        for (auto fd : fds) {
+            if (fd>=0) close(fd);
+        }
+#endif
+    }
+
+    Counters(const Counters&) = delete;
+    Counters& operator=(const Counters&) = delete;
+
+    bool available() const {
+        return fds[CYCLES]>=0;
+    }
+
+    void start() {
+#ifdef __linux__
+        if (!available()) return;
+        ioctl(fds[CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    // The counts since start(), scaled up if the kernel had to share the
+    // counters with others
+    Counts stop() {
+        Counts c;
+#ifdef __linux__
+        if (!available()) return c;
+        ioctl(fds[CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        uint64_t data[3+EVENTS];
+        if (read(fds[CYCLES], data, sizeof(data))<ssize_t(3*sizeof(uint64_t))) return c;
+        auto enabled = data[1];
+        auto running = data[2];
+        double scale = running>0 ? double(enabled)/running : 0.0;
+        // Values are in the order the events joined the group
+        std::size_t v = 3;
+        for (int e = 0; e<EVENTS && v<3+data[0]; ++e) {
+            if (fds[e]>=0) c.events[e] = data[v++]*scale;
+        }
+#endif
+        return c;
+    }
+};
+
+struct Result {
+    std::string name;
+    std::size_t ops = 0;   // Operations per run
+    double seconds = 0.0;  // Of the fastest run
+    Counts counts;         // Of the fastest run when counting events
+
+    double nsPerOp() const {
+        return ops ? seconds*1e9/ops : 0.0;
+    }
+
+    double opsPerSecond() const {
+        return seconds>0.0 ? ops/seconds : 0.0;
+    }
+};
+
+// Time f, which performs ops operations, keeping the fastest of several runs.
+// Events are only counted on the calling thread.
+template <typename F>
+Result run(const std::string& name, std::size_t ops, F&& f, unsigned runs = 3)
+{
+    using clock = std::chrono::steady_clock;
+    Result r{name, ops, 0.0, {}};
+    Counters counters;
+    for (unsigned i = 0; i<runs; ++i) {
+        counters.start();
+        auto start = clock::now();
+        f();
+        std::chrono::duration<double> d = clock::now()-start;
+        auto counts = counters.stop();
+        if (i==0 || d.count()<r.seconds) {
+            r.seconds = d.count();
+            r.counts = counts;
+        }
+    }
+    return r;
+}
+
+// Events per operation: cycles, instructions, instructions per cycle,
+// branch misses, L1 data and last level cache misses
+inline std::ostream& perOp(std::ostream& os, const Counts& c, std::size_t ops)
+{
+    if (!c.counted() || ops==0) return os;
+    auto column = [&](double count, const char* unit) {
+        os << std::setw(10);
+        if (count<0) os << "-";
+        else os << count/ops;
+        os << " " << unit;
+    };
+    os << std::fixed << std::setprecision(1);
+    column(c.events[CYCLES], "cyc");
+    column(c.events[INSTRUCTIONS], "ins");
+    os << std::setw(6) << std::setprecision(2);
+    if (c.events[INSTRUCTIONS]<0 || c.events[CYCLES]<=0) os << "-";
+    else os << c.events[INSTRUCTIONS]/c.events[CYCLES];
+    os << " IPC" << std::setprecision(3);
+    column(c.events[BRANCH_MISSES], "br-miss");
+    column(c.events[L1D_MISSES], "L1D-miss");
+    column(c.events[LLC_MISSES], "LLC-miss");
+    return os;
+}
+
+// The time each of a series of operations took
+class Latencies {
+    std::vector<double> ns;
+    bool sorted = true;
+
+public:
+    // Time one operation
+    template <typename F>
+    void time(F&& f) {
+        using clock = std::chrono::steady_clock;
+        auto start = clock::now();
+        f();
+        ns.push_back(std::chrono::duration<double, std::nano>(clock::now()-start).count());
+        sorted = false;
+    }
+
+    // Include the times of another series, from another thread say
+    void add(const Latencies& other) {
+        ns.insert(ns.end(), other.ns.begin(), other.ns.end());
+        sorted = ns.empty();
+    }
+
+    // p is a fraction: 0.5 for the median
+    double percentile(double p) {
+        if (ns.empty()) return 0.0;
+        if (!sorted) std::sort(ns.begin(), ns.end());
+        sorted = true;
+        auto i = std::size_t(p*(ns.size()-1) + 0.5);
+        return ns[std::min(i, ns.size()-1)];
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Result& r)
+{
+    os << std::left << std::setw(40) << r.name << std::right
+       << std::fixed << std::setprecision(1)
+       << std::setw(12) << r.nsPerOp() << " ns/op"
+       << std::setw(14) << std::setprecision(0) << r.opsPerSecond() << " op/s";
+    return perOp(os, r.counts, r.ops);
+}
+
+}
+
+#endif
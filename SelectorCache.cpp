@@ -0,0 +1,226 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorCache.h"
+
+#include "SelectorEnv.h"
+#include "SelectorExpression.h"
+#include "SelectorNode.h"
+#include "SelectorProbes.h"
+#include "SelectorValue.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::get;
+using std::make_unique;
+using std::ostream;
+using std::string;
+using std::string_view;
+using std::unique_ptr;
+using std::vector;
+
+namespace selector {
+
+namespace {
+
+inline uint64_t mix(uint64_t h, uint64_t v)
+{
+    h ^= v + 0x9e3779b97f4a7c15ull + (h<<6) + (h>>2);
+    return h;
+}
+
+inline uint64_t bits(double d)
+{
+    uint64_t b;
+    std::memcpy(&b, &d, sizeof(b));
+    return b;
+}
+
+inline uint64_t hash(const Value& v)
+{
+    switch (v.type()) {
+    case Value::T_BOOL:    return mix(Value::T_BOOL, get<bool>(v.value));
+    case Value::T_EXACT:   return mix(Value::T_EXACT, get<int64_t>(v.value));
+    case Value::T_INEXACT: return mix(Value::T_INEXACT, bits(get<double>(v.value)));
+    case Value::T_STRING:  return mix(Value::T_STRING, std::hash<string_view>{}(get<string_view>(v.value)));
+    default:               return Value::T_UNKNOWN;
+    }
+}
+
+// Keys must be identical, not just equal: 5 and 5.0 or 0.0 and -0.0 can
+// give different results
+inline bool identical(const Value& v1, const Value& v2)
+{
+    if (!sameType(v1, v2)) return false;
+    if (v1.type()==Value::T_INEXACT) return bits(get<double>(v1.value))==bits(get<double>(v2.value));
+    return v1.value==v2.value;
+}
+
+// The values the cache has already loaded for a message
+class FetchedEnv : public Env {
+    const vector<Value>& values;
+    const Env& message;
+
+public:
+    FetchedEnv(const vector<Value>& v, const Env& m) :
+        values(v),
+        message(m)
+    {}
+
+    const Value& fetched(std::size_t i) const {
+        return values[i];
+    }
+
+    const Value& value(const string_view name) const override {
+        return message.value(name);
+    }
+};
+
+// An identifier resolved to one of the cache's loaded values
+class FetchedIdentifier : public ValueExpression {
+    std::pmr::string name;
+    std::size_t i;
+
+public:
+    FetchedIdentifier(string_view n, std::size_t i0) :
+        name(n, NodeResource::current()),
+        i(i0)
+    {}
+
+    void repr(ostream& os) const {
+        os << "I:" << name;
+    }
+
+    // Only ever evaluated by the cache with a FetchedEnv
+    Value eval(const Env& env) const {
+        return static_cast<const FetchedEnv&>(env).fetched(i);
+    }
+
+    const std::pmr::string* identifierName() const {
+        return &name;
+    }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const FetchedIdentifier*>(&o);
+        return c && c->i==i;
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn&) const {
+        return make_unique<FetchedIdentifier>(name, i);
+    }
+
+    unique_ptr<ValueExpression> simplified(Context) const {
+        return make_unique<FetchedIdentifier>(name, i);
+    }
+};
+
+}
+
+ResultCache::ResultCache(const Expression& e, std::size_t sets) :
+    expression(e),
+    ids(identifiers(e))
+{
+    ValueExpression::CopyFn resolve = [&](const ValueExpression& v) -> unique_ptr<ValueExpression> {
+        auto name = v.identifierName();
+        if (!name) return v.copy(resolve);
+        return make_unique<FetchedIdentifier>(*name, std::find(ids.begin(), ids.end(), string_view{*name})-ids.begin());
+    };
+    fetched = resolve(static_cast<const ValueExpression&>(e));
+    std::size_t n = 1;
+    while (n<sets) n <<= 1;
+    entries.resize(2*n);
+    recent.resize(n);
+    values.resize(ids.size());
+    mask = n-1;
+}
+
+ResultCache::~ResultCache() = default;
+
+void ResultCache::clear()
+{
+    for (auto& e : entries) e.valid = false;
+    hits_ = 0;
+    misses_ = 0;
+}
+
+// Copy the current values into the entry, taking copies of any strings
+void ResultCache::store(Entry& e, uint64_t h, BoolOrNone result)
+{
+    e.hash = h;
+    e.valid = true;
+    e.result = result;
+    e.chars.clear();
+    for (auto& v : values) {
+        if (characters(v)) e.chars += get<string_view>(v.value);
+    }
+    e.key = values;
+    std::size_t offset = 0;
+    for (auto& v : e.key) {
+        if (!characters(v)) continue;
+        auto size = get<string_view>(v.value).size();
+        v = string_view{e.chars.data()+offset, size};
+        offset += size;
+    }
+}
+
+BoolOrNone ResultCache::eval_bool(const Env& env)
+{
+    SELECTOR_PROBE1(eval_start, &expression);
+    uint64_t h = 0;
+    for (std::size_t i = 0; i<ids.size(); ++i) {
+        values[i] = env.value(ids[i]);
+        h = mix(h, hash(values[i]));
+    }
+
+    auto set = h & mask;
+    for (unsigned way = 0; way<2; ++way) {
+        auto& e = entries[2*set+way];
+        if (!e.valid || e.hash!=h) continue;
+        bool match = true;
+        for (std::size_t i = 0; i<values.size() && match; ++i) {
+            match = identical(e.key[i], values[i]);
+        }
+        if (match) {
+            ++hits_;
+            recent[set] = way;
+            SELECTOR_PROBE2(eval_end, &expression, int(e.result));
+            return e.result;
+        }
+    }
+
+    ++misses_;
+    auto result = fetched->eval_bool(FetchedEnv{values, env});
+    // Replace the least recently used way
+    unsigned way = !recent[set];
+    store(entries[2*set+way], h, result);
+    recent[set] = way;
+    SELECTOR_PROBE2(eval_end, &expression, int(result));
+    return result;
+}
+
+}
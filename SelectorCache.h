@@ -0,0 +1,101 @@
+#ifndef SELECTOR_CACHE_H
+#define SELECTOR_CACHE_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorValue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+class Env;
+class Expression;
+
+/**
+ * Memoise the result of an expression keyed on the values of the
+ * properties it refers to.
+ *
+ * The cache is a small 2 way set associative table: evaluating a message
+ * whose referenced property values match a cached entry only loads those
+ * properties and returns the cached result. A miss evaluates the expression
+ * with the values it has already loaded.
+ *
+ * The expression must outlive the cache. A cache is not thread safe so
+ * use one per evaluating thread.
+ */
+class ResultCache {
+    struct Entry {
+        uint64_t hash = 0;
+        bool valid = false;
+        BoolOrNone result = BN_UNKNOWN;
+        std::vector<Value> key;
+        std::string chars; // Storage for the string values in key
+    };
+
+    const Expression& expression;
+    std::unique_ptr<Expression> fetched; // Reads values rather than the message
+    std::vector<std::string> ids;
+    std::vector<Entry> entries;
+    std::vector<bool> recent; // Which way of each set was used last
+    std::vector<Value> values;
+    std::size_t mask;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+
+    void store(Entry&, uint64_t hash, BoolOrNone);
+
+public:
+    // sets is rounded up to a power of 2
+    SELECTORS_EXPORT explicit ResultCache(const Expression&, std::size_t sets = 64);
+    SELECTORS_EXPORT ~ResultCache();
+
+    SELECTORS_EXPORT BoolOrNone eval_bool(const Env&);
+    bool eval(const Env& env) {
+        return eval_bool(env)==BN_TRUE;
+    }
+
+    SELECTORS_EXPORT void clear();
+
+    uint64_t hits() const {
+        return hits_;
+    }
+
+    uint64_t misses() const {
+        return misses_;
+    }
+
+    double hitRate() const {
+        auto total = hits_+misses_;
+        return total ? double(hits_)/total : 0.0;
+    }
+};
+
+}
+
+#endif
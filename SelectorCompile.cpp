@@ -0,0 +1,110 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorCompile.h"
+
+#include "SelectorExpression.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <memory_resource>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using std::shared_ptr;
+using std::size_t;
+using std::string_view;
+using std::vector;
+
+namespace selector {
+
+namespace {
+
+// Small enough to balance the threads, big enough that taking work is rare
+const size_t CHUNK = 64;
+
+}
+
+vector<CompiledSelector> compile_selectors(const string_view* texts, size_t count, size_t threads,
+                                           std::pmr::memory_resource* resource)
+{
+    // Which distinct text each input is
+    vector<string_view> distinct;
+    vector<size_t> which(count);
+    {
+        std::unordered_map<string_view, size_t> seen;
+        seen.reserve(count);
+        for (size_t i = 0; i<count; ++i) {
+            auto [it, added] = seen.try_emplace(texts[i], distinct.size());
+            if (added) distinct.push_back(texts[i]);
+            which[i] = it->second;
+        }
+    }
+
+    vector<CompiledSelector> compiled(distinct.size());
+    std::atomic<size_t> next{0};
+    auto work = [&] {
+        size_t begin;
+        while ((begin = next.fetch_add(CHUNK, std::memory_order_relaxed))<distinct.size()) {
+            auto end = std::min(begin+CHUNK, distinct.size());
+            // Roughly enough for the chunk, as make_arena_selector() reckons
+            shared_ptr<std::pmr::memory_resource> arena;
+            if (!resource) {
+                size_t bytes = 0;
+                for (size_t i = begin; i<end; ++i) bytes += 256 + 16*distinct[i].size();
+                arena = std::make_shared<std::pmr::monotonic_buffer_resource>(bytes);
+            }
+            for (size_t i = begin; i<end; ++i) {
+                try {
+                    auto e = make_selector(distinct[i], arena ? arena.get() : resource);
+                    if (arena) {
+                        // Each expression keeps the arena alive
+                        auto keep = [arena](const Expression* x) { delete x; };
+                        compiled[i].expression = shared_ptr<const Expression>{e.release(), keep};
+                    } else {
+                        compiled[i].expression = std::move(e);
+                    }
+                } catch (std::exception& e) {
+                    compiled[i].error = e.what();
+                }
+            }
+        }
+    };
+
+    if (threads==0) threads = std::max(std::thread::hardware_concurrency(), 1u);
+    threads = std::max<size_t>(std::min(threads, (distinct.size()+CHUNK-1)/CHUNK), 1);
+    vector<std::thread> workers;
+    for (size_t t = 1; t<threads; ++t) workers.emplace_back(work);
+    work();
+    for (auto& w : workers) w.join();
+
+    vector<CompiledSelector> results;
+    results.reserve(count);
+    for (auto i : which) results.push_back(compiled[i]);
+    return results;
+}
+
+}
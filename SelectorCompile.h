@@ -0,0 +1,76 @@
+#ifndef SELECTOR_COMPILE_H
+#define SELECTOR_COMPILE_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+class Expression;
+
+// The outcome of compiling one selector: if it didn't compile the expression
+// is null and error says why
+struct CompiledSelector {
+    std::shared_ptr<const Expression> expression;
+    std::string error;
+};
+
+/**
+ * Compile many selectors at once using several threads: threads is how many
+ * (including the caller's), 0 for one per core.
+ *
+ * Identical texts are compiled only once and share the same expression. The
+ * results are in the same order as the texts.
+ *
+ * Each thread compiles a chunk of selectors at a time into a monotonic arena
+ * of the chunk's own, which is released once none of its expressions are
+ * left. Given a resource, which must be thread safe, the expressions are
+ * allocated from it instead.
+ */
+SELECTORS_EXPORT std::vector<CompiledSelector> compile_selectors(const std::string_view* texts, std::size_t count,
+                                                                 std::size_t threads = 0,
+                                                                 std::pmr::memory_resource* resource = nullptr);
+
+inline std::vector<CompiledSelector> compile_selectors(const std::vector<std::string_view>& texts, std::size_t threads = 0,
+                                                       std::pmr::memory_resource* resource = nullptr)
+{
+    return compile_selectors(texts.data(), texts.size(), threads, resource);
+}
+
+inline std::vector<CompiledSelector> compile_selectors(const std::vector<std::string>& texts, std::size_t threads = 0,
+                                                       std::pmr::memory_resource* resource = nullptr)
+{
+    std::vector<std::string_view> views(texts.begin(), texts.end());
+    return compile_selectors(views.data(), views.size(), threads, resource);
+}
+
+}
+
+#endif
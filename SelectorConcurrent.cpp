@@ -0,0 +1,176 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorConcurrent.h"
+
+#include "SelectorEnv.h"
+#include "SelectorExpression.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using std::size_t;
+using std::unique_ptr;
+using std::vector;
+
+namespace selector {
+
+struct ConcurrentSelectorSet::Entry {
+    Id id;
+    unique_ptr<Expression> expression;
+};
+
+// The selectors in id order; entries belong to the set, not the snapshot
+struct ConcurrentSelectorSet::Snapshot {
+    vector<const Entry*> entries;
+};
+
+// The epoch a reader entered when it started matching, or 0 if it isn't
+// matching. Each slot has its own cache line so readers don't contend.
+struct alignas(64) ConcurrentSelectorSet::Slot {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> used{false};
+};
+
+namespace {
+
+const auto byId = [](auto* e, auto id) {
+    return e->id<id;
+};
+
+}
+
+ConcurrentSelectorSet::ConcurrentSelectorSet(size_t readers) :
+    current(new Snapshot),
+    slots(new Slot[readers]),
+    maxReaders(readers)
+{}
+
+ConcurrentSelectorSet::~ConcurrentSelectorSet()
+{
+    retired.clear();
+    auto s = current.load();
+    for (auto e : s->entries) delete e;
+    delete s;
+}
+
+ConcurrentSelectorSet::Id ConcurrentSelectorSet::subscribe(unique_ptr<Expression> expression)
+{
+    std::lock_guard<std::mutex> l{updates};
+    auto old = current.load();
+    auto s = std::make_unique<Snapshot>();
+    s->entries.reserve(old->entries.size()+1);
+    s->entries.insert(s->entries.end(), old->entries.begin(), old->entries.end());
+    auto id = nextId++;
+    s->entries.push_back(new Entry{id, std::move(expression)});
+    publish(std::move(s), nullptr);
+    return id;
+}
+
+bool ConcurrentSelectorSet::unsubscribe(Id id)
+{
+    std::lock_guard<std::mutex> l{updates};
+    auto old = current.load();
+    auto i = std::lower_bound(old->entries.begin(), old->entries.end(), id, byId);
+    if (i==old->entries.end() || (*i)->id!=id) return false;
+    auto s = std::make_unique<Snapshot>();
+    s->entries.reserve(old->entries.size()-1);
+    s->entries.insert(s->entries.end(), old->entries.begin(), i);
+    s->entries.insert(s->entries.end(), i+1, old->entries.end());
+    publish(std::move(s), std::shared_ptr<const Entry>(*i));
+    return true;
+}
+
+size_t ConcurrentSelectorSet::size()
+{
+    std::lock_guard<std::mutex> l{updates};
+    return current.load()->entries.size();
+}
+
+size_t ConcurrentSelectorSet::reclaim()
+{
+    std::lock_guard<std::mutex> l{updates};
+    return reclaimRetired();
+}
+
+// Called with the update lock held
+void ConcurrentSelectorSet::publish(unique_ptr<const Snapshot> s, std::shared_ptr<const void> removed)
+{
+    std::shared_ptr<const Snapshot> old{current.exchange(s.release())};
+    // Readers that enter from now on can only see the new snapshot
+    auto e = ++epoch;
+    retired.emplace_back(e, std::move(old));
+    if (removed) retired.emplace_back(e, std::move(removed));
+    reclaimRetired();
+}
+
+// Called with the update lock held
+size_t ConcurrentSelectorSet::reclaimRetired()
+{
+    auto oldest = epoch.load();
+    for (size_t i = 0; i<maxReaders; ++i) {
+        auto e = slots[i].epoch.load();
+        if (e!=0) oldest = std::min(oldest, e);
+    }
+    retired.erase(std::remove_if(retired.begin(), retired.end(), [=](auto& r) { return r.first<=oldest; }), retired.end());
+    return retired.size();
+}
+
+ConcurrentSelectorSet::Reader::Reader(ConcurrentSelectorSet& s) :
+    set(s),
+    slot([&]() -> Slot& {
+        for (size_t i = 0; i<s.maxReaders; ++i) {
+            bool used = false;
+            if (s.slots[i].used.compare_exchange_strong(used, true)) return s.slots[i];
+        }
+        throw std::range_error("Too many readers for selector set");
+    }())
+{}
+
+ConcurrentSelectorSet::Reader::~Reader()
+{
+    slot.used.store(false);
+}
+
+// A reader that has loaded the epoch but not yet announced it can't see
+// anything retired since: any update that retires something after the load
+// also publishes its replacement before checking the readers' epochs, so the
+// reader's load of the snapshot that follows its announcement sees the
+// replacement.
+void ConcurrentSelectorSet::Reader::match(const Env& message, vector<Id>& matched)
+{
+    matched.clear();
+    slot.epoch.store(set.epoch.load());
+    auto s = set.current.load();
+    for (auto e : s->entries) {
+        if (eval(*e->expression, message)) matched.push_back(e->id);
+    }
+    slot.epoch.store(0);
+}
+
+}
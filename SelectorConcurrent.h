@@ -0,0 +1,115 @@
+#ifndef SELECTOR_CONCURRENT_H
+#define SELECTOR_CONCURRENT_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+class Env;
+class Expression;
+
+/**
+ * A set of selectors that can change while other threads match against it.
+ *
+ * Matching threads each use their own Reader and never block or wait for
+ * each other or for updates. Updates copy the list of selectors and
+ * publish the copy for readers to pick up next time they match. Whatever an
+ * update replaced is kept until every reader that might still be looking at
+ * it has finished matching, and freed by a later update (or reclaim()).
+ *
+ * Updates are serialised among themselves and cost time proportional to
+ * the number of selectors in the set.
+ */
+class ConcurrentSelectorSet {
+public:
+    typedef uint64_t Id; // Allocated in increasing order starting from 0
+
+    class Reader;
+
+    SELECTORS_EXPORT explicit ConcurrentSelectorSet(std::size_t maxReaders = 64);
+    // There must be no readers left when the set is destroyed
+    SELECTORS_EXPORT ~ConcurrentSelectorSet();
+
+    ConcurrentSelectorSet(const ConcurrentSelectorSet&) = delete;
+    ConcurrentSelectorSet& operator=(const ConcurrentSelectorSet&) = delete;
+
+    SELECTORS_EXPORT Id subscribe(std::unique_ptr<Expression>);
+    SELECTORS_EXPORT bool unsubscribe(Id);
+
+    SELECTORS_EXPORT std::size_t size();
+
+    // Free what can be freed now and return how much is still waiting
+    SELECTORS_EXPORT std::size_t reclaim();
+
+private:
+    struct Entry;
+    struct Snapshot;
+    struct Slot;
+
+    std::atomic<const Snapshot*> current;
+    std::atomic<uint64_t> epoch{1};
+    std::unique_ptr<Slot[]> slots;
+    std::size_t maxReaders;
+
+    std::mutex updates;
+    Id nextId = 0;
+    // What each update replaced and the epoch it was replaced in
+    std::vector<std::pair<uint64_t, std::shared_ptr<const void>>> retired;
+
+    void publish(std::unique_ptr<const Snapshot>, std::shared_ptr<const void> removed);
+    std::size_t reclaimRetired();
+};
+
+/**
+ * A matching thread's access to a ConcurrentSelectorSet.
+ * Each reader must only be used by one thread at a time.
+ */
+class ConcurrentSelectorSet::Reader {
+    ConcurrentSelectorSet& set;
+    Slot& slot;
+
+public:
+    // Throws std::range_error if the set already has its maximum number of readers
+    SELECTORS_EXPORT explicit Reader(ConcurrentSelectorSet&);
+    SELECTORS_EXPORT ~Reader();
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // The ids of the selectors that match the message in increasing order
+    SELECTORS_EXPORT void match(const Env& message, std::vector<Id>& matched);
+};
+
+}
+
+#endif
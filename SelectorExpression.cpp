@@ -24,19 +24,35 @@
 #include "selectors.h"
 
 #include "SelectorEnv.h"
+#include "SelectorFlat.h"
+#include "SelectorIncremental.h"
+#include "SelectorIndex.h"
+#include "SelectorIntern.h"
+#include "SelectorNode.h"
+#include "SelectorProbes.h"
+#include "SelectorProfile.h"
+#include "SelectorShape.h"
 #include "SelectorToken.h"
 #include "SelectorValue.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <cerrno> // Need to use errno in checking return from strtoull()/strtod()
+#include <functional>
+#include <iomanip>
 #include <memory>
+#include <memory_resource>
+#include <new>
 #include <ostream>
-#include <regex>
+#include <sstream>
 #include <string>
 #include <string_view>
 #include <type_traits>
-#include <sstream>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
 #include <vector>
 
 using std::enable_if;
@@ -44,7 +60,6 @@ using std::make_unique;
 using std::ostream;
 using std::string;
 using std::string_view;
-using std::ostringstream;
 using std::unique_ptr;
 using std::vector;
 
@@ -265,27 +280,80 @@ constexpr auto negate = UnaryArithmeticOperator{"-", operator-};
 
 Expression::~Expression() noexcept = default;
 
-class ValueExpression : public Expression {
-public:
-  virtual ~ValueExpression() noexcept = default;
-  virtual void repr(ostream&) const = 0;
-  virtual Value eval(const Env&) const = 0;
-  
-  virtual BoolOrNone eval_bool(const Env& env) const {
-    return eval(env);
-  }
+// Before each node: the resource it came from and whether the node is the
+// root of an expression that owns that resource
+struct alignas(std::max_align_t) NodeHeader {
+    std::pmr::memory_resource* resource;
+    bool owner;
 };
 
-class BoolExpression : public ValueExpression {
-public:
-  virtual ~BoolExpression() noexcept = default;
-  virtual void repr(ostream&) const = 0;
-  virtual BoolOrNone eval_bool(const Env&) const = 0;
-  
-  Value eval(const Env& env) const {
-    return eval_bool(env);
-  }
-};
+static thread_local std::pmr::memory_resource* nodeResource = nullptr;
+
+NodeResource::NodeResource(std::pmr::memory_resource* resource) :
+    previous(nodeResource)
+{
+    nodeResource = resource;
+}
+
+NodeResource::~NodeResource()
+{
+    nodeResource = previous;
+}
+
+std::pmr::memory_resource* NodeResource::current()
+{
+    return nodeResource ? nodeResource : std::pmr::get_default_resource();
+}
+
+void* ValueExpression::operator new(std::size_t size)
+{
+    WorkCounter::add(1);
+    auto resource = NodeResource::current();
+    auto h = static_cast<NodeHeader*>(resource->allocate(sizeof(NodeHeader)+size, alignof(NodeHeader)));
+    h->resource = resource;
+    h->owner = false;
+    return h+1;
+}
+
+void ValueExpression::operator delete(void* p, std::size_t size) noexcept
+{
+    auto h = static_cast<NodeHeader*>(p)-1;
+    auto resource = h->resource;
+    bool owner = h->owner;
+    resource->deallocate(h, sizeof(NodeHeader)+size, alignof(NodeHeader));
+    // The rest of the tree has gone already
+    if (owner) delete resource;
+}
+
+// The operands of an IN or NOT IN
+using NodeList = std::pmr::vector<unique_ptr<ValueExpression>>;
+
+// The indexed property named by e, if it is one
+static const std::pmr::string* indexedIdentifier(const ValueExpression& e, const vector<string_view>& indexed)
+{
+    auto i = e.identifierName();
+    if (i && std::find(indexed.begin(), indexed.end(), *i)!=indexed.end()) return i;
+    return nullptr;
+}
+
+template <class L>
+static bool sameList(const L& l1, const L& l2)
+{
+    return std::equal(l1.begin(), l1.end(), l2.begin(), l2.end(),
+        [](auto& e1, auto& e2) { return e1->same(*e2); });
+}
+
+static unique_ptr<ValueExpression> inContext(unique_ptr<ValueExpression> e, Context c);
+static unique_ptr<ValueExpression> fold(unique_ptr<ValueExpression> e, Context c, bool constant);
+static unique_ptr<ValueExpression> junction(bool conjunction, vector<unique_ptr<ValueExpression>>&& terms, Context c);
+
+// Is the value of this expression always a boolean or unknown
+static bool boolean(const ValueExpression& e)
+{
+    Value v;
+    if (e.literal(v)) return v.type()==Value::T_BOOL || unknown(v);
+    return dynamic_cast<const BoolExpression*>(&e);
+}
 
 // Boolean Expression types...
 
@@ -308,6 +376,73 @@ public:
     BoolOrNone eval_bool(const Env& env) const {
         return op.eval(*e1, *e2, env);
     }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const ComparisonExpression*>(&o);
+        return c && &c->op==&op && c->e1->same(*e1) && c->e2->same(*e2);
+    }
+
+    void children(vector<const ValueExpression*>& cs) const {
+        cs.push_back(e1.get());
+        cs.push_back(e2.get());
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn& child) const {
+        return make_unique<ComparisonExpression>(op, child(*e1), child(*e2));
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        auto f = &op==&eqOp ? F_EQ : &op==&neqOp ? F_NEQ : &op==&lsOp ? F_LESS :
+                 &op==&grOp ? F_GRT : &op==&lseqOp ? F_LSEQ : F_GREQ;
+        return w.write(at, f, {e1.get(), e2.get()});
+    }
+
+    bool keySet(KeySet& k) const {
+        // Normalise to <identifier> op <literal>
+        const ComparisonOperator* o = &op;
+        Value v;
+        auto i = e1->identifierName();
+        if (i) {
+            if (!e2->literal(v)) return false;
+        } else if ((i = e2->identifierName())) {
+            if (!e1->literal(v)) return false;
+            if (o==&lsOp) o = &grOp;
+            else if (o==&grOp) o = &lsOp;
+            else if (o==&lseqOp) o = &greqOp;
+            else if (o==&greqOp) o = &lseqOp;
+        } else {
+            return false;
+        }
+
+        // Comparing with unknown is always unknown, and the complement of
+        // a key set is not a key set
+        if (unknown(v) || o==&neqOp) return false;
+
+        k = KeySet{string{*i}, {}, {}};
+        if (o==&eqOp) {
+            k.points.push_back(v);
+            return true;
+        }
+        // Ordering comparisons are always false for non numeric values
+        if (!numeric(v)) return true;
+        KeyRange r;
+        if (o==&lsOp || o==&lseqOp) {
+            r.upper = v;
+            r.upperInclusive = o==&lseqOp;
+        } else {
+            r.lower = v;
+            r.lowerInclusive = o==&greqOp;
+        }
+        k.ranges.push_back(r);
+        return true;
+    }
+
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        auto s1 = e1->simplified(C_VALUE);
+        auto s2 = e2->simplified(C_VALUE);
+        bool constant = isLiteral(*s1) && isLiteral(*s2);
+        return fold(make_unique<ComparisonExpression>(op, std::move(s1), std::move(s2)), c, constant);
+    }
 };
 
 class OrExpression : public BoolExpression {
@@ -332,6 +467,64 @@ public:
         if (bn1==BN_FALSE && bn2==BN_FALSE) return BN_FALSE;
         else return BN_UNKNOWN;
     }
+
+    IndexPlan indexPlan(const vector<string_view>& indexed) const {
+        return planOr(e1->indexPlan(indexed), e2->indexPlan(indexed));
+    }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const OrExpression*>(&o);
+        return c && c->e1->same(*e1) && c->e2->same(*e2);
+    }
+
+    void children(vector<const ValueExpression*>& cs) const {
+        cs.push_back(e1.get());
+        cs.push_back(e2.get());
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn& child) const {
+        return make_unique<OrExpression>(child(*e1), child(*e2));
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        return w.write(at, F_OR, {e1.get(), e2.get()});
+    }
+
+    // The operands of this and any directly nested OR
+    void operands(vector<const ValueExpression*>& ops) const {
+        for (auto e : {e1.get(), e2.get()}) {
+            if (auto o = dynamic_cast<const OrExpression*>(e)) o->operands(ops);
+            else ops.push_back(e);
+        }
+    }
+
+    void release(vector<unique_ptr<ValueExpression>>& ops) {
+        ops.push_back(std::move(e1));
+        ops.push_back(std::move(e2));
+    }
+
+    // A long chain of ORs is simplified in one go: simplifying each nested
+    // OR in turn costs time cubic in its length
+    vector<const ValueExpression*> chain() const {
+        vector<const ValueExpression*> ops;
+        operands(ops);
+        return ops;
+    }
+
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        auto tc = c==C_MATCH ? C_MATCH : C_BOOL;
+        vector<unique_ptr<ValueExpression>> terms;
+        for (auto e : chain()) terms.push_back(e->simplified(tc));
+        return junction(false, std::move(terms), c);
+    }
+
+    // NOT (a OR b) is NOT a AND NOT b
+    unique_ptr<ValueExpression> negated(Context c) const {
+        auto tc = c==C_MATCH ? C_MATCH : C_BOOL;
+        vector<unique_ptr<ValueExpression>> terms;
+        for (auto e : chain()) terms.push_back(e->negated(tc));
+        return junction(true, std::move(terms), c);
+    }
 };
 
 class AndExpression : public BoolExpression {
@@ -356,6 +549,64 @@ public:
         if (bn1==BN_TRUE && bn2==BN_TRUE) return BN_TRUE;
         else return BN_UNKNOWN;
     }
+
+    IndexPlan indexPlan(const vector<string_view>& indexed) const {
+        return planAnd(e1->indexPlan(indexed), e2->indexPlan(indexed));
+    }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const AndExpression*>(&o);
+        return c && c->e1->same(*e1) && c->e2->same(*e2);
+    }
+
+    void children(vector<const ValueExpression*>& cs) const {
+        cs.push_back(e1.get());
+        cs.push_back(e2.get());
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn& child) const {
+        return make_unique<AndExpression>(child(*e1), child(*e2));
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        return w.write(at, F_AND, {e1.get(), e2.get()});
+    }
+
+    // The operands of this and any directly nested AND
+    void operands(vector<const ValueExpression*>& ops) const {
+        for (auto e : {e1.get(), e2.get()}) {
+            if (auto a = dynamic_cast<const AndExpression*>(e)) a->operands(ops);
+            else ops.push_back(e);
+        }
+    }
+
+    void release(vector<unique_ptr<ValueExpression>>& ops) {
+        ops.push_back(std::move(e1));
+        ops.push_back(std::move(e2));
+    }
+
+    // A long chain of ANDs is simplified in one go: simplifying each nested
+    // AND in turn costs time cubic in its length
+    vector<const ValueExpression*> chain() const {
+        vector<const ValueExpression*> ops;
+        operands(ops);
+        return ops;
+    }
+
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        auto tc = c==C_MATCH ? C_MATCH : C_BOOL;
+        vector<unique_ptr<ValueExpression>> terms;
+        for (auto e : chain()) terms.push_back(e->simplified(tc));
+        return junction(true, std::move(terms), c);
+    }
+
+    // NOT (a AND b) is NOT a OR NOT b
+    unique_ptr<ValueExpression> negated(Context c) const {
+        auto tc = c==C_MATCH ? C_MATCH : C_BOOL;
+        vector<unique_ptr<ValueExpression>> terms;
+        for (auto e : chain()) terms.push_back(e->negated(tc));
+        return junction(false, std::move(terms), c);
+    }
 };
 
 class UnaryBooleanExpression : public BoolExpression {
@@ -375,91 +626,115 @@ public:
     BoolOrNone eval_bool(const Env& env) const {
         return op.eval(*e1, env);
     }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const UnaryBooleanExpression*>(&o);
+        return c && &c->op==&op && c->e1->same(*e1);
+    }
+
+    void children(vector<const ValueExpression*>& cs) const {
+        cs.push_back(e1.get());
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn& child) const {
+        return make_unique<UnaryBooleanExpression>(op, child(*e1));
+    }
+
+    // The identifier tested if this is IS NULL or IS NOT NULL of one
+    const std::pmr::string* nullTest(bool& isNull) const {
+        if (&op==&notOp) return nullptr;
+        isNull = &op==&isNullOp;
+        return e1->identifierName();
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        auto f = &op==&notOp ? F_NOT : &op==&isNullOp ? F_ISNULL : F_ISNONNULL;
+        return w.write(at, f, {e1.get()});
+    }
+
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        if (&op==&notOp) return e1->negated(c);
+        auto s = e1->simplified(C_VALUE);
+        bool constant = isLiteral(*s);
+        return fold(make_unique<UnaryBooleanExpression>(op, std::move(s)), c, constant);
+    }
+
+    // IS NULL and IS NOT NULL are never unknown so negate each other exactly;
+    // NOT NOT a is a as long as a is only used for its boolean value
+    unique_ptr<ValueExpression> negated(Context c) const {
+        if (&op==&isNullOp || &op==&isNonNullOp) {
+            auto s = e1->simplified(C_VALUE);
+            bool constant = isLiteral(*s);
+            return fold(make_unique<UnaryBooleanExpression>(&op==&isNullOp ? isNonNullOp : isNullOp, std::move(s)), c, constant);
+        }
+        if (c!=C_VALUE || dynamic_cast<const BoolExpression*>(e1.get())) return e1->simplified(c);
+        return ValueExpression::negated(c);
+    }
 };
 
 class LikeExpression : public BoolExpression {
     unique_ptr<ValueExpression> e;
-    string reString;
-    std::regex regexBuffer;
-
-    static string toRegex(const string& s, const string& escape) {
-        string regex("^");
-        if (escape.size()>1) throw std::logic_error("Internal error");
-        char e = 0;
-        if (escape.size()==1) {
-            e = escape[0];
-        }
-        // Translate % -> .*, _ -> ., . ->\. *->\*
-        bool doEscape = false;
-        for (auto& i : s) {
-            if ( e!=0 && i==e ) {
-                doEscape = true;
-                continue;
-            }
-            switch(i) {
-                case '%':
-                    if (doEscape) regex += i;
-                    else regex += ".*";
-                    break;
-                case '_':
-                    if (doEscape) regex += i;
-                    else regex += ".";
-                    break;
-                case ']':
-                case '{':
-                case '}':
-                case '(':
-                case ')':
-                case '-':
-                case '+':
-                case '?':
-                case '|':
-                    regex += '[';
-                    regex += i;
-                    regex += ']';
-                    break;
-                // Don't add any more cases here: these are sufficient,
-                // adding more might turn on inadvertent matching
-                case '\\':
-                case '^':
-                case '$':
-                case '.':
-                case '*':
-                case '[':
-                    regex += "\\";
-                    // Fallthrough
-                default:
-                    regex += i;
-                    break;
-            }
-            doEscape = false;
-        }
-        regex += "$";
-        return regex;
-    }
+    std::pmr::string pattern;
+    char escape;
+    std::pmr::string elements; // The compiled pattern, which matches without allocating
 
 public:
-    LikeExpression(unique_ptr<ValueExpression> e_, const string& like, const string& escape="")
-    try :
+    LikeExpression(unique_ptr<ValueExpression> e_, string_view like, string_view escape_="") :
         e(std::move(e_)),
-        reString(toRegex(like, escape)),
-        regexBuffer(reString, std::regex::basic)
-    {}
-    catch (std::regex_error& e) {
-        ostringstream o("Regex Internal error: code=");
-        o << e.code() << std::ends;
-        throw std::logic_error(o.str());
+        pattern(like, NodeResource::current()),
+        escape(escape_.empty() ? 0 : escape_[0]),
+        elements(likeElements(like, escape, NodeResource::current()))
+    {
+        if (escape_.size()>1) throw std::logic_error("Internal error");
     }
 
+    // The same pattern applied to a different expression
+    LikeExpression(unique_ptr<ValueExpression> e_, const LikeExpression& l) :
+        e(std::move(e_)),
+        pattern(l.pattern, NodeResource::current()),
+        escape(l.escape),
+        elements(l.elements, NodeResource::current())
+    {}
+
     void repr(ostream& os) const {
-        os << *e << " REGEX_MATCH '" << reString << "'";
+        os << *e << " LIKE '" << pattern << "'";
+        if (escape!=0) os << " ESCAPE '" << escape << "'";
     }
 
     BoolOrNone eval_bool(const Env& env) const {
         Value v(e->eval(env));
         if ( v.type()!=Value::T_STRING ) return BN_UNKNOWN;
-        auto sv = std::get<string_view>(v.value);
-        return BoolOrNone(std::regex_match(sv.cbegin(), sv.cend(), regexBuffer));
+        return BoolOrNone(likeMatch(std::get<string_view>(v.value), elements));
+    }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const LikeExpression*>(&o);
+        return c && c->elements==elements && c->e->same(*e);
+    }
+
+    void children(vector<const ValueExpression*>& cs) const {
+        cs.push_back(e.get());
+    }
+
+    // Matching a pattern costs far more than any other node
+    std::size_t cost() const {
+        return 16 + e->cost();
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn& child) const {
+        return make_unique<LikeExpression>(child(*e), *this);
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        if (!w.write(at, F_LIKE, {e.get()})) return false;
+        w.likePattern(at, elements);
+        return true;
+    }
+
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        auto s = e->simplified(C_VALUE);
+        bool constant = isLiteral(*s);
+        return fold(make_unique<LikeExpression>(std::move(s), *this), c, constant);
     }
 };
 
@@ -486,14 +761,103 @@ public:
         if (unknown(ve) || unknown(vl) || unknown(vu)) return BN_UNKNOWN;
         return BoolOrNone(ve>=vl && ve<=vu);
     }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const BetweenExpression*>(&o);
+        return c && c->e->same(*e) && c->l->same(*l) && c->u->same(*u);
+    }
+
+    void children(vector<const ValueExpression*>& cs) const {
+        cs.push_back(e.get());
+        cs.push_back(l.get());
+        cs.push_back(u.get());
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn& child) const {
+        return make_unique<BetweenExpression>(child(*e), child(*l), child(*u));
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        return w.write(at, F_BETWEEN, {e.get(), l.get(), u.get()});
+    }
+
+    bool keySet(KeySet& k) const {
+        auto i = e->identifierName();
+        Value vl;
+        Value vu;
+        if (!i || !l->literal(vl) || !u->literal(vu) || unknown(vl) || unknown(vu)) return false;
+        k = KeySet{string{*i}, {}, {}};
+        // Always false for non numeric values
+        if (numeric(vl) && numeric(vu)) k.ranges.push_back(KeyRange{vl, vu, true, true});
+        return true;
+    }
+
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        auto se = e->simplified(C_VALUE);
+        auto sl = l->simplified(C_VALUE);
+        auto su = u->simplified(C_VALUE);
+        bool constant = isLiteral(*se) && isLiteral(*sl) && isLiteral(*su);
+        return fold(make_unique<BetweenExpression>(std::move(se), std::move(sl), std::move(su)), c, constant);
+    }
 };
 
+// Equal literals have equal hashes: 0.0 and -0.0 included
+static std::size_t literalHash(const Value& v)
+{
+    std::size_t h;
+    switch (v.type()) {
+    case Value::T_BOOL:    h = std::get<bool>(v.value); break;
+    case Value::T_EXACT:   h = std::hash<int64_t>{}(std::get<int64_t>(v.value)); break;
+    case Value::T_INEXACT: h = std::hash<double>{}(std::get<double>(v.value)); break;
+    case Value::T_STRING:  h = std::hash<string_view>{}(std::get<string_view>(v.value)); break;
+    default:               h = 0;
+    }
+    return h ^ v.type();
+}
+
+// A hash of e's structure near its root, which same() expressions share: it
+// looks no deeper so that hashing every term of a junction stays linear
+static std::size_t structuralHash(const ValueExpression& e, int depth = 3)
+{
+    std::size_t h = std::type_index(typeid(e)).hash_code();
+    Value v;
+    if (e.literal(v)) return h ^ literalHash(v);
+    if (auto i = e.identifierName()) return h ^ std::hash<string_view>{}(*i);
+    if (--depth==0) return h;
+    vector<const ValueExpression*> cs;
+    e.children(cs);
+    for (auto c : cs) h = h*31 + structuralHash(*c, depth);
+    return h;
+}
+
+// Simplify the operands of an IN or NOT IN removing duplicate list entries
+static bool simplifyList(const ValueExpression& e, const NodeList& l,
+                         unique_ptr<ValueExpression>& se, NodeList& sl)
+{
+    se = e.simplified(C_VALUE);
+    bool constant = isLiteral(*se);
+    // Duplicates are found by hashing: comparing each element with all the
+    // others is quadratic
+    std::unordered_multimap<std::size_t, const ValueExpression*> seen;
+    for (auto& le : l) {
+        auto s = le->simplified(C_VALUE);
+        auto h = structuralHash(*s);
+        auto [first, last] = seen.equal_range(h);
+        WorkCounter::add(std::distance(first, last));
+        if (std::any_of(first, last, [&](const auto& x) { return x.second->same(*s); })) continue;
+        seen.emplace(h, s.get());
+        if (!isLiteral(*s)) constant = false;
+        sl.push_back(std::move(s));
+    }
+    return constant;
+}
+
 class InExpression : public BoolExpression {
     unique_ptr<ValueExpression> e;
-    vector<unique_ptr<ValueExpression>> l;
+    NodeList l;
 
 public:
-    InExpression(unique_ptr<ValueExpression> e_, vector<unique_ptr<ValueExpression>>&& l_) :
+    InExpression(unique_ptr<ValueExpression> e_, NodeList&& l_) :
         e(std::move(e_)),
         l(std::move(l_))
     {}
@@ -519,14 +883,57 @@ public:
         }
         return r;
     }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const InExpression*>(&o);
+        return c && c->e->same(*e) && sameList(c->l, l);
+    }
+
+    void children(vector<const ValueExpression*>& cs) const {
+        cs.push_back(e.get());
+        for (auto& le : l) cs.push_back(le.get());
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn& child) const {
+        NodeList cl{NodeResource::current()};
+        for (auto& le : l) cl.push_back(child(*le));
+        return make_unique<InExpression>(child(*e), std::move(cl));
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        vector<const ValueExpression*> cs;
+        children(cs);
+        return w.write(at, F_IN, cs);
+    }
+
+    bool keySet(KeySet& k) const {
+        auto i = e->identifierName();
+        if (!i) return false;
+        k = KeySet{string{*i}, {}, {}};
+        for (auto& le : l) {
+            Value v;
+            if (!le->literal(v) || unknown(v)) return false;
+            k.points.push_back(v);
+        }
+        return true;
+    }
+
+    // A single element IN is the same as =
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        unique_ptr<ValueExpression> se;
+        NodeList sl{NodeResource::current()};
+        bool constant = simplifyList(*e, l, se, sl);
+        if (sl.size()==1) return fold(make_unique<ComparisonExpression>(eqOp, std::move(se), std::move(sl[0])), c, constant);
+        return fold(make_unique<InExpression>(std::move(se), std::move(sl)), c, constant);
+    }
 };
 
 class NotInExpression : public BoolExpression {
     unique_ptr<ValueExpression> e;
-    vector<unique_ptr<ValueExpression>> l;
+    NodeList l;
 
 public:
-    NotInExpression(unique_ptr<ValueExpression> e_, vector<unique_ptr<ValueExpression>>&& l_) :
+    NotInExpression(unique_ptr<ValueExpression> e_, NodeList&& l_) :
         e(std::move(e_)),
         l(std::move(l_))
     {}
@@ -561,6 +968,37 @@ public:
         }
         return r;
     }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const NotInExpression*>(&o);
+        return c && c->e->same(*e) && sameList(c->l, l);
+    }
+
+    void children(vector<const ValueExpression*>& cs) const {
+        cs.push_back(e.get());
+        for (auto& le : l) cs.push_back(le.get());
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn& child) const {
+        NodeList cl{NodeResource::current()};
+        for (auto& le : l) cl.push_back(child(*le));
+        return make_unique<NotInExpression>(child(*e), std::move(cl));
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        vector<const ValueExpression*> cs;
+        children(cs);
+        return w.write(at, F_NOTIN, cs);
+    }
+
+    // A single element NOT IN is the same as <>
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        unique_ptr<ValueExpression> se;
+        NodeList sl{NodeResource::current()};
+        bool constant = simplifyList(*e, l, se, sl);
+        if (sl.size()==1) return fold(make_unique<ComparisonExpression>(neqOp, std::move(se), std::move(sl[0])), c, constant);
+        return fold(make_unique<NotInExpression>(std::move(se), std::move(sl)), c, constant);
+    }
 };
 
 // Arithmetic Expression types
@@ -584,6 +1022,37 @@ public:
     Value eval(const Env& env) const {
         return op.eval(*e1, *e2, env);
     }
+
+    // Arithmetic results are never true
+    IndexPlan indexPlan(const vector<string_view>&) const {
+        return noScan();
+    }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const ArithmeticExpression*>(&o);
+        return c && &c->op==&op && c->e1->same(*e1) && c->e2->same(*e2);
+    }
+
+    void children(vector<const ValueExpression*>& cs) const {
+        cs.push_back(e1.get());
+        cs.push_back(e2.get());
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn& child) const {
+        return make_unique<ArithmeticExpression>(op, child(*e1), child(*e2));
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        auto f = &op==&add ? F_ADD : &op==&sub ? F_SUB : &op==&mult ? F_MULT : F_DIV;
+        return w.write(at, f, {e1.get(), e2.get()});
+    }
+
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        auto s1 = e1->simplified(C_VALUE);
+        auto s2 = e2->simplified(C_VALUE);
+        bool constant = isLiteral(*s1) && isLiteral(*s2);
+        return fold(make_unique<ArithmeticExpression>(op, std::move(s1), std::move(s2)), c, constant);
+    }
 };
 
 class UnaryArithExpression : public ValueExpression {
@@ -603,6 +1072,33 @@ public:
     Value eval(const Env& env) const {
         return op.eval(*e1, env);
     }
+
+    IndexPlan indexPlan(const vector<string_view>&) const {
+        return noScan();
+    }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const UnaryArithExpression*>(&o);
+        return c && &c->op==&op && c->e1->same(*e1);
+    }
+
+    void children(vector<const ValueExpression*>& cs) const {
+        cs.push_back(e1.get());
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn& child) const {
+        return make_unique<UnaryArithExpression>(op, child(*e1));
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        return w.write(at, F_NEGATE, {e1.get()});
+    }
+
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        auto s = e1->simplified(C_VALUE);
+        bool constant = isLiteral(*s);
+        return fold(make_unique<UnaryArithExpression>(op, std::move(s)), c, constant);
+    }
 };
 
 // Expression types...
@@ -623,31 +1119,88 @@ public:
     Value eval(const Env&) const {
         return value;
     }
+
+    bool literal(Value& v) const {
+        v = value;
+        return true;
+    }
+
+    IndexPlan indexPlan(const vector<string_view>&) const {
+        return BoolOrNone(value)==BN_TRUE ? IndexPlan{} : noScan();
+    }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const Literal*>(&o);
+        return c && c->value.value==value.value;
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn&) const {
+        return make_unique<Literal>(value);
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        w.literal(at, value);
+        return true;
+    }
+
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        return inContext(make_unique<Literal>(value), c);
+    }
 };
 
+// The text of string literals is interned, so equal literals share it, and
+// comparing one with an interned value (say a string set through the C
+// interface) compares only the pointers
 class StringLiteral : public ValueExpression {
-    const string value;
+    const InternedString text;
 
 public:
     StringLiteral(string_view v) :
-        value(v)
+        text(v)
     {}
 
     void repr(ostream& os) const {
-        os << "'" << value << "'";
+        os << "'" << text.view() << "'";
     }
 
     Value eval(const Env&) const {
-        return string_view{value};
+        return text.value();
+    }
+
+    bool literal(Value& v) const {
+        v = text.value();
+        return true;
+    }
+
+    IndexPlan indexPlan(const vector<string_view>&) const {
+        return noScan();
+    }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const StringLiteral*>(&o);
+        return c && c->text.view().data()==text.view().data();
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn&) const {
+        return make_unique<StringLiteral>(*this);
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        w.literal(at, text.view());
+        return true;
+    }
+
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        return inContext(make_unique<StringLiteral>(*this), c);
     }
 };
 
 class Identifier : public ValueExpression {
-    string identifier;
+    std::pmr::string identifier;
 
 public:
-    Identifier(const string& i) :
-        identifier(i)
+    Identifier(string_view i) :
+        identifier(i, NodeResource::current())
     {}
 
     void repr(ostream& os) const {
@@ -657,10 +1210,526 @@ public:
     Value eval(const Env& env) const {
         return env.value(identifier);
     }
+
+    const std::pmr::string* identifierName() const {
+        return &identifier;
+    }
+
+    // Only true if the property is boolean true
+    IndexPlan indexPlan(const vector<string_view>& indexed) const {
+        if (!indexedIdentifier(*this, indexed)) return IndexPlan{};
+        return keyScan(KeySet{string{identifier}, {true}, {}});
+    }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const Identifier*>(&o);
+        return c && c->identifier==identifier;
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn&) const {
+        return make_unique<Identifier>(identifier);
+    }
+
+    bool flatten(FlatWriter& w, uint32_t at) const {
+        w.identifier(at, identifier);
+        return true;
+    }
+
+    unique_ptr<ValueExpression> simplified(Context) const {
+        return make_unique<Identifier>(identifier);
+    }
 };
 
 ////////////////////////////////////////////////////
 
+// Simplification
+
+class EmptyEnv : public Env {
+    const Value& value(const string_view) const override {
+        static const Value EMPTY{};
+        return EMPTY;
+    }
+};
+
+// Reduce a literal to the part of its value that the context needs
+static unique_ptr<ValueExpression> inContext(unique_ptr<ValueExpression> e, Context c)
+{
+    Value v;
+    if (c==C_VALUE || !e->literal(v)) return e;
+    BoolOrNone b(v);
+    if (c==C_MATCH) return make_unique<Literal>(b==BN_TRUE);
+    return make_unique<Literal>(b);
+}
+
+// Replace an expression of only literals by its value and one that can never be
+// true by false if that is all that matters
+static unique_ptr<ValueExpression> fold(unique_ptr<ValueExpression> e, Context c, bool constant)
+{
+    if (constant) {
+        Value v = e->eval(EmptyEnv{});
+        // String values refer to the expression itself
+        if (!characters(v)) e = make_unique<Literal>(v);
+    }
+    if (c==C_MATCH) {
+        KeySet k;
+        if (e->keySet(k)) {
+            normalise(k);
+            if (k.points.empty() && k.ranges.empty()) return make_unique<Literal>(false);
+        }
+    }
+    return inContext(std::move(e), c);
+}
+
+unique_ptr<ValueExpression> ValueExpression::negated(Context c) const
+{
+    auto e = simplified(C_BOOL);
+    Value v;
+    if (e->literal(v)) return inContext(make_unique<Literal>(!v), c);
+    return make_unique<UnaryBooleanExpression>(notOp, std::move(e));
+}
+
+static unique_ptr<ValueExpression> literalExpression(const Value& v)
+{
+    if (characters(v)) return make_unique<StringLiteral>(std::get<string_view>(v.value));
+    return make_unique<Literal>(v);
+}
+
+// A single expression for "identifier has a value in the key set" if there is one
+static unique_ptr<ValueExpression> keyExpression(const KeySet& k)
+{
+    auto identifier = [&]() { return make_unique<Identifier>(k.identifier); };
+    if (k.ranges.empty()) {
+        if (k.points.size()==1) return make_unique<ComparisonExpression>(eqOp, identifier(), literalExpression(k.points[0]));
+        NodeList l{NodeResource::current()};
+        for (auto& p : k.points) l.push_back(literalExpression(p));
+        return make_unique<InExpression>(identifier(), std::move(l));
+    }
+    if (!k.points.empty() || k.ranges.size()>1) return nullptr;
+    auto& r = k.ranges[0];
+    if (unknown(r.lower) && unknown(r.upper)) return nullptr;
+    if (unknown(r.lower)) return make_unique<ComparisonExpression>(r.upperInclusive ? lseqOp : lsOp, identifier(), literalExpression(r.upper));
+    if (unknown(r.upper)) return make_unique<ComparisonExpression>(r.lowerInclusive ? greqOp : grOp, identifier(), literalExpression(r.lower));
+    if (r.lowerInclusive && r.upperInclusive) {
+        return make_unique<BetweenExpression>(identifier(), literalExpression(r.lower), literalExpression(r.upper));
+    }
+    return make_unique<AndExpression>(
+        make_unique<ComparisonExpression>(r.lowerInclusive ? greqOp : grOp, identifier(), literalExpression(r.lower)),
+        make_unique<ComparisonExpression>(r.upperInclusive ? lseqOp : lsOp, identifier(), literalExpression(r.upper)));
+}
+
+// The operands of e if it is an AND (conjunction) or an OR
+static bool junctionOperands(bool conjunction, const ValueExpression& e, vector<const ValueExpression*>& ops)
+{
+    if (conjunction) {
+        auto a = dynamic_cast<const AndExpression*>(&e);
+        if (a) a->operands(ops);
+        return a;
+    } else {
+        auto o = dynamic_cast<const OrExpression*>(&e);
+        if (o) o->operands(ops);
+        return o;
+    }
+}
+
+static void flatten(bool conjunction, unique_ptr<ValueExpression> e, vector<unique_ptr<ValueExpression>>& terms)
+{
+    vector<unique_ptr<ValueExpression>> ops;
+    if (conjunction) {
+        if (auto a = dynamic_cast<AndExpression*>(e.get())) a->release(ops);
+    } else {
+        if (auto o = dynamic_cast<OrExpression*>(e.get())) o->release(ops);
+    }
+    if (ops.empty()) {
+        terms.push_back(std::move(e));
+        return;
+    }
+    for (auto& op : ops) flatten(conjunction, std::move(op), terms);
+}
+
+// Simplify a chain of ANDs (conjunction) or ORs whose terms are already simplified
+// (in the boolean context, unless c is C_MATCH). Terms are compared by their
+// structural hashes and key sets grouped by identifier, not pair by pair: a
+// junction can have thousands of terms.
+static unique_ptr<ValueExpression> junction(bool conjunction, vector<unique_ptr<ValueExpression>>&& in, Context c)
+{
+    // FALSE decides an AND, TRUE decides an OR
+    const bool decisive = !conjunction;
+
+    vector<unique_ptr<ValueExpression>> flat;
+    for (auto& t : in) flatten(conjunction, std::move(t), flat);
+    WorkCounter::add(flat.size());
+
+    // Constants and duplicates
+    bool sawUnknown = false;
+    vector<unique_ptr<ValueExpression>> terms;
+    std::unordered_multimap<std::size_t, const ValueExpression*> seen;
+    for (auto& t : flat) {
+        Value v;
+        if (t->literal(v)) {
+            BoolOrNone b(v);
+            if (b==BN_UNKNOWN) sawUnknown = true;
+            else if (bool(b)==decisive) return inContext(make_unique<Literal>(decisive), c);
+            continue;
+        }
+        auto h = structuralHash(*t);
+        auto [first, last] = seen.equal_range(h);
+        WorkCounter::add(std::distance(first, last));
+        if (std::any_of(first, last, [&](const auto& x) { return x.second->same(*t); })) continue;
+        seen.emplace(h, t.get());
+        terms.push_back(std::move(t));
+    }
+    // An unknown AND term can never be true
+    if (sawUnknown && c==C_MATCH && conjunction) return make_unique<Literal>(false);
+
+    // Merge the key set terms for each identifier: intersecting them for AND
+    // and taking their union for OR
+    std::unordered_map<string, vector<std::pair<std::size_t, KeySet>>> keyed;
+    vector<string> identifiers;
+    for (std::size_t i = 0; i<terms.size(); ++i) {
+        KeySet k;
+        if (!terms[i]->keySet(k)) continue;
+        normalise(k);
+        auto& group = keyed[k.identifier];
+        if (group.empty()) identifiers.push_back(k.identifier);
+        group.emplace_back(i, std::move(k));
+    }
+    vector<bool> removed(terms.size());
+    for (auto& i : identifiers) {
+        auto& group = keyed[i];
+        if (group.size()<2) continue;
+        // The union of them all at once: uniting them in turn is quadratic
+        auto k = std::move(group[0].second);
+        for (std::size_t j = 1; j<group.size(); ++j) {
+            auto& kj = group[j].second;
+            WorkCounter::add(kj.points.size() + kj.ranges.size());
+            if (conjunction) {
+                k = intersect(k, kj);
+            } else {
+                k.points.insert(k.points.end(), kj.points.begin(), kj.points.end());
+                k.ranges.insert(k.ranges.end(), kj.ranges.begin(), kj.ranges.end());
+            }
+        }
+        if (!conjunction) normalise(k);
+        if (k.points.empty() && k.ranges.empty()) {
+            // Contradiction: never true, but unknown rather than false if the identifier is missing
+            if (c==C_MATCH) return make_unique<Literal>(false);
+            continue;
+        }
+        auto e = keyExpression(k);
+        if (!e) continue;
+        terms[group[0].first] = std::move(e);
+        for (std::size_t j = 1; j<group.size(); ++j) removed[group[j].first] = true;
+    }
+
+    // Absorption: a AND (a OR b) is a; a OR (a AND b) is a. Only a term that
+    // is itself an OR (for AND) is absorbed, so never one that absorbs
+    seen.clear();
+    for (std::size_t i = 0; i<terms.size(); ++i) {
+        if (!removed[i]) seen.emplace(structuralHash(*terms[i]), terms[i].get());
+    }
+    for (std::size_t i = 0; i<terms.size(); ++i) {
+        vector<const ValueExpression*> ops;
+        if (removed[i] || !junctionOperands(!conjunction, *terms[i], ops)) continue;
+        removed[i] = std::any_of(ops.begin(), ops.end(), [&](const ValueExpression* op) {
+            auto [first, last] = seen.equal_range(structuralHash(*op));
+            WorkCounter::add(1 + std::distance(first, last));
+            return std::any_of(first, last, [&](const auto& x) { return x.second!=terms[i].get() && x.second->same(*op); });
+        });
+    }
+
+    vector<unique_ptr<ValueExpression>> kept;
+    for (std::size_t i = 0; i<terms.size(); ++i) {
+        if (!removed[i]) kept.push_back(std::move(terms[i]));
+    }
+    if (sawUnknown && c!=C_MATCH) kept.push_back(make_unique<Literal>(BN_UNKNOWN));
+    if (kept.empty()) return inContext(make_unique<Literal>(!decisive), c);
+
+    // The value of an AND or OR is boolean even if its operands' values are
+    // not: keep the conversion with the operator's identity
+    if (kept.size()==1 && c==C_VALUE && !boolean(*kept[0])) kept.push_back(make_unique<Literal>(conjunction));
+
+    auto r = std::move(kept[0]);
+    for (std::size_t i = 1; i<kept.size(); ++i) {
+        if (conjunction) r = make_unique<AndExpression>(std::move(r), std::move(kept[i]));
+        else r = make_unique<OrExpression>(std::move(r), std::move(kept[i]));
+    }
+    return r;
+}
+
+////////////////////////////////////////////////////
+
+// Incremental evaluation
+
+// Remembers the value of its subexpression until invalidated
+class CachedExpression : public ValueExpression {
+    unique_ptr<ValueExpression> e;
+    vector<IncrementalEval::Slot>& slots;
+    std::size_t slot;
+    std::size_t& evaluations;
+
+public:
+    CachedExpression(unique_ptr<ValueExpression> e_, vector<IncrementalEval::Slot>& s, std::size_t i, std::size_t& n) :
+        e(std::move(e_)),
+        slots(s),
+        slot(i),
+        evaluations(n)
+    {}
+
+    void repr(ostream& os) const {
+        os << *e;
+    }
+
+    Value eval(const Env& env) const {
+        auto& s = slots[slot];
+        if (!s.valid) {
+            ++evaluations;
+            s.value = e->eval(env);
+            s.valid = true;
+        }
+        return s.value;
+    }
+
+    bool same(const ValueExpression& o) const {
+        return e->same(o);
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn& child) const {
+        return e->copy(child);
+    }
+
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        return e->simplified(c);
+    }
+};
+
+IncrementalEval::IncrementalEval(const Expression& exp) :
+    ids(identifiers(exp)),
+    dependents(ids.size())
+{
+    ValueExpression::CopyFn cached = [&](const ValueExpression& e) -> unique_ptr<ValueExpression> {
+        if (isLiteral(e)) return e.copy(cached);
+        auto c = e.copy(cached);
+        auto index = slots.size();
+        slots.emplace_back();
+        vector<string> deps;
+        collectIdentifiers(e, deps);
+        for (auto& d : deps) {
+            auto i = std::find(ids.begin(), ids.end(), d) - ids.begin();
+            dependents[i].push_back(index);
+        }
+        return make_unique<CachedExpression>(std::move(c), slots, index, evaluations_);
+    };
+    expression = cached(static_cast<const ValueExpression&>(exp));
+}
+
+IncrementalEval::~IncrementalEval() = default;
+
+BoolOrNone IncrementalEval::eval_bool(const Env& env)
+{
+    SELECTOR_PROBE1(eval_start, expression.get());
+    auto r = expression->eval_bool(env);
+    SELECTOR_PROBE2(eval_end, expression.get(), int(r));
+    return r;
+}
+
+void IncrementalEval::changed(string_view property)
+{
+    auto i = std::find(ids.begin(), ids.end(), property);
+    if (i==ids.end()) return;
+    for (auto s : dependents[i-ids.begin()]) slots[s].valid = false;
+}
+
+void IncrementalEval::reset()
+{
+    for (auto& s : slots) s.valid = false;
+}
+
+////////////////////////////////////////////////////
+// Profiled evaluation
+
+// Counts the evaluations and results of its subexpression
+class ProfiledExpression : public ValueExpression {
+    unique_ptr<ValueExpression> e;
+    vector<ProfiledEval::Node>& nodes;
+    std::size_t node;
+
+public:
+    ProfiledExpression(unique_ptr<ValueExpression> e_, vector<ProfiledEval::Node>& n, std::size_t i) :
+        e(std::move(e_)),
+        nodes(n),
+        node(i)
+    {}
+
+    void repr(ostream& os) const {
+        os << *e;
+    }
+
+    Value eval(const Env& env) const {
+        using clock = std::chrono::steady_clock;
+        auto start = clock::now();
+        Value v = e->eval(env);
+        auto& n = nodes[node];
+        n.ns += std::chrono::duration<double, std::nano>(clock::now()-start).count();
+        ++n.evaluations;
+        switch (v.type()) {
+        case Value::T_UNKNOWN: ++n.unknowns; break;
+        case Value::T_BOOL:    ++(std::get<bool>(v.value) ? n.trues : n.falses); break;
+        default: break;
+        }
+        return v;
+    }
+
+    bool same(const ValueExpression& o) const {
+        return e->same(o);
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn& child) const {
+        return e->copy(child);
+    }
+
+    unique_ptr<ValueExpression> simplified(Context c) const {
+        return e->simplified(c);
+    }
+};
+
+ProfiledEval::ProfiledEval(const Expression& exp)
+{
+    // Number the nodes before copying them as copy() needn't visit children in order
+    std::unordered_map<const ValueExpression*, std::size_t> index;
+    std::function<void(const ValueExpression&, unsigned)> number = [&](const ValueExpression& e, unsigned depth) {
+        index.emplace(&e, nodes_.size());
+        nodes_.emplace_back();
+        std::ostringstream text;
+        text << e;
+        nodes_.back().text = text.str();
+        nodes_.back().depth = depth;
+        vector<const ValueExpression*> cs;
+        e.children(cs);
+        for (auto c : cs) number(*c, depth+1);
+    };
+    auto& root = static_cast<const ValueExpression&>(exp);
+    number(root, 0);
+    ValueExpression::CopyFn profiled = [&](const ValueExpression& e) -> unique_ptr<ValueExpression> {
+        return make_unique<ProfiledExpression>(e.copy(profiled), nodes_, index.at(&e));
+    };
+    expression = profiled(root);
+}
+
+ProfiledEval::~ProfiledEval() = default;
+
+BoolOrNone ProfiledEval::eval_bool(const Env& env)
+{
+    SELECTOR_PROBE1(eval_start, expression.get());
+    auto r = expression->eval_bool(env);
+    SELECTOR_PROBE2(eval_end, expression.get(), int(r));
+    return r;
+}
+
+void ProfiledEval::reset()
+{
+    for (auto& n : nodes_) {
+        n.evaluations = n.trues = n.falses = n.unknowns = 0;
+        n.ns = 0.0;
+    }
+}
+
+std::ostream& operator<<(std::ostream& os, const ProfiledEval& p)
+{
+    auto flags = os.flags();
+    auto precision = os.precision();
+    os << std::setw(10) << "evals" << std::setw(10) << "true" << std::setw(10) << "false"
+       << std::setw(10) << "unknown" << std::setw(12) << "ns/eval" << "  node\n";
+    for (auto& n : p.nodes()) {
+        os << std::setw(10) << n.evaluations << std::setw(10) << n.trues << std::setw(10) << n.falses
+           << std::setw(10) << n.unknowns << std::setw(12) << std::fixed << std::setprecision(1)
+           << (n.evaluations ? n.ns/n.evaluations : 0.0) << "  " << string(2*n.depth, ' ') << n.text << "\n";
+    }
+    os.flags(flags);
+    os.precision(precision);
+    return os;
+}
+
+thread_local WorkCounter* WorkCounter::current = nullptr;
+
+WorkCounter::WorkCounter() :
+    previous(current)
+{
+    current = this;
+}
+
+WorkCounter::~WorkCounter()
+{
+    current = previous;
+    if (previous) previous->count_ += count_;
+}
+
+////////////////////////////////////////////////////
+// Shape specialised evaluation
+
+ShapeEval::ShapeEval(const Expression& exp, std::size_t n) :
+    expression(exp),
+    ids(identifiers(exp)),
+    maxShapes(n)
+{
+    if (ids.size()>64) ids.resize(64);
+}
+
+ShapeEval::~ShapeEval() = default;
+
+// The residual for a shape, made the first time it is seen
+const ShapeEval::Shape* ShapeEval::shape(uint64_t present)
+{
+    for (auto& s : shapes_) {
+        if (s.present==present) return &s;
+    }
+    if (shapes_.size()>=maxShapes) return nullptr;
+
+    // Which of the shape's properties the identifier is, if any
+    auto property = [&](const std::pmr::string* name) {
+        auto i = name ? std::size_t(std::find(ids.begin(), ids.end(), string_view{*name}) - ids.begin()) : ids.size();
+        return i<ids.size() ? uint64_t(1)<<i : 0;
+    };
+    // Missing properties are unknown and present ones are never null
+    ValueExpression::CopyFn specialise = [&](const ValueExpression& e) -> unique_ptr<ValueExpression> {
+        if (auto bit = property(e.identifierName()); bit && !(present & bit)) return make_unique<Literal>(Value{});
+        if (auto u = dynamic_cast<const UnaryBooleanExpression*>(&e)) {
+            bool isNull;
+            if (auto bit = property(u->nullTest(isNull)); bit && (present & bit)) return make_unique<Literal>(!isNull);
+        }
+        return e.copy(specialise);
+    };
+    auto residual = specialise(static_cast<const ValueExpression&>(expression))->simplified(C_MATCH);
+    Value v;
+    if (residual->literal(v)) {
+        shapes_.push_back(Shape{present, nullptr, true, BoolOrNone(v)==BN_TRUE});
+    } else {
+        shapes_.push_back(Shape{present, std::move(residual), false, false});
+    }
+    return &shapes_.back();
+}
+
+bool ShapeEval::eval(const Env& env)
+{
+    uint64_t present = 0;
+    for (std::size_t i = 0; i<ids.size(); ++i) {
+        if (!unknown(env.value(ids[i]))) present |= uint64_t(1)<<i;
+    }
+    auto s = shape(present);
+    if (!s) return selector::eval(expression, env);
+    SELECTOR_PROBE1(eval_start, &expression);
+    BoolOrNone r;
+    if (s->decided) {
+        ++decided_;
+        r = s->matches ? BN_TRUE : BN_FALSE;
+    } else {
+        r = s->residual->eval_bool(env);
+    }
+    SELECTOR_PROBE2(eval_end, &expression, int(r));
+    return r==BN_TRUE;
+}
+
+////////////////////////////////////////////////////
+
 struct Parse {
 
 [[noreturn]]
@@ -719,13 +1788,13 @@ static unique_ptr<BoolExpression> conditionalNegate(bool negated, unique_ptr<Boo
 static unique_ptr<BoolExpression> specialComparisons(Tokeniser& tokeniser, unique_ptr<ValueExpression> e1, bool negated = false) {
     switch (tokeniser.nextToken().type) {
     case T_LIKE: {
-        auto t = tokeniser.nextToken();
+        const auto& t = tokeniser.nextToken();
         if ( t.type!=T_STRING ) {
             throwParseError(tokeniser, "expected string after LIKE");
         }
         // Check for "ESCAPE"
         if ( tokeniser.nextToken().type==T_ESCAPE ) {
-            auto e = tokeniser.nextToken();
+            const auto& e = tokeniser.nextToken();
             if ( e.type!=T_STRING ) {
                 throwParseError(tokeniser, "expected string after ESCAPE");
             }
@@ -752,7 +1821,7 @@ static unique_ptr<BoolExpression> specialComparisons(Tokeniser& tokeniser, uniqu
         if ( tokeniser.nextToken().type!=T_LPAREN ) {
             throwParseError(tokeniser, "missing '(' after IN");
         }
-        vector<unique_ptr<ValueExpression>> list;
+        NodeList list{NodeResource::current()};
         do {
             list.push_back(addExpression(tokeniser));
         } while (tokeniser.nextToken().type==T_COMMA);
@@ -815,11 +1884,11 @@ static unique_ptr<ValueExpression> addExpression(Tokeniser& tokeniser)
 {
     auto e = multiplyExpression(tokeniser);
 
-    auto t = tokeniser.nextToken();
-    while (t.type==T_PLUS || t.type==T_MINUS ) {
-        const ArithmeticOperator& op = t.type==T_PLUS ? add : sub;
+    auto t = tokeniser.nextToken().type;
+    while (t==T_PLUS || t==T_MINUS ) {
+        const ArithmeticOperator& op = t==T_PLUS ? add : sub;
         e = make_unique<ArithmeticExpression>(op, std::move(e), multiplyExpression(tokeniser));
-        t = tokeniser.nextToken();
+        t = tokeniser.nextToken().type;
     }
 
     tokeniser.returnTokens();
@@ -830,11 +1899,11 @@ static unique_ptr<ValueExpression> multiplyExpression(Tokeniser& tokeniser)
 {
     auto e = unaryArithExpression(tokeniser);
 
-    auto t = tokeniser.nextToken();
-    while (t.type==T_MULT || t.type==T_DIV ) {
-        const ArithmeticOperator& op = t.type==T_MULT ? mult : div;
+    auto t = tokeniser.nextToken().type;
+    while (t==T_MULT || t==T_DIV ) {
+        const ArithmeticOperator& op = t==T_MULT ? mult : div;
         e = make_unique<ArithmeticExpression>(op, std::move(e), unaryArithExpression(tokeniser));
-        t = tokeniser.nextToken();
+        t = tokeniser.nextToken().type;
     }
 
     tokeniser.returnTokens();
@@ -888,7 +1957,7 @@ static unique_ptr<ValueExpression> unaryArithExpression(Tokeniser& tokeniser)
     case T_PLUS:
         break; // Unary + is no op
     case T_MINUS: {
-        auto t = tokeniser.nextToken();
+        const auto& t = tokeniser.nextToken();
         // Special case for negative numerics
         if (t.type==T_NUMERIC_EXACT) {
             return exactNumeric(t, true);
@@ -907,7 +1976,7 @@ static unique_ptr<ValueExpression> unaryArithExpression(Tokeniser& tokeniser)
 
 static unique_ptr<ValueExpression> primaryExpression(Tokeniser& tokeniser)
 {
-    auto t = tokeniser.nextToken();
+    const auto& t = tokeniser.nextToken();
     switch (t.type) {
         case T_IDENTIFIER:
             return make_unique<Identifier>(t.val);
@@ -931,16 +2000,89 @@ static unique_ptr<ValueExpression> primaryExpression(Tokeniser& tokeniser)
 ///////////////////////////////////////////////////////////
 
 // Top level parser
+unique_ptr<Expression> make_selector(string_view exp, std::pmr::memory_resource* resource)
+{
+    // The tokens are only needed while parsing: most selectors fit here
+    std::byte buffer[4096];
+    std::pmr::monotonic_buffer_resource scratch{buffer, sizeof(buffer)};
+    auto tokeniser = Tokeniser{exp, &scratch};
+    NodeResource nodes{resource};
+    SELECTOR_PROBE2(parse_start, exp.data(), exp.size());
+    try {
+        auto e = Parse::selectorExpression(tokeniser);
+        SELECTOR_PROBE3(parse_end, exp.size(), 1, e.get());
+        return e;
+    } catch (...) {
+        SELECTOR_PROBE3(parse_end, exp.size(), 0, static_cast<const Expression*>(nullptr));
+        throw;
+    }
+}
+
 unique_ptr<Expression> make_selector(string_view exp)
 {
-    auto tokeniser = Tokeniser{exp};
-    return Parse::selectorExpression(tokeniser);
+    return make_selector(exp, NodeResource::current());
+}
+
+unique_ptr<Expression> make_arena_selector(string_view exp)
+{
+    // Roughly enough for the nodes of a typical selector of this length
+    auto arena = make_unique<std::pmr::monotonic_buffer_resource>(256 + 16*exp.size());
+    auto e = make_selector(exp, arena.get());
+    auto h = static_cast<NodeHeader*>(dynamic_cast<void*>(e.get()))-1;
+    h->owner = true;
+    arena.release();
+    return e;
+}
+
+void collectIdentifiers(const ValueExpression& e, vector<string>& ids)
+{
+    if (auto i = e.identifierName()) {
+        if (std::find(ids.begin(), ids.end(), string_view{*i})==ids.end()) ids.emplace_back(*i);
+        return;
+    }
+    vector<const ValueExpression*> cs;
+    e.children(cs);
+    for (auto c : cs) collectIdentifiers(*c, ids);
+}
+
+// Every expression made by make_selector() is a ValueExpression
+vector<string> identifiers(const Expression& exp)
+{
+    vector<string> ids;
+    collectIdentifiers(static_cast<const ValueExpression&>(exp), ids);
+    return ids;
+}
+
+std::size_t estimated_cost(const Expression& exp)
+{
+    return static_cast<const ValueExpression&>(exp).cost();
+}
+
+IndexPlan index_plan(const Expression& exp, const vector<string_view>& indexed)
+{
+    return static_cast<const ValueExpression&>(exp).indexPlan(indexed);
+}
+
+unique_ptr<Expression> simplify(const Expression& exp)
+{
+    return static_cast<const ValueExpression&>(exp).simplified(C_MATCH);
+}
+
+bool unsatisfiable(const Expression& exp)
+{
+    Value v;
+    return static_cast<const ValueExpression&>(exp).simplified(C_MATCH)->literal(v) && BoolOrNone(v)!=BN_TRUE;
 }
 
+#ifndef SELECTORS_STATIC_DEFINE
 bool eval(const Expression& exp, const Env& env)
 {
-    return exp.eval_bool(env)==BN_TRUE;
+    SELECTOR_PROBE1(eval_start, &exp);
+    auto r = exp.eval_bool(env);
+    SELECTOR_PROBE2(eval_end, &exp, int(r));
+    return r==BN_TRUE;
 }
+#endif
 
 std::ostream& operator<<(std::ostream& o, const Expression& e)
 {
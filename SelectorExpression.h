@@ -22,11 +22,16 @@
  *
  */
 
+#include "SelectorProbes.h"
 #include "SelectorValue.h"
 
+#include <cstddef>
 #include <iosfwd>
 #include <memory>
+#include <memory_resource>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include "selectors_export.h"
 
@@ -43,7 +48,38 @@ public:
 };
 
 SELECTORS_EXPORT std::unique_ptr<Expression> make_selector(std::string_view exp);
+// The nodes of the expression, and everything they hold, are allocated from
+// resource, which must outlive the expression. Tokens go in a scratch arena.
+// The text of string literals is interned (see InternedString) instead.
+SELECTORS_EXPORT std::unique_ptr<Expression> make_selector(std::string_view exp, std::pmr::memory_resource* resource);
+// The expression is allocated from a monotonic arena of its own, which is
+// released in one go when it's destroyed
+SELECTORS_EXPORT std::unique_ptr<Expression> make_arena_selector(std::string_view exp);
+#ifdef SELECTORS_STATIC_DEFINE
+// Users of the static library call straight through to the expression, so
+// the call inlines into their code even without link time optimisation
+inline bool eval(const Expression& exp, const Env& env)
+{
+    SELECTOR_PROBE1(eval_start, &exp);
+    auto r = exp.eval_bool(env);
+    SELECTOR_PROBE2(eval_end, &exp, int(r));
+    return r==BN_TRUE;
+}
+#else
 SELECTORS_EXPORT bool eval(const Expression&, const Env&);
+#endif
+
+// The identifiers an expression refers to in the order they first appear
+SELECTORS_EXPORT std::vector<std::string> identifiers(const Expression&);
+
+// A rough estimate of the relative cost of evaluating an expression
+SELECTORS_EXPORT std::size_t estimated_cost(const Expression&);
+
+// Simplification: the simplified expression matches exactly the same messages
+// as the original, although its value may differ when it does not match.
+SELECTORS_EXPORT std::unique_ptr<Expression> simplify(const Expression&);
+// Can this expression never match any message
+SELECTORS_EXPORT bool unsatisfiable(const Expression&);
 SELECTORS_EXPORT std::ostream& operator<<(std::ostream&, const Expression&);
 }
 
@@ -0,0 +1,369 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorFlat.h"
+
+#include "SelectorEnv.h"
+#include "SelectorNode.h"
+#include "SelectorProbes.h"
+#include "SelectorProfile.h"
+#include "SelectorValue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::get;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace selector {
+
+// LIKE patterns are stored as a pair of bytes for each element: the kind of
+// element and the character to match for a literal
+namespace {
+
+const char LIKE_CHAR = 'c';
+const char LIKE_ONE = '_';
+const char LIKE_ANY = '%';
+
+}
+
+uint32_t FlatWriter::string(string_view s)
+{
+    auto offset = strings.size();
+    strings.append(s);
+    return offset;
+}
+
+bool FlatWriter::write(uint32_t at, FlatOp op, const vector<const ValueExpression*>& children)
+{
+    uint32_t first = nodes.size();
+    nodes.resize(first + children.size());
+    nodes[at].op = op;
+    nodes[at].first = first;
+    nodes[at].count = children.size();
+    for (size_t i = 0; i<children.size(); ++i) {
+        if (!children[i]->flatten(*this, first+i)) return false;
+    }
+    return true;
+}
+
+void FlatWriter::literal(uint32_t at, const Value& v)
+{
+    auto& n = nodes[at];
+    n.op = characters(v) ? F_STRING : F_LITERAL;
+    n.type = v.type();
+    switch (v.type()) {
+    case Value::T_BOOL:    n.boolean = get<bool>(v.value); break;
+    case Value::T_EXACT:   n.exact = get<int64_t>(v.value); break;
+    case Value::T_INEXACT: n.inexact = get<double>(v.value); break;
+    case Value::T_STRING: {
+        auto s = get<string_view>(v.value);
+        auto offset = string(s);
+        nodes[at].offset = offset;
+        nodes[at].length = s.size();
+        break;
+    }
+    default: break;
+    }
+}
+
+void FlatWriter::identifier(uint32_t at, string_view name)
+{
+    auto offset = string(name);
+    nodes[at].op = F_IDENTIFIER;
+    nodes[at].offset = offset;
+    nodes[at].length = name.size();
+}
+
+void FlatWriter::likePattern(uint32_t at, string_view elements)
+{
+    auto offset = string(elements);
+    nodes[at].offset = offset;
+    nodes[at].length = elements.size();
+}
+
+bool FlatWriter::program(const ValueExpression& e, std::string& out)
+{
+    nodes.assign(1, FlatNode{});
+    strings.clear();
+    if (!e.flatten(*this, 0)) return false;
+    FlatProgram header{uint32_t(nodes.size()), uint32_t(strings.size())};
+    out.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.append(reinterpret_cast<const char*>(nodes.data()), nodes.size()*sizeof(FlatNode));
+    out.append(strings);
+    return true;
+}
+
+// An escape character makes the next character literal and is itself dropped
+// (even if it is the escape character)
+std::pmr::string likeElements(string_view pattern, char escape, std::pmr::memory_resource* resource)
+{
+    std::pmr::string elements{resource};
+    elements.reserve(2*pattern.size());
+    bool escaped = false;
+    for (char c : pattern) {
+        if (escape!=0 && c==escape) {
+            escaped = true;
+            continue;
+        }
+        if (!escaped && (c=='%' || c=='_')) {
+            elements += c==LIKE_ANY ? LIKE_ANY : LIKE_ONE;
+            elements += c;
+        } else {
+            elements += LIKE_CHAR;
+            elements += c;
+        }
+        escaped = false;
+    }
+    return elements;
+}
+
+namespace {
+
+// Match a whole string against a LIKE pattern. A wildcard never matches a NUL
+// character, as with the POSIX regex "." LIKE used to be translated to.
+// Counts the characters it tries to match in steps.
+bool matchElements(string_view s, string_view elements, size_t& steps)
+{
+    auto p = elements.data();
+    auto n = elements.size();
+    size_t si = 0;
+    size_t pi = 0;
+    size_t star = n; // The last % seen and where in s it started matching
+    size_t mark = 0;
+    while (si<s.size()) {
+        ++steps;
+        if (pi<n && p[pi]==LIKE_ANY) {
+            star = pi;
+            mark = si;
+            pi += 2;
+        } else if (pi<n && (p[pi]==LIKE_ONE ? s[si]!=0 : p[pi+1]==s[si])) {
+            ++si;
+            pi += 2;
+        } else if (star<n && s[mark]!=0) {
+            // Let the last % match one more character and try again
+            pi = star+2;
+            si = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (pi<n && p[pi]==LIKE_ANY) pi += 2;
+    return pi==n;
+}
+
+}
+
+bool likeMatch(string_view s, string_view elements)
+{
+    size_t steps = 0;
+    bool matched = matchElements(s, elements, steps);
+    WorkCounter::add(steps);
+    SELECTOR_PROBE3(like, s.data(), s.size(), int(matched));
+    return matched;
+}
+
+namespace {
+
+class FlatEval {
+    const FlatProgram& program;
+    const char* strings;
+    const Env& env;
+
+    string_view text(const FlatNode& n) const {
+        return string_view{strings + n.offset, n.length};
+    }
+
+public:
+    FlatEval(const FlatProgram& p, const Env& e) :
+        program(p),
+        strings(p.strings()),
+        env(e)
+    {}
+
+    // The same semantics as the corresponding expression nodes
+    Value eval(uint32_t i) const {
+        auto& n = *program.node(i);
+        auto c = n.first;
+        switch (n.op) {
+        case F_LITERAL:
+            switch (n.type) {
+            case Value::T_BOOL:    return n.boolean;
+            case Value::T_EXACT:   return n.exact;
+            case Value::T_INEXACT: return n.inexact;
+            default:               return Value{};
+            }
+        case F_STRING:     return text(n);
+        case F_IDENTIFIER: return env.value(text(n));
+        case F_ADD:        return eval(c) + eval(c+1);
+        case F_SUB:        return eval(c) - eval(c+1);
+        case F_MULT:       return eval(c) * eval(c+1);
+        case F_DIV:        return eval(c) / eval(c+1);
+        case F_NEGATE:     return -eval(c);
+        default:           return eval_bool(i);
+        }
+    }
+
+    BoolOrNone eval_bool(uint32_t i) const {
+        auto& n = *program.node(i);
+        auto c = n.first;
+        switch (n.op) {
+        case F_EQ: case F_NEQ: case F_LESS: case F_GRT: case F_LSEQ: case F_GREQ: {
+            Value v1 = eval(c);
+            if (unknown(v1)) return BN_UNKNOWN;
+            Value v2 = eval(c+1);
+            if (unknown(v2)) return BN_UNKNOWN;
+            switch (n.op) {
+            case F_EQ:   return BoolOrNone(v1==v2);
+            case F_NEQ:  return BoolOrNone(v1!=v2);
+            case F_LESS: return BoolOrNone(v1<v2);
+            case F_GRT:  return BoolOrNone(v1>v2);
+            case F_LSEQ: return BoolOrNone(v1<=v2);
+            default:     return BoolOrNone(v1>=v2);
+            }
+        }
+        case F_AND: {
+            BoolOrNone bn1(eval_bool(c));
+            if (bn1==BN_FALSE) return BN_FALSE;
+            BoolOrNone bn2(eval_bool(c+1));
+            if (bn2==BN_FALSE) return BN_FALSE;
+            return bn1==BN_TRUE && bn2==BN_TRUE ? BN_TRUE : BN_UNKNOWN;
+        }
+        case F_OR: {
+            BoolOrNone bn1(eval_bool(c));
+            if (bn1==BN_TRUE) return BN_TRUE;
+            BoolOrNone bn2(eval_bool(c+1));
+            if (bn2==BN_TRUE) return BN_TRUE;
+            return bn1==BN_FALSE && bn2==BN_FALSE ? BN_FALSE : BN_UNKNOWN;
+        }
+        case F_NOT:       return !eval(c);
+        case F_ISNULL:    return BoolOrNone(unknown(eval(c)));
+        case F_ISNONNULL: return BoolOrNone(!unknown(eval(c)));
+        case F_LIKE: {
+            Value v = eval(c);
+            if (!characters(v)) return BN_UNKNOWN;
+            return BoolOrNone(likeMatch(get<string_view>(v.value), text(n)));
+        }
+        case F_BETWEEN: {
+            Value ve = eval(c);
+            Value vl = eval(c+1);
+            Value vu = eval(c+2);
+            if (unknown(ve) || unknown(vl) || unknown(vu)) return BN_UNKNOWN;
+            return BoolOrNone(ve>=vl && ve<=vu);
+        }
+        case F_IN: {
+            Value ve = eval(c);
+            if (unknown(ve)) return BN_UNKNOWN;
+            BoolOrNone r = BN_FALSE;
+            for (uint32_t l = c+1; l<c+n.count; ++l) {
+                Value li = eval(l);
+                if (unknown(li)) {
+                    r = BN_UNKNOWN;
+                    continue;
+                }
+                if (ve==li) return BN_TRUE;
+            }
+            return r;
+        }
+        case F_NOTIN: {
+            Value ve = eval(c);
+            if (unknown(ve)) return BN_UNKNOWN;
+            BoolOrNone r = BN_TRUE;
+            for (uint32_t l = c+1; l<c+n.count; ++l) {
+                Value li = eval(l);
+                if (unknown(li)) {
+                    r = BN_UNKNOWN;
+                    continue;
+                }
+                if (r!=BN_UNKNOWN && !sameType(ve, li) && !(numeric(ve) && numeric(li))) {
+                    r = BN_FALSE;
+                    continue;
+                }
+                if (ve==li) return BN_FALSE;
+            }
+            return r;
+        }
+        default:
+            return eval(i);
+        }
+    }
+};
+
+}
+
+BoolOrNone flatEval(const FlatProgram& program, const Env& env)
+{
+    // There's no Expression here: the eval probes see the program instead
+    SELECTOR_PROBE1(eval_start, static_cast<const void*>(&program));
+    auto r = FlatEval{program, env}.eval_bool(0);
+    SELECTOR_PROBE2(eval_end, static_cast<const void*>(&program), int(r));
+    return r;
+}
+
+bool flatValid(const FlatProgram& program, size_t bytes)
+{
+    auto nodeBytes = bytes<sizeof(FlatProgram) ? 0 : bytes-sizeof(FlatProgram);
+    if (program.nodes==0 || program.nodes>nodeBytes/sizeof(FlatNode)) return false;
+    if (program.bytes>nodeBytes-program.nodes*sizeof(FlatNode)) return false;
+    for (uint32_t i = 0; i<program.nodes; ++i) {
+        auto& n = *program.node(i);
+        uint32_t least = 2;
+        uint32_t most = 2;
+        switch (n.op) {
+        case F_LITERAL: case F_STRING: case F_IDENTIFIER:
+            least = most = 0;
+            break;
+        case F_NOT: case F_ISNULL: case F_ISNONNULL: case F_NEGATE: case F_LIKE:
+            least = most = 1;
+            break;
+        case F_BETWEEN:
+            least = most = 3;
+            break;
+        case F_IN: case F_NOTIN:
+            least = 1;
+            most = UINT32_MAX;
+            break;
+        case F_EQ: case F_NEQ: case F_LESS: case F_GRT: case F_LSEQ: case F_GREQ:
+        case F_AND: case F_OR: case F_ADD: case F_SUB: case F_MULT: case F_DIV:
+            break;
+        default:
+            return false;
+        }
+        if (n.count<least || n.count>most) return false;
+        // Children after their parent means evaluation always ends
+        if (n.count>0 && (n.first<=i || n.first>program.nodes || n.count>program.nodes-n.first)) return false;
+        if (n.op==F_STRING || n.op==F_IDENTIFIER || n.op==F_LIKE) {
+            if (n.offset>program.bytes || n.length>program.bytes-n.offset) return false;
+            // Elements are pairs of bytes
+            if (n.op==F_LIKE && n.length%2!=0) return false;
+        }
+    }
+    return true;
+}
+
+}
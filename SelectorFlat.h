@@ -0,0 +1,152 @@
+#ifndef SELECTOR_FLAT_H
+#define SELECTOR_FLAT_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Internal: the flat form of an expression used by the shared selector store.
+//
+// A flat program is a header, an array of nodes and an area of string data.
+// Nodes refer to their children by index and to their strings by offset into
+// the string area so a program can be used wherever it is mapped in memory.
+// The root is node 0 and a node's children are consecutive.
+
+#include "SelectorValue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace selector {
+
+class Env;
+class ValueExpression;
+
+enum FlatOp : uint8_t {
+    F_LITERAL,
+    F_STRING,
+    F_IDENTIFIER,
+    F_EQ,
+    F_NEQ,
+    F_LESS,
+    F_GRT,
+    F_LSEQ,
+    F_GREQ,
+    F_AND,
+    F_OR,
+    F_NOT,
+    F_ISNULL,
+    F_ISNONNULL,
+    F_ADD,
+    F_SUB,
+    F_MULT,
+    F_DIV,
+    F_NEGATE,
+    F_LIKE,
+    F_BETWEEN,
+    F_IN,
+    F_NOTIN
+};
+
+struct FlatNode {
+    uint8_t op = F_LITERAL;
+    uint8_t type = Value::T_UNKNOWN; // Of a literal
+    uint16_t unused = 0;
+    uint32_t count = 0;  // Of children
+    uint32_t first = 0;  // Index of the first child
+    uint32_t length = 0; // Of the node's string data
+    union {
+        int64_t exact;
+        double inexact;
+        bool boolean;
+        uint64_t offset; // Of the node's string data
+    };
+
+    FlatNode() :
+        offset(0)
+    {}
+};
+
+static_assert(std::is_trivially_copyable<FlatNode>::value && sizeof(FlatNode)==24, "FlatNode layout is part of the store format");
+
+struct FlatProgram {
+    uint32_t nodes;
+    uint32_t bytes; // Of string data, which follows the nodes
+
+    const FlatNode* node(uint32_t i) const {
+        return reinterpret_cast<const FlatNode*>(this+1) + i;
+    }
+
+    const char* strings() const {
+        return reinterpret_cast<const char*>(node(nodes));
+    }
+
+    std::size_t size() const {
+        return sizeof(FlatProgram) + nodes*sizeof(FlatNode) + bytes;
+    }
+};
+
+static_assert(sizeof(FlatProgram)==8, "FlatProgram layout is part of the store format");
+
+/**
+ * Builds the flat program for an expression: each node writes itself with
+ * ValueExpression::flatten() at an index reserved by its parent.
+ */
+class FlatWriter {
+    std::vector<FlatNode> nodes;
+    std::string strings;
+
+    uint32_t string(std::string_view);
+
+public:
+    // Write the operator node at and its children
+    bool write(uint32_t at, FlatOp, const std::vector<const ValueExpression*>& children);
+    void literal(uint32_t at, const Value&);
+    void identifier(uint32_t at, std::string_view name);
+    // Add the pattern, made by likeElements(), to a LIKE node already written
+    void likePattern(uint32_t at, std::string_view elements);
+
+    // The whole program for the expression, or false if part of it has no flat form
+    bool program(const ValueExpression&, std::string& out);
+};
+
+// Evaluate a program where it is. The program must be well formed.
+BoolOrNone flatEval(const FlatProgram&, const Env&);
+
+// Whether a program that may not have come from a FlatWriter is well formed,
+// within the given bytes: each node has a known operator and the right number
+// of children, which come after it among the program's nodes, and its string
+// data is within the program's
+bool flatValid(const FlatProgram&, std::size_t bytes);
+
+// LIKE patterns are compiled to a pair of bytes for each element of the
+// pattern, which both forms of expression match without allocating
+std::pmr::string likeElements(std::string_view pattern, char escape,
+                              std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+bool likeMatch(std::string_view s, std::string_view elements);
+
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef SELECTOR_FUZZ_H
+#define SELECTOR_FUZZ_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+// Support for the fuzz target and its regression test: this is not part of
+// the library
+
+#include "SelectorEnv.h"
+#include "SelectorExpression.h"
+#include "SelectorProfile.h"
+#include "SelectorValue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+namespace selector::fuzz {
+
+// Every property has the value that follows the selector in an input:
+// identifiers starting with n its length as a number and the others the
+// value as a string
+class FuzzEnv : public Env {
+    Value string;
+    Value number;
+
+public:
+    explicit FuzzEnv(std::string_view v) :
+        string(v),
+        number(int64_t(v.size()))
+    {}
+
+    const Value& value(const std::string_view name) const override {
+        return !name.empty() && name[0]=='n' ? number : string;
+    }
+};
+
+// Fixed costs a small input is allowed on top of its cost per byte
+constexpr std::size_t allowance = 64;
+
+// The most work (see WorkCounter) an input in the regression corpus may
+// cost per byte. Inputs of every shape in the corpus cost one or two units
+// per byte whatever their size, while one of tens of kilobytes whose cost
+// is quadratic in its size is at hundreds.
+constexpr double maxWorkPerByte = 16;
+
+struct Cost {
+    bool parsed = false;
+    uint64_t work = 0;
+    std::size_t size = 0;
+
+    double perByte() const {
+        return double(work)/(size+allowance);
+    }
+};
+
+// Parse the selector in an input, evaluate it and its simplified form
+// against the value after the first NUL, and count the work that took. As
+// evaluation isn't counted node by node its cost is taken to be the
+// expressions' estimated costs.
+inline Cost run(const uint8_t* data, std::size_t size)
+{
+    auto input = std::string_view{reinterpret_cast<const char*>(data), size};
+    auto nul = input.find('\0');
+    FuzzEnv env{nul==input.npos ? std::string_view{} : input.substr(nul+1)};
+
+    Cost cost;
+    cost.size = size;
+    WorkCounter work;
+    try {
+        auto e = make_selector(input.substr(0, nul));
+        cost.parsed = true;
+        eval(*e, env);
+        auto s = simplify(*e);
+        eval(*s, env);
+        cost.work += estimated_cost(*e) + estimated_cost(*s);
+    } catch (std::range_error&) {
+        // Not a selector
+    }
+    cost.work += work.count();
+    return cost;
+}
+
+}
+
+#endif
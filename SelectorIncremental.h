@@ -0,0 +1,88 @@
+#ifndef SELECTOR_INCREMENTAL_H
+#define SELECTOR_INCREMENTAL_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorValue.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+class Env;
+class Expression;
+
+/**
+ * Evaluate an expression repeatedly against one message whose properties
+ * change between evaluations.
+ *
+ * The context remembers the result of every subexpression; after being told
+ * which properties changed only the subexpressions that depend on them are
+ * evaluated again. Unchanged properties must keep their values (and any
+ * string storage) between evaluations.
+ *
+ * Use reset() before evaluating a different message.
+ */
+class IncrementalEval {
+public:
+    struct Slot {
+        Value value;
+        bool valid = false;
+    };
+
+private:
+    std::vector<std::string> ids;
+    std::vector<std::vector<std::size_t>> dependents; // Slots depending on each id
+    std::vector<Slot> slots;
+    std::size_t evaluations_ = 0;
+    std::unique_ptr<Expression> expression;
+
+public:
+    SELECTORS_EXPORT explicit IncrementalEval(const Expression&);
+    SELECTORS_EXPORT ~IncrementalEval();
+
+    IncrementalEval(const IncrementalEval&) = delete;
+    IncrementalEval& operator=(const IncrementalEval&) = delete;
+
+    SELECTORS_EXPORT BoolOrNone eval_bool(const Env&);
+    bool eval(const Env& env) {
+        return eval_bool(env)==BN_TRUE;
+    }
+
+    SELECTORS_EXPORT void changed(std::string_view property);
+    SELECTORS_EXPORT void reset();
+
+    // How many subexpressions have been evaluated (rather than reused) so far
+    std::size_t evaluations() const {
+        return evaluations_;
+    }
+};
+
+}
+
+#endif
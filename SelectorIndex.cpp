@@ -0,0 +1,273 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorIndex.h"
+
+#include "SelectorProfile.h"
+#include "SelectorValue.h"
+
+#include <algorithm>
+#include <iterator>
+#include <ostream>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using std::get;
+using std::ostream;
+using std::string_view;
+using std::vector;
+
+namespace selector {
+
+// A total order on key values (unlike the selector comparison operators):
+// booleans then numbers then strings. Exact and inexact numbers with the
+// same value are equivalent just as they are equal in selectors.
+bool keyLess(const Value& v1, const Value& v2)
+{
+    auto rank = [](const Value& v) {
+        switch (v.type()) {
+        case Value::T_BOOL:    return 1;
+        case Value::T_EXACT:
+        case Value::T_INEXACT: return 2;
+        case Value::T_STRING:  return 3;
+        default:               return 0;
+        }
+    };
+    int r1 = rank(v1);
+    int r2 = rank(v2);
+    if (r1!=r2) return r1<r2;
+    switch (r1) {
+    case 1: return get<bool>(v1.value) < get<bool>(v2.value);
+    case 2: return v1 < v2;
+    case 3: return get<string_view>(v1.value) < get<string_view>(v2.value);
+    default: return false;
+    }
+}
+
+namespace {
+
+inline bool keyEqual(const Value& v1, const Value& v2)
+{
+    return !keyLess(v1, v2) && !keyLess(v2, v1);
+}
+
+// Is the lower bound of r1 below the lower bound of r2
+inline bool lowerBelow(const KeyRange& r1, const KeyRange& r2)
+{
+    if (unknown(r1.lower)) return !unknown(r2.lower);
+    if (unknown(r2.lower)) return false;
+    return r1.lower<r2.lower || (r1.lower==r2.lower && r1.lowerInclusive && !r2.lowerInclusive);
+}
+
+// Is the upper bound of r1 above the upper bound of r2
+inline bool upperAbove(const KeyRange& r1, const KeyRange& r2)
+{
+    if (unknown(r1.upper)) return !unknown(r2.upper);
+    if (unknown(r2.upper)) return false;
+    return r1.upper>r2.upper || (r1.upper==r2.upper && r1.upperInclusive && !r2.upperInclusive);
+}
+
+// Do ranges r1 and r2 overlap or abut given that r1 starts no later than r2
+inline bool joins(const KeyRange& r1, const KeyRange& r2)
+{
+    if (unknown(r1.upper) || unknown(r2.lower)) return true;
+    if (r2.lower<r1.upper) return true;
+    return r2.lower==r1.upper && (r1.upperInclusive || r2.lowerInclusive);
+}
+
+// Is v inside one of the sorted, merged ranges rs: only the last one starting
+// at or below v can contain it, so there's no need to try them all
+bool inRanges(const vector<KeyRange>& rs, const Value& v)
+{
+    if (!numeric(v)) return false;
+    auto i = std::partition_point(rs.begin(), rs.end(), [&](const KeyRange& r) {
+        return unknown(r.lower) || !(r.lower>v);
+    });
+    return i!=rs.begin() && std::prev(i)->contains(v);
+}
+
+// A crude measure of how much of the index a plan will have to look at
+std::size_t cost(const IndexPlan& p)
+{
+    std::size_t c = 0;
+    for (auto& k : p.keys) {
+        c += k.points.size();
+        for (auto& r : k.ranges) {
+            c += (unknown(r.lower) || unknown(r.upper)) ? 16 : 4;
+        }
+    }
+    return c;
+}
+
+}
+
+bool empty(const KeyRange& r)
+{
+    if (unknown(r.lower) || unknown(r.upper)) return false;
+    if (r.lower<r.upper) return false;
+    return !(r.lower==r.upper && r.lowerInclusive && r.upperInclusive);
+}
+
+bool KeyRange::contains(const Value& v) const
+{
+    if (!numeric(v)) return false;
+    if (!unknown(lower) && !(v>lower || (lowerInclusive && v==lower))) return false;
+    if (!unknown(upper) && !(v<upper || (upperInclusive && v==upper))) return false;
+    return true;
+}
+
+bool KeySet::contains(const Value& v) const
+{
+    auto i = std::lower_bound(points.begin(), points.end(), v, keyLess);
+    if (i!=points.end() && *i==v) return true;
+    return inRanges(ranges, v);
+}
+
+// Sort and merge the ranges, then sort the points removing duplicates
+// and any points already covered by a range
+void normalise(KeySet& k)
+{
+    WorkCounter::add(k.points.size() + k.ranges.size());
+    auto& rs = k.ranges;
+    rs.erase(std::remove_if(rs.begin(), rs.end(), [](const KeyRange& r){ return empty(r); }), rs.end());
+    std::sort(rs.begin(), rs.end(), lowerBelow);
+    vector<KeyRange> merged;
+    for (auto& r : rs) {
+        if (!merged.empty() && joins(merged.back(), r)) {
+            if (upperAbove(r, merged.back())) {
+                merged.back().upper = r.upper;
+                merged.back().upperInclusive = r.upperInclusive;
+            }
+        } else {
+            merged.push_back(r);
+        }
+    }
+    rs = std::move(merged);
+
+    auto& ps = k.points;
+    ps.erase(std::remove_if(ps.begin(), ps.end(), [&](const Value& v) {
+        return unknown(v) || inRanges(rs, v);
+    }), ps.end());
+    std::sort(ps.begin(), ps.end(), keyLess);
+    ps.erase(std::unique(ps.begin(), ps.end(), keyEqual), ps.end());
+}
+
+KeySet intersect(const KeySet& k1, const KeySet& k2)
+{
+    KeySet r{k1.identifier, {}, {}};
+    for (auto& p : k1.points) {
+        if (k2.contains(p)) r.points.push_back(p);
+    }
+    for (auto& p : k2.points) {
+        if (k1.contains(p)) r.points.push_back(p);
+    }
+    WorkCounter::add(k1.ranges.size() * k2.ranges.size());
+    for (auto& r1 : k1.ranges) {
+        for (auto& r2 : k2.ranges) {
+            KeyRange i{
+                lowerBelow(r1, r2) ? r2.lower : r1.lower,
+                upperAbove(r1, r2) ? r2.upper : r1.upper,
+                lowerBelow(r1, r2) ? r2.lowerInclusive : r1.lowerInclusive,
+                upperAbove(r1, r2) ? r2.upperInclusive : r1.upperInclusive
+            };
+            if (!empty(i)) r.ranges.push_back(i);
+        }
+    }
+    normalise(r);
+    return r;
+}
+
+KeySet unite(const KeySet& k1, const KeySet& k2)
+{
+    KeySet r{k1};
+    r.points.insert(r.points.end(), k2.points.begin(), k2.points.end());
+    r.ranges.insert(r.ranges.end(), k2.ranges.begin(), k2.ranges.end());
+    normalise(r);
+    return r;
+}
+
+IndexPlan noScan()
+{
+    return IndexPlan{false, {}};
+}
+
+IndexPlan keyScan(KeySet&& k)
+{
+    normalise(k);
+    if (k.points.empty() && k.ranges.empty()) return noScan();
+    IndexPlan p{false, {}};
+    p.keys.push_back(std::move(k));
+    return p;
+}
+
+// Both plans must be satisfied: the intersection of the two candidate sets is
+// only representable if they constrain the same single property; otherwise
+// either plan is a sound over-approximation, so use the cheaper one.
+IndexPlan planAnd(IndexPlan&& p1, IndexPlan&& p2)
+{
+    if (p1.fullScan) return std::move(p2);
+    if (p2.fullScan) return std::move(p1);
+    if (p1.keys.empty() || p2.keys.empty()) return noScan();
+    if (p1.keys.size()==1 && p2.keys.size()==1 && p1.keys[0].identifier==p2.keys[0].identifier) {
+        return keyScan(intersect(p1.keys[0], p2.keys[0]));
+    }
+    return cost(p2)<cost(p1) ? std::move(p2) : std::move(p1);
+}
+
+// Either plan may be satisfied so look up the union of both candidate sets
+IndexPlan planOr(IndexPlan&& p1, IndexPlan&& p2)
+{
+    if (p1.fullScan || p2.fullScan) return IndexPlan{};
+    for (auto& k2 : p2.keys) {
+        auto k1 = std::find_if(p1.keys.begin(), p1.keys.end(), [&](const KeySet& k) { return k.identifier==k2.identifier; });
+        if (k1==p1.keys.end()) p1.keys.push_back(std::move(k2));
+        else *k1 = unite(*k1, k2);
+    }
+    return std::move(p1);
+}
+
+ostream& operator<<(ostream& os, const IndexPlan& p)
+{
+    if (p.fullScan) return os << "FULL SCAN";
+    if (p.keys.empty()) return os << "NO SCAN";
+    for (std::size_t i = 0; i<p.keys.size(); ++i) {
+        auto& k = p.keys[i];
+        if (i>0) os << " OR ";
+        os << k.identifier << ":";
+        if (!k.points.empty()) {
+            os << " {";
+            for (std::size_t j = 0; j<k.points.size(); ++j) {
+                os << k.points[j] << (j<k.points.size()-1 ? ", " : "}");
+            }
+        }
+        for (auto& r : k.ranges) {
+            os << " " << (r.lowerInclusive ? "[" : "(");
+            if (unknown(r.lower)) os << "-inf"; else os << r.lower;
+            os << ", ";
+            if (unknown(r.upper)) os << "+inf"; else os << r.upper;
+            os << (r.upperInclusive ? "]" : ")");
+        }
+    }
+    return os;
+}
+
+}
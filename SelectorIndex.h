@@ -0,0 +1,99 @@
+#ifndef SELECTOR_INDEX_H
+#define SELECTOR_INDEX_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorValue.h"
+
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+class Expression;
+
+/**
+ * A contiguous range of numeric key values.
+ * An unknown bound means the range is unbounded in that direction.
+ */
+struct KeyRange {
+    Value lower;
+    Value upper;
+    bool lowerInclusive = false;
+    bool upperInclusive = false;
+
+    SELECTORS_EXPORT bool contains(const Value&) const;
+};
+
+/**
+ * The values of a single property that a matching message might have:
+ * any of the points or any value inside one of the ranges.
+ */
+struct KeySet {
+    std::string identifier;
+    std::vector<Value> points;
+    std::vector<KeyRange> ranges;
+
+    SELECTORS_EXPORT bool contains(const Value&) const;
+};
+
+/**
+ * An over-approximation of the messages a selector can match, expressed as
+ * index lookups on a chosen set of indexed properties.
+ *
+ * If fullScan is set the selector cannot be restricted by the indexed
+ * properties and every message is a candidate. Otherwise the candidates are
+ * the union of the messages found by looking up each KeySet in keys (so an
+ * empty keys means that no message can match).
+ *
+ * Every message that the selector matches is a candidate, but not every candidate
+ * is necessarily matched: the full selector must still be evaluated on each one.
+ *
+ * String values in the plan refer to literals inside the expression so the
+ * plan must not outlive the expression it was made from.
+ */
+struct IndexPlan {
+    bool fullScan = true;
+    std::vector<KeySet> keys;
+};
+
+SELECTORS_EXPORT IndexPlan index_plan(const Expression&, const std::vector<std::string_view>& indexed);
+SELECTORS_EXPORT std::ostream& operator<<(std::ostream&, const IndexPlan&);
+
+// Used to build up plans when walking the expression
+bool keyLess(const Value&, const Value&);
+bool empty(const KeyRange&);
+void normalise(KeySet&);
+KeySet intersect(const KeySet&, const KeySet&);
+KeySet unite(const KeySet&, const KeySet&);
+IndexPlan noScan();
+IndexPlan keyScan(KeySet&&);
+IndexPlan planAnd(IndexPlan&&, IndexPlan&&);
+IndexPlan planOr(IndexPlan&&, IndexPlan&&);
+
+}
+
+#endif
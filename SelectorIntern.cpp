@@ -0,0 +1,144 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorIntern.h"
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <unordered_set>
+
+namespace selector {
+
+namespace {
+
+// Each interned string is one of these followed by its text and a NUL
+struct Entry {
+    std::atomic<std::size_t> refs;
+    const std::size_t hash;
+    const std::size_t size;
+
+    Entry(std::size_t h, std::string_view s) :
+        refs(1),
+        hash(h),
+        size(s.size())
+    {
+        auto chars = reinterpret_cast<char*>(this+1);
+        std::memcpy(chars, s.data(), s.size());
+        chars[s.size()] = '\0';
+    }
+
+    std::string_view text() const {
+        return {reinterpret_cast<const char*>(this+1), size};
+    }
+
+    static Entry* of(std::string_view s) {
+        return reinterpret_cast<Entry*>(const_cast<char*>(s.data())) - 1;
+    }
+};
+
+// Shards of the table so that threads compiling selectors at once rarely
+// wait for each other
+struct Shard {
+    std::mutex lock;
+    std::unordered_set<std::string_view> views; // Of entries
+};
+
+constexpr std::size_t SHARDS = 16;
+
+// Never destroyed, as strings may be released by other static objects
+// destructors, and intern()'s are kept for good
+std::array<Shard, SHARDS>& shards()
+{
+    static auto s = new std::array<Shard, SHARDS>;
+    return *s;
+}
+
+// Takes a reference to the entry for s, making it if there is none
+std::string_view acquire(std::string_view s)
+{
+    auto h = std::hash<std::string_view>{}(s);
+    auto& shard = shards()[h%SHARDS];
+    std::lock_guard<std::mutex> l{shard.lock};
+    if (auto i = shard.views.find(s); i!=shard.views.end()) {
+        Entry::of(*i)->refs.fetch_add(1, std::memory_order_relaxed);
+        return *i;
+    }
+    auto e = new (::operator new(sizeof(Entry)+s.size()+1)) Entry(h, s);
+    shard.views.insert(e->text());
+    return e->text();
+}
+
+void release(std::string_view s)
+{
+    auto e = Entry::of(s);
+    // Only the last reference needs the lock, to remove the entry before
+    // anyone can find it again
+    auto n = e->refs.load(std::memory_order_relaxed);
+    while (n>1) {
+        if (e->refs.compare_exchange_weak(n, n-1, std::memory_order_release, std::memory_order_relaxed)) return;
+    }
+    auto& shard = shards()[e->hash%SHARDS];
+    std::lock_guard<std::mutex> l{shard.lock};
+    // Someone may have interned it again since
+    if (e->refs.fetch_sub(1, std::memory_order_acq_rel)!=1) return;
+    shard.views.erase(s);
+    e->~Entry();
+    ::operator delete(e);
+}
+
+}
+
+std::string_view intern(std::string_view s)
+{
+    // The reference is never released
+    return acquire(s);
+}
+
+InternedString::InternedString(std::string_view s) :
+    text(acquire(s))
+{}
+
+InternedString::InternedString(const InternedString& o) :
+    text(o.text)
+{
+    if (text.data()) Entry::of(text)->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+InternedString::~InternedString()
+{
+    if (text.data()) release(text);
+}
+
+std::size_t interned_count()
+{
+    std::size_t n = 0;
+    for (auto& shard : shards()) {
+        std::lock_guard<std::mutex> l{shard.lock};
+        n += shard.views.size();
+    }
+    return n;
+}
+
+}
@@ -0,0 +1,84 @@
+#ifndef SELECTOR_INTERN_H
+#define SELECTOR_INTERN_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <cstddef>
+#include <string_view>
+#include <utility>
+
+#include "SelectorValue.h"
+#include "selectors_export.h"
+
+namespace selector {
+
+// Interned strings: while a string is interned, interning an equal string
+// gives the same pointer, so two interned strings are equal exactly when
+// their pointers are. The text is NUL terminated. Safe to use from any thread.
+
+// Interns for the life of the program. This is what selector_intern() keeps
+// for programs using the C interface.
+SELECTORS_EXPORT std::string_view intern(std::string_view);
+
+// A counted reference to an interned string: the string stays interned
+// until its last reference goes. String literals and the string values of
+// the C interface hold these.
+class InternedString {
+    std::string_view text;
+
+public:
+    InternedString() = default;
+    SELECTORS_EXPORT explicit InternedString(std::string_view);
+    SELECTORS_EXPORT InternedString(const InternedString&);
+    SELECTORS_EXPORT ~InternedString();
+
+    InternedString(InternedString&& o) noexcept :
+        text(o.text)
+    {
+        o.text = {};
+    }
+
+    InternedString& operator=(InternedString o) noexcept {
+        std::swap(text, o.text);
+        return *this;
+    }
+
+    std::string_view view() const {
+        return text;
+    }
+
+    // A string value of the text tagged as interned, so that comparing it
+    // with another interned value only compares pointers. It mustn't
+    // outlive this reference.
+    Value value() const {
+        Value v{text};
+        v.interned = true;
+        return v;
+    }
+};
+
+// How many strings are interned
+SELECTORS_EXPORT std::size_t interned_count();
+
+}
+
+#endif
@@ -0,0 +1,345 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorJson.h"
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace selector {
+
+namespace {
+
+bool isWhitespace(char c)
+{
+    return c==' ' || c=='\n' || c=='\r' || c=='\t';
+}
+
+const char* skipWhitespace(const char* p, const char* e)
+{
+    while (p!=e && isWhitespace(*p)) ++p;
+    return p;
+}
+
+// p is just after an opening quote: the closing quote or e if there isn't
+// one. memchr() finds candidates quickly and a quote is escaped just when an
+// odd number of backslashes comes before it
+const char* endOfString(const char* p, const char* e)
+{
+    while (p!=e) {
+        auto q = static_cast<const char*>(std::memchr(p, '"', e-p));
+        if (!q) return e;
+        auto b = q;
+        while (b!=p && b[-1]=='\\') --b;
+        if ((q-b)%2==0) return q;
+        p = q+1;
+    }
+    return e;
+}
+
+bool isStructural(char c)
+{
+    return c=='"' || c=='{' || c=='}' || c=='[' || c==']';
+}
+
+// The first quote, brace or bracket at or after p: SSE2 looks at 16 characters
+// at a time. '[' and ']' differ from '{' and '}' only in bit 5 so folding that
+// bit in finds all four with two comparisons
+const char* nextStructural(const char* p, const char* e)
+{
+#ifdef __SSE2__
+    for (; e-p>=16; p+=16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto f = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        auto m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                 _mm_or_si128(_mm_cmpeq_epi8(f, _mm_set1_epi8('{')), _mm_cmpeq_epi8(f, _mm_set1_epi8('}'))));
+        auto found = unsigned(_mm_movemask_epi8(m));
+        if (found) return p + __builtin_ctz(found);
+    }
+#endif
+    while (p!=e && !isStructural(*p)) ++p;
+    return p;
+}
+
+// p is at an opening brace or bracket: just past the matching close or e.
+// Only nesting is tracked, so this is not a validator
+const char* skipNested(const char* p, const char* e)
+{
+    std::size_t depth = 0;
+    while ((p = nextStructural(p, e))!=e) {
+        switch (*p) {
+        case '"':
+            p = endOfString(p+1, e);
+            if (p==e) return e;
+            break;
+        case '{':
+        case '[':
+            ++depth;
+            break;
+        default:
+            if (--depth==0) return p+1;
+        }
+        ++p;
+    }
+    return e;
+}
+
+// The end of the value starting at p
+const char* skipValue(const char* p, const char* e)
+{
+    if (p==e) return e;
+    switch (*p) {
+    case '"': {
+        auto q = endOfString(p+1, e);
+        return q==e ? e : q+1;
+    }
+    case '{':
+    case '[':
+        return skipNested(p, e);
+    default:
+        while (p!=e && *p!=',' && *p!='}' && *p!=']' && !isWhitespace(*p)) ++p;
+        return p;
+    }
+}
+
+void appendUtf8(std::string& s, uint32_t c)
+{
+    if (c<0x80) {
+        s += char(c);
+    } else if (c<0x800) {
+        s += char(0xc0 | c>>6);
+        s += char(0x80 | (c & 0x3f));
+    } else if (c<0x10000) {
+        s += char(0xe0 | c>>12);
+        s += char(0x80 | (c>>6 & 0x3f));
+        s += char(0x80 | (c & 0x3f));
+    } else {
+        s += char(0xf0 | c>>18);
+        s += char(0x80 | (c>>12 & 0x3f));
+        s += char(0x80 | (c>>6 & 0x3f));
+        s += char(0x80 | (c & 0x3f));
+    }
+}
+
+bool hex4(const char*& p, const char* e, uint32_t& c)
+{
+    if (e-p<4) return false;
+    auto r = std::from_chars(p, p+4, c, 16);
+    if (r.ec!=std::errc{} || r.ptr!=p+4) return false;
+    p += 4;
+    return true;
+}
+
+// Decode the body of a string containing escapes: false if an escape is bad
+bool unescape(std::string_view s, std::string& out)
+{
+    out.reserve(s.size());
+    auto p = s.data();
+    auto e = p + s.size();
+    while (p!=e) {
+        auto b = static_cast<const char*>(std::memchr(p, '\\', e-p));
+        if (!b) b = e;
+        out.append(p, b);
+        if (b==e) break;
+        p = b+1;
+        if (p==e) return false;
+        switch (*p++) {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/': out += '/'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+            uint32_t c;
+            if (!hex4(p, e, c)) return false;
+            // A high surrogate must be followed by an escaped low one
+            if (c>=0xd800 && c<0xdc00) {
+                uint32_t low;
+                if (e-p<2 || p[0]!='\\' || p[1]!='u') return false;
+                p += 2;
+                if (!hex4(p, e, low) || low<0xdc00 || low>=0xe000) return false;
+                c = 0x10000 + ((c-0xd800)<<10) + (low-0xdc00);
+            } else if (c>=0xdc00 && c<0xe000) {
+                return false;
+            }
+            appendUtf8(out, c);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+Value number(std::string_view t)
+{
+    auto b = t.data();
+    auto e = b + t.size();
+    if (t.find_first_of(".eE")==t.npos) {
+        int64_t i;
+        auto r = std::from_chars(b, e, i);
+        if (r.ec==std::errc{} && r.ptr==e) return i;
+        if (r.ec!=std::errc::result_out_of_range || r.ptr!=e) return {};
+    }
+    double x;
+    auto r = std::from_chars(b, e, x);
+    if (r.ec==std::errc{} && r.ptr==e) return x;
+    return {};
+}
+
+}
+
+JsonEnv::JsonEnv(std::string_view json0) :
+    json(json0)
+{}
+
+JsonEnv::Field& JsonEnv::field(std::size_t i) const
+{
+    if (i<inlineFields) return first[i];
+    i -= inlineFields;
+    return chunks[i/chunkFields][i%chunkFields];
+}
+
+JsonEnv::Field& JsonEnv::add(std::string_view key, std::string_view text) const
+{
+    if (count>=inlineFields && (count-inlineFields)%chunkFields==0) {
+        chunks.emplace_back(new Field[chunkFields]);
+    }
+    auto& f = field(count++);
+    f.key = key;
+    f.text = text;
+    return f;
+}
+
+// Scan on until the member named key, remembering every member passed
+JsonEnv::Field* JsonEnv::scan(std::string_view key) const
+{
+    auto b = json.data();
+    auto e = b + json.size();
+    auto p = b + position;
+    auto fail = [this]() -> Field* {
+        finished = true;
+        failed = true;
+        return nullptr;
+    };
+
+    if (!started) {
+        p = skipWhitespace(p, e);
+        if (p==e || *p!='{') return fail();
+        ++p;
+        started = true;
+    }
+    while (true) {
+        p = skipWhitespace(p, e);
+        if (p==e) return fail();
+        if (*p=='}') {
+            finished = true;
+            return nullptr;
+        }
+        if (count>0) {
+            if (*p!=',') return fail();
+            p = skipWhitespace(p+1, e);
+            if (p==e) return fail();
+        }
+        if (*p!='"') return fail();
+        auto k = endOfString(p+1, e);
+        if (k==e) return fail();
+        std::string_view name(p+1, k-p-1);
+        if (name.find('\\')!=name.npos) {
+            std::string decoded;
+            if (!unescape(name, decoded)) return fail();
+            name = chars.emplace_front(std::move(decoded));
+        }
+        p = skipWhitespace(k+1, e);
+        if (p==e || *p!=':') return fail();
+        p = skipWhitespace(p+1, e);
+        auto v = skipValue(p, e);
+        if (v==p || v==e) return fail();
+        auto& f = add(name, {p, std::size_t(v-p)});
+        p = v;
+        position = p - b;
+        if (name==key) return &f;
+    }
+}
+
+const Value& JsonEnv::value(const std::string_view key) const
+{
+    static const Value unknown;
+
+    Field* f = nullptr;
+    for (std::size_t i = 0; i<count; ++i) {
+        if (field(i).key==key) {
+            f = &field(i);
+            break;
+        }
+    }
+    if (!f && !finished) f = scan(key);
+    if (!f) return unknown;
+
+    if (!f->decoded) {
+        auto t = f->text;
+        switch (t[0]) {
+        case '"': {
+            auto s = t.substr(1, t.size()-2);
+            if (s.find('\\')==s.npos) {
+                f->value = s;
+            } else if (std::string decoded; unescape(s, decoded)) {
+                f->value = std::string_view(chars.emplace_front(std::move(decoded)));
+            }
+            break;
+        }
+        case 't':
+            if (t=="true") f->value = true;
+            break;
+        case 'f':
+            if (t=="false") f->value = false;
+            break;
+        case '-':
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            f->value = number(t);
+            break;
+        default:
+            // null, objects and arrays
+            break;
+        }
+        f->decoded = true;
+    }
+    return f->value;
+}
+
+bool JsonEnv::complete() const
+{
+    while (!finished) scan({});
+    return !failed;
+}
+
+}
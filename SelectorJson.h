@@ -0,0 +1,98 @@
+#ifndef SELECTOR_JSON_H
+#define SELECTOR_JSON_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include "SelectorEnv.h"
+#include "SelectorValue.h"
+
+#include <cstddef>
+#include <forward_list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+/**
+ * The properties of a message held as a flat JSON object.
+ *
+ * Nothing is parsed up front: looking up a property scans the top level
+ * members from where the last lookup stopped until it finds the key,
+ * skipping nested objects, arrays and strings without decoding them. Every
+ * key passed on the way is remembered with its value's offset so later
+ * lookups of it don't scan again, and a value is decoded only the first
+ * time it is asked for.
+ *
+ * Integers that fit in 64 bits are exact and other numbers inexact; strings
+ * without escapes are views into the buffer and escaped strings are decoded
+ * once into storage owned by the env. null, objects, arrays, missing keys
+ * and anything after a syntax error are unknown. If a key occurs more than
+ * once the first occurrence wins.
+ *
+ * The buffer must outlive the env and any values taken from it. The env is
+ * not thread safe, even for lookups, as they update the cache.
+ */
+class SELECTORS_EXPORT JsonEnv : public Env {
+    struct Field {
+        std::string_view key;  // Decoded
+        std::string_view text; // The undecoded value
+        bool decoded = false;
+        Value value;
+    };
+
+    // The keys found so far in document order: the first few are kept in the
+    // env itself so that a typical message needs no allocation, and the rest
+    // in chunks, so a field never moves once found
+    static constexpr std::size_t inlineFields = 16;
+    static constexpr std::size_t chunkFields = 32;
+
+    std::string_view json;
+    mutable std::size_t count = 0;
+    mutable Field first[inlineFields];
+    mutable std::vector<std::unique_ptr<Field[]>> chunks;
+    mutable std::forward_list<std::string> chars; // Storage for decoded keys and strings
+    mutable std::size_t position = 0;       // Where the scan stopped
+    mutable bool started = false;
+    mutable bool finished = false;
+    mutable bool failed = false;
+
+    Field& field(std::size_t i) const;
+    Field& add(std::string_view key, std::string_view text) const;
+    Field* scan(std::string_view key) const;
+
+public:
+    explicit JsonEnv(std::string_view json);
+
+    const Value& value(const std::string_view) const override;
+
+    // Whether the whole object has been scanned without an error
+    bool complete() const;
+};
+
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef SELECTOR_NODE_H
+#define SELECTOR_NODE_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Internal interface of the expression tree nodes: the node types themselves
+// are private to SelectorExpression.cpp, but other parts of the library can
+// inspect trees and add their own node types through this interface.
+
+#include "SelectorExpression.h"
+#include "SelectorIndex.h"
+#include "SelectorValue.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace selector {
+
+class Env;
+class FlatWriter;
+
+// How much of an expression's result its parent depends on when simplifying
+enum Context {
+    C_VALUE, // The exact value
+    C_BOOL,  // The value as a three valued boolean
+    C_MATCH  // Only whether the value is true
+};
+
+class ValueExpression : public Expression {
+public:
+  // Nodes come from the memory resource current when they are made (see
+  // NodeResource) and go back to the one they came from
+  static void* operator new(std::size_t);
+  static void operator delete(void*, std::size_t) noexcept;
+
+  virtual ~ValueExpression() noexcept = default;
+  virtual void repr(std::ostream&) const = 0;
+  virtual Value eval(const Env&) const = 0;
+  
+  virtual BoolOrNone eval_bool(const Env& env) const {
+    return eval(env);
+  }
+
+  // Introspection for the analysis passes
+  virtual const std::pmr::string* identifierName() const {
+    return nullptr;
+  }
+
+  virtual bool literal(Value&) const {
+    return false;
+  }
+
+  virtual void children(std::vector<const ValueExpression*>&) const {
+  }
+
+  // A rough relative cost of evaluating this expression: a node each by default
+  virtual std::size_t cost() const {
+    std::vector<const ValueExpression*> cs;
+    children(cs);
+    std::size_t c = 1;
+    for (auto e : cs) c += e->cost();
+    return c;
+  }
+
+  // A copy of this expression with its children replaced by copy(child)
+  typedef std::function<std::unique_ptr<ValueExpression>(const ValueExpression&)> CopyFn;
+  virtual std::unique_ptr<ValueExpression> copy(const CopyFn&) const = 0;
+
+  // Structural equality
+  virtual bool same(const ValueExpression&) const = 0;
+
+  // Does this expression mean "identifier has a value in the key set":
+  // UNKNOWN if the identifier has no value, otherwise TRUE or FALSE
+  virtual bool keySet(KeySet&) const {
+    return false;
+  }
+
+  // Which messages can make this expression true in terms of the indexed properties
+  virtual IndexPlan indexPlan(const std::vector<std::string_view>& indexed) const {
+    KeySet k;
+    if (!keySet(k) || std::find(indexed.begin(), indexed.end(), k.identifier)==indexed.end()) return IndexPlan{};
+    return keyScan(std::move(k));
+  }
+
+  // Write the flat form of this expression as node at (see SelectorFlat.h)
+  // returning false if it doesn't have one
+  virtual bool flatten(FlatWriter&, uint32_t) const {
+    return false;
+  }
+
+  // Simplified copies of this expression and of its negation
+  virtual std::unique_ptr<ValueExpression> simplified(Context) const = 0;
+  virtual std::unique_ptr<ValueExpression> negated(Context) const;
+};
+
+class BoolExpression : public ValueExpression {
+public:
+  virtual ~BoolExpression() noexcept = default;
+  virtual void repr(std::ostream&) const = 0;
+  virtual BoolOrNone eval_bool(const Env&) const = 0;
+  
+  Value eval(const Env& env) const {
+    return eval_bool(env);
+  }
+};
+
+// While one exists nodes made on its thread, and the strings and lists they
+// hold, come from resource, which must outlive them
+class NodeResource {
+  std::pmr::memory_resource* previous;
+
+public:
+  explicit NodeResource(std::pmr::memory_resource* resource);
+  ~NodeResource();
+
+  NodeResource(const NodeResource&) = delete;
+  NodeResource& operator=(const NodeResource&) = delete;
+
+  // The default resource unless a NodeResource says otherwise
+  static std::pmr::memory_resource* current();
+};
+
+inline bool isLiteral(const ValueExpression& e)
+{
+    Value v;
+    return e.literal(v);
+}
+
+// Add the identifiers in e that are not already in ids
+void collectIdentifiers(const ValueExpression& e, std::vector<std::string>& ids);
+
+}
+
+#endif
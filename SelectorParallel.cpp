@@ -0,0 +1,167 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorParallel.h"
+
+#include "SelectorEnv.h"
+#include "SelectorExpression.h"
+#include "SelectorWait.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using std::size_t;
+using std::vector;
+
+namespace selector {
+
+// The handoff between match() and the workers: the generation is bumped for
+// every message, and pending counts the workers still matching it
+struct alignas(64) ParallelMatcher::Shared {
+    std::atomic<uint32_t> generation{0};
+    std::atomic<uint32_t> sleepers{0};
+    std::atomic<bool> stopping{false};
+    alignas(64) std::atomic<size_t> pending{0};
+    const Env* message = nullptr;
+    unsigned spin;
+};
+
+// Each partition has its own cache lines so workers don't contend
+struct alignas(64) ParallelMatcher::Partition {
+    size_t begin = 0;
+    size_t end = 0;
+    size_t cost = 0;
+    vector<size_t> matched;
+};
+
+ParallelMatcher::ParallelMatcher(vector<const Expression*> s, size_t threads, unsigned spin) :
+    selectors(std::move(s)),
+    shared(new Shared),
+    threads_(std::max<size_t>(std::min(threads, selectors.size()), 1))
+{
+    shared->spin = spin;
+    partitions.reset(new Partition[threads_]);
+
+    // Cut the list where the running cost passes each partition's share of the total
+    vector<size_t> costs;
+    size_t total = 0;
+    for (auto e : selectors) {
+        costs.push_back(estimated_cost(*e));
+        total += costs.back();
+    }
+    size_t i = 0;
+    size_t running = 0;
+    for (size_t p = 0; p<threads_; ++p) {
+        auto& part = partitions[p];
+        part.begin = i;
+        auto target = total*(p+1)/threads_;
+        // Leave at least one selector for each remaining partition
+        auto last = selectors.size() - (threads_-p-1);
+        while (i<last && (running<target || i==part.begin || p==threads_-1)) {
+            running += costs[i];
+            part.cost += costs[i];
+            ++i;
+        }
+        part.end = i;
+    }
+
+    for (size_t p = 1; p<threads_; ++p) {
+        workers.emplace_back([this, p] { work(partitions[p]); });
+    }
+}
+
+ParallelMatcher::~ParallelMatcher()
+{
+    shared->stopping = true;
+    ++shared->generation;
+    wake_all(shared->generation);
+    for (auto& w : workers) w.join();
+}
+
+size_t ParallelMatcher::cost(size_t partition) const
+{
+    return partitions[partition].cost;
+}
+
+void ParallelMatcher::run(Partition& part, const Env& message)
+{
+    part.matched.clear();
+    for (size_t s = part.begin; s<part.end; ++s) {
+        if (eval(*selectors[s], message)) part.matched.push_back(s);
+    }
+}
+
+void ParallelMatcher::work(Partition& part)
+{
+    auto& sh = *shared;
+    uint32_t seen = 0;
+    while (true) {
+        uint32_t g;
+        unsigned spins = 0;
+        while ((g = sh.generation.load(std::memory_order_acquire))==seen) {
+            if (spins++<sh.spin) {
+                cpu_relax();
+                continue;
+            }
+            // A wake up between announcing the sleep and waiting is not lost:
+            // the wait returns at once if the generation has moved on
+            ++sh.sleepers;
+            wait_on(sh.generation, seen);
+            --sh.sleepers;
+        }
+        seen = g;
+        if (sh.stopping) return;
+        run(part, *sh.message);
+        sh.pending.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void ParallelMatcher::match(const Env& message, vector<size_t>& matched)
+{
+    auto& sh = *shared;
+    if (threads_>1) {
+        sh.message = &message;
+        sh.pending.store(threads_-1, std::memory_order_relaxed);
+        ++sh.generation;
+        if (sh.sleepers>0) wake_all(sh.generation);
+    }
+
+    run(partitions[0], message);
+    matched = partitions[0].matched;
+
+    unsigned spins = 0;
+    while (sh.pending.load(std::memory_order_acquire)>0) {
+        if (spins++<sh.spin) cpu_relax();
+        else std::this_thread::yield();
+    }
+    // Partitions are contiguous so concatenating them keeps the ids in order
+    for (size_t p = 1; p<threads_; ++p) {
+        matched.insert(matched.end(), partitions[p].matched.begin(), partitions[p].matched.end());
+    }
+}
+
+}
@@ -0,0 +1,89 @@
+#ifndef SELECTOR_PARALLEL_H
+#define SELECTOR_PARALLEL_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+class Env;
+class Expression;
+
+/**
+ * Match one message at a time against a large set of selectors using
+ * several cores.
+ *
+ * The selectors are divided into contiguous partitions of roughly equal
+ * estimated cost, one per thread. The thread calling match() evaluates the
+ * first partition itself and a worker thread evaluates each of the others.
+ * Workers spin waiting for the next message for a while, then sleep on a
+ * futex until woken, so that a busy matcher hands messages over without
+ * going through a queue or the scheduler.
+ *
+ * Selectors are identified by their position in the list the matcher was
+ * made from. The selectors must outlive the matcher, and the message's
+ * Env::value() must be safe to call from several threads at once.
+ *
+ * Only one thread at a time may call match().
+ */
+class ParallelMatcher {
+    struct Partition;
+    struct Shared;
+
+    std::vector<const Expression*> selectors;
+    std::unique_ptr<Shared> shared;
+    std::unique_ptr<Partition[]> partitions;
+    std::size_t threads_;
+    std::vector<std::thread> workers;
+
+    void run(Partition&, const Env&);
+    void work(Partition&);
+
+public:
+    // spin is how many times an idle worker checks for a message before sleeping
+    SELECTORS_EXPORT ParallelMatcher(std::vector<const Expression*> selectors, std::size_t threads, unsigned spin = 20000);
+    SELECTORS_EXPORT ~ParallelMatcher();
+
+    ParallelMatcher(const ParallelMatcher&) = delete;
+    ParallelMatcher& operator=(const ParallelMatcher&) = delete;
+
+    std::size_t threads() const {
+        return threads_;
+    }
+
+    // The estimated cost of the selectors in a partition
+    SELECTORS_EXPORT std::size_t cost(std::size_t partition) const;
+
+    // The ids of the selectors that match the message in increasing order
+    SELECTORS_EXPORT void match(const Env& message, std::vector<std::size_t>& matched);
+};
+
+}
+
+#endif
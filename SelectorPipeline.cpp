@@ -0,0 +1,102 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorPipeline.h"
+
+#include "SelectorEnv.h"
+#include "SelectorExpression.h"
+#include "SelectorSet.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+using std::size_t;
+
+namespace selector {
+
+FilterStage::FilterStage(const Expression& e, SpscRing<const Env*>& in, SpscRing<Delivery>& out, StageOptions o) :
+    expression(&e),
+    input(in),
+    output(out),
+    options(o),
+    batch(std::max<size_t>(o.batch, 1))
+{}
+
+FilterStage::FilterStage(const SelectorSet& s, SpscRing<const Env*>& in, SpscRing<Delivery>& out, StageOptions o) :
+    set(&s),
+    input(in),
+    output(out),
+    options(o),
+    batch(std::max<size_t>(o.batch, 1))
+{}
+
+void FilterStage::deliver(const Delivery& d)
+{
+    if (!output.tryPush(d)) {
+        counters_.outputFull.fetch_add(1, std::memory_order_relaxed);
+        output.push(d, options.wait);
+    }
+    counters_.deliveries.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FilterStage::process(size_t n)
+{
+    if (expression) {
+        for (size_t i = 0; i<n; ++i) {
+            if (eval(*expression, *batch[i])) deliver(Delivery{batch[i], 0});
+        }
+    } else {
+        batch.resize(n);
+        set->match(batch, matches, Tiling{n, set->size()});
+        for (size_t i = 0; i<n; ++i) {
+            matches.matches(i, ids);
+            for (auto s : ids) deliver(Delivery{batch[i], s});
+        }
+        batch.resize(std::max<size_t>(options.batch, 1));
+    }
+    counters_.messages.fetch_add(n, std::memory_order_relaxed);
+    counters_.batches.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t FilterStage::poll()
+{
+    auto n = input.tryPop(batch.data(), batch.size());
+    if (n==0) {
+        counters_.inputEmpty.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    process(n);
+    return n;
+}
+
+void FilterStage::run()
+{
+    while (true) {
+        if (poll()>0) continue;
+        auto n = input.pop(batch.data(), batch.size(), options.wait);
+        if (n==0) break;
+        process(n);
+    }
+    output.close();
+}
+
+}
@@ -0,0 +1,246 @@
+#ifndef SELECTOR_PIPELINE_H
+#define SELECTOR_PIPELINE_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorSet.h"
+#include "SelectorWait.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+class Env;
+class Expression;
+
+// What a thread does when it can't make progress
+enum class WaitMode {
+    BUSY_POLL, // Spin, yielding the processor now and then, until it can
+    BLOCK      // Spin for a while, then sleep until woken
+};
+
+/**
+ * A lock free bounded queue between one producer thread and one consumer
+ * thread.
+ *
+ * The producer and consumer each keep their own position in their own
+ * cache line, and a cached copy of the other's so that they only touch the
+ * other's cache line when the queue looks full (or empty).
+ */
+template <typename T>
+class SpscRing {
+    std::unique_ptr<T[]> slots;
+    std::size_t mask;
+    unsigned spin;
+
+    // Consumer
+    alignas(64) std::atomic<std::size_t> head{0};
+    std::size_t tailSeen = 0;
+    std::atomic<bool> consumerWaiting{false};
+    std::atomic<uint32_t> popped{0}; // Bumped to wake a waiting producer
+
+    // Producer
+    alignas(64) std::atomic<std::size_t> tail{0};
+    std::size_t headSeen = 0;
+    std::atomic<bool> producerWaiting{false};
+    std::atomic<uint32_t> pushed{0}; // Bumped to wake a waiting consumer
+    std::atomic<bool> closed_{false};
+
+    // Wait until ready() or (when blocking) until woken through event
+    template <typename Ready>
+    void await(WaitMode mode, std::atomic<bool>& waiting, std::atomic<uint32_t>& event, Ready ready) {
+        for (unsigned spins = 0; !ready(); ++spins) {
+            if (spins<spin) {
+                cpu_relax();
+                continue;
+            }
+            // Let the other side run if it shares this core
+            if (mode==WaitMode::BUSY_POLL) {
+                std::this_thread::yield();
+                continue;
+            }
+            // The other side checks waiting after it changes its position
+            // so it either sees this or this sees its change
+            auto seen = event.load();
+            waiting.store(true);
+            if (!ready()) wait_on(event, seen);
+            waiting.store(false);
+        }
+    }
+
+    static void wake(std::atomic<bool>& waiting, std::atomic<uint32_t>& event) {
+        if (!waiting.load()) return;
+        ++event;
+        wake_all(event);
+    }
+
+public:
+    // capacity is rounded up to a power of 2; spin is how many times a blocking
+    // wait checks the queue before sleeping
+    explicit SpscRing(std::size_t capacity, unsigned spin_ = 1000) :
+        spin(spin_)
+    {
+        std::size_t n = 1;
+        while (n<capacity) n *= 2;
+        slots.reset(new T[n]);
+        mask = n-1;
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    std::size_t capacity() const {
+        return mask+1;
+    }
+
+    // Producer: add an item if there is room
+    bool tryPush(const T& item) {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t-headSeen>mask) {
+            headSeen = head.load(std::memory_order_acquire);
+            if (t-headSeen>mask) return false;
+        }
+        slots[t & mask] = item;
+        tail.store(t+1, std::memory_order_seq_cst);
+        wake(consumerWaiting, pushed);
+        return true;
+    }
+
+    // Producer: add an item waiting for room if the queue is full
+    void push(const T& item, WaitMode mode = WaitMode::BLOCK) {
+        if (tryPush(item)) return;
+        await(mode, producerWaiting, popped, [&] { return tail.load(std::memory_order_relaxed)-head.load()<=mask; });
+        tryPush(item);
+    }
+
+    // Producer: there will be no more items
+    void close() {
+        closed_.store(true);
+        ++pushed;
+        wake_all(pushed);
+    }
+
+    // Consumer: take up to max items that are ready
+    std::size_t tryPop(T* out, std::size_t max) {
+        auto h = head.load(std::memory_order_relaxed);
+        if (tailSeen-h<max) tailSeen = tail.load(std::memory_order_acquire);
+        std::size_t n = std::min(tailSeen-h, max);
+        for (std::size_t i = 0; i<n; ++i) out[i] = slots[(h+i) & mask];
+        if (n>0) {
+            head.store(h+n, std::memory_order_seq_cst);
+            wake(producerWaiting, popped);
+        }
+        return n;
+    }
+
+    // Consumer: take up to max items waiting until there is at least one;
+    // returns 0 only once the queue is closed and empty
+    std::size_t pop(T* out, std::size_t max, WaitMode mode = WaitMode::BLOCK) {
+        while (true) {
+            if (auto n = tryPop(out, max)) return n;
+            if (closed_.load()) {
+                // Anything pushed before the close
+                return tryPop(out, max);
+            }
+            await(mode, consumerWaiting, pushed, [&] { return tail.load()!=head.load(std::memory_order_relaxed) || closed_.load(); });
+        }
+    }
+
+    bool closed() const {
+        return closed_.load();
+    }
+};
+
+// A message that matched a selector: selector is 0 when filtering with a single expression
+struct Delivery {
+    const Env* message = nullptr;
+    std::size_t selector = 0;
+};
+
+struct StageOptions {
+    std::size_t batch = 16; // Most messages taken from the input at once
+    WaitMode wait = WaitMode::BLOCK;
+};
+
+// Updated by the stage's thread and safe to read from any thread
+struct StageCounters {
+    std::atomic<uint64_t> messages{0};   // Taken from the input
+    std::atomic<uint64_t> deliveries{0}; // Put on the output
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> inputEmpty{0}; // Times the stage found no input waiting
+    std::atomic<uint64_t> outputFull{0}; // Times the stage was held up by back-pressure
+};
+
+/**
+ * A pipeline stage that filters messages from an input queue to an output
+ * queue with a selector, or with a set of selectors producing a delivery for
+ * each selector a message matches.
+ *
+ * The stage takes messages from its input in batches; a selector set
+ * matches a whole batch at once with SelectorSet::match().
+ *
+ * The stage is the input's only consumer and the output's only producer,
+ * and the selector (or set) must outlive it.
+ */
+class FilterStage {
+    const Expression* expression = nullptr;
+    const SelectorSet* set = nullptr;
+    SpscRing<const Env*>& input;
+    SpscRing<Delivery>& output;
+    StageOptions options;
+    StageCounters counters_;
+    std::vector<const Env*> batch;
+    MatchMatrix matches;
+    std::vector<std::size_t> ids;
+
+    void process(std::size_t n);
+    void deliver(const Delivery&);
+
+public:
+    SELECTORS_EXPORT FilterStage(const Expression&, SpscRing<const Env*>& in, SpscRing<Delivery>& out, StageOptions = {});
+    SELECTORS_EXPORT FilterStage(const SelectorSet&, SpscRing<const Env*>& in, SpscRing<Delivery>& out, StageOptions = {});
+
+    FilterStage(const FilterStage&) = delete;
+    FilterStage& operator=(const FilterStage&) = delete;
+
+    // Filter one batch of whatever input is ready returning how many messages it took
+    SELECTORS_EXPORT std::size_t poll();
+
+    // Filter until the input is closed and empty, then close the output
+    SELECTORS_EXPORT void run();
+
+    const StageCounters& counters() const {
+        return counters_;
+    }
+};
+
+}
+
+#endif
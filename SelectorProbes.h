@@ -0,0 +1,69 @@
+#ifndef SELECTOR_PROBES_H
+#define SELECTOR_PROBES_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+// USDT (user space statically defined tracing) probes for bpftrace, perf,
+// SystemTap and the like, with provider "selectors". A probe is a single nop
+// until a tracer attaches to it, and tracers find probes by the notes that
+// sys/sdt.h adds, not by symbol, so the library's hidden symbols don't
+// matter. Built without SELECTORS_USDT (CMake turns it on when it finds
+// sys/sdt.h) the probes are compiled out.
+//
+//   parse_start(const char* text, size_t length)  text isn't NUL terminated
+//   parse_end(size_t length, int ok, const Expression*)
+//   eval_start(const Expression*)
+//   eval_end(const Expression*, int result)        0 false, 1 true, 2 unknown
+//   like(const char* string, size_t length, int matched)
+//   capi(const char* function)                     each C API call
+//
+// The eval probes fire for each evaluation of a selector against a message,
+// whichever way it is made: eval() (and so the parallel, concurrent and
+// pipeline matchers), ShapeEval, ResultCache, IncrementalEval, ProfiledEval,
+// SelectorSet::match and filter(). Some of these pass something other than
+// the caller's expression: IncrementalEval, ProfiledEval and SelectorSet
+// their own rewritten copy of it, and flatEval() the FlatProgram, as stored
+// selectors have no Expression. A ResultCache hit reports the cached result,
+// a ShapeEval shape that decides the result alone reports only true or
+// false, and filter() fires no probes for rows whose result it gathers from
+// a dictionary column's codes.
+//
+// For example the latency of each selector's evaluations:
+//   bpftrace -e 'usdt:libselectors.so:selectors:eval_start { @start[tid] = nsecs; }
+//                usdt:libselectors.so:selectors:eval_end /@start[tid]/ {
+//                    @ns[arg0] = hist(nsecs - @start[tid]); delete(@start[tid]); }'
+
+#ifdef SELECTORS_USDT
+#include <sys/sdt.h>
+
+#define SELECTOR_PROBE1(name, a) DTRACE_PROBE1(selectors, name, a)
+#define SELECTOR_PROBE2(name, a, b) DTRACE_PROBE2(selectors, name, a, b)
+#define SELECTOR_PROBE3(name, a, b, c) DTRACE_PROBE3(selectors, name, a, b, c)
+#else
+// The arguments are not evaluated
+#define SELECTOR_PROBE1(name, a) do { (void)sizeof(a); } while (false)
+#define SELECTOR_PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (false)
+#define SELECTOR_PROBE3(name, a, b, c) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (false)
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef SELECTOR_PROFILE_H
+#define SELECTOR_PROFILE_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorValue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+class Env;
+class Expression;
+
+/**
+ * Evaluate an expression counting how often each of its nodes is evaluated,
+ * with what result, and how long it takes.
+ *
+ * Nodes are evaluated exactly as they would be otherwise, so a node that a
+ * short circuit skips isn't counted. Times include the node's children and
+ * the cost of reading the clock, which is significant for small nodes.
+ */
+class ProfiledEval {
+public:
+    struct Node {
+        std::string text;
+        unsigned depth = 0;       // In the tree: the root is 0
+        uint64_t evaluations = 0;
+        uint64_t trues = 0;
+        uint64_t falses = 0;
+        uint64_t unknowns = 0;    // Other values are neither true, false nor unknown
+        double ns = 0.0;          // In total
+    };
+
+private:
+    std::vector<Node> nodes_;
+    std::unique_ptr<Expression> expression;
+
+public:
+    SELECTORS_EXPORT explicit ProfiledEval(const Expression&);
+    SELECTORS_EXPORT ~ProfiledEval();
+
+    ProfiledEval(const ProfiledEval&) = delete;
+    ProfiledEval& operator=(const ProfiledEval&) = delete;
+
+    SELECTORS_EXPORT BoolOrNone eval_bool(const Env&);
+    bool eval(const Env& env) {
+        return eval_bool(env)==BN_TRUE;
+    }
+
+    SELECTORS_EXPORT void reset();
+
+    // Every node, each before its children
+    const std::vector<Node>& nodes() const {
+        return nodes_;
+    }
+};
+
+// A table of the nodes' counts, indented to show the tree
+SELECTORS_EXPORT std::ostream& operator<<(std::ostream&, const ProfiledEval&);
+
+/**
+ * Count the work done on its thread while it exists: the expression nodes
+ * made by parsing, simplifying and copying, the terms and key set entries
+ * compared while simplifying and the steps taken matching LIKE patterns.
+ * Evaluating a node isn't counted, as evaluation is linear in the nodes
+ * apart from LIKE.
+ *
+ * Unlike time, the count is the same on every run on every machine, so
+ * tests can bound it (see SelectorFuzz.h). An inner counter's work is also
+ * counted by the one it is inside.
+ */
+class WorkCounter {
+    uint64_t count_ = 0;
+    WorkCounter* previous;
+
+    static thread_local WorkCounter* current;
+
+public:
+    SELECTORS_EXPORT WorkCounter();
+    SELECTORS_EXPORT ~WorkCounter();
+
+    WorkCounter(const WorkCounter&) = delete;
+    WorkCounter& operator=(const WorkCounter&) = delete;
+
+    uint64_t count() const {
+        return count_;
+    }
+
+    // Used inside the library to count n units of work
+    static void add(uint64_t n) {
+        if (current) current->count_ += n;
+    }
+};
+
+}
+
+#endif
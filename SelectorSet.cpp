@@ -0,0 +1,202 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorSet.h"
+
+#include "SelectorEnv.h"
+#include "SelectorExpression.h"
+#include "SelectorNode.h"
+#include "SelectorProbes.h"
+#include "SelectorValue.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::make_unique;
+using std::ostream;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::unique_ptr;
+using std::vector;
+
+namespace selector {
+
+namespace {
+
+// The properties of the messages in a block, loaded on first use
+class BlockEnv : public Env {
+    const vector<string>& ids;
+    vector<Value> values;
+    vector<uint32_t> loaded; // The generation each value was loaded in
+    uint32_t generation = 0;
+    const Env* message = nullptr;
+    Value* row = nullptr;
+    uint32_t* rowLoaded = nullptr;
+
+public:
+    BlockEnv(const vector<string>& i, size_t messages) :
+        ids(i),
+        values(messages*i.size()),
+        loaded(messages*i.size())
+    {}
+
+    // Start a new block of messages
+    void next() {
+        ++generation;
+    }
+
+    void select(size_t m, const Env& env) {
+        message = &env;
+        row = &values[m*ids.size()];
+        rowLoaded = &loaded[m*ids.size()];
+    }
+
+    const Value& slot(size_t s) const {
+        if (rowLoaded[s]!=generation) {
+            row[s] = message->value(ids[s]);
+            rowLoaded[s] = generation;
+        }
+        return row[s];
+    }
+
+    const Value& value(const string_view name) const override {
+        return message->value(name);
+    }
+};
+
+// An identifier resolved to a slot of the set's properties
+class SlotIdentifier : public ValueExpression {
+    std::pmr::string name;
+    size_t s;
+
+public:
+    SlotIdentifier(string_view n, size_t s0) :
+        name(n, NodeResource::current()),
+        s(s0)
+    {}
+
+    void repr(ostream& os) const {
+        os << "I:" << name;
+    }
+
+    // Only ever evaluated by the set with a BlockEnv
+    Value eval(const Env& env) const {
+        return static_cast<const BlockEnv&>(env).slot(s);
+    }
+
+    const std::pmr::string* identifierName() const {
+        return &name;
+    }
+
+    bool same(const ValueExpression& o) const {
+        auto c = dynamic_cast<const SlotIdentifier*>(&o);
+        return c && c->s==s;
+    }
+
+    unique_ptr<ValueExpression> copy(const CopyFn&) const {
+        return make_unique<SlotIdentifier>(name, s);
+    }
+
+    unique_ptr<ValueExpression> simplified(Context) const {
+        return make_unique<SlotIdentifier>(name, s);
+    }
+};
+
+// The eval probes see the set's own rewritten copy of each selector
+inline BoolOrNone probedEval(const ValueExpression& e, const Env& env)
+{
+    SELECTOR_PROBE1(eval_start, static_cast<const Expression*>(&e));
+    auto r = e.eval_bool(env);
+    SELECTOR_PROBE2(eval_end, static_cast<const Expression*>(&e), int(r));
+    return r;
+}
+
+}
+
+void MatchMatrix::matches(size_t message, vector<size_t>& ids) const
+{
+    ids.clear();
+    for (size_t w = 0; w<words; ++w) {
+        for (auto b = bits[message*words + w]; b; b &= b-1) {
+            ids.push_back(w*64 + __builtin_ctzll(b));
+        }
+    }
+}
+
+SelectorSet::SelectorSet() = default;
+SelectorSet::~SelectorSet() = default;
+
+size_t SelectorSet::add(const Expression& exp)
+{
+    ValueExpression::CopyFn resolve = [&](const ValueExpression& e) -> unique_ptr<ValueExpression> {
+        auto name = e.identifierName();
+        if (!name) return e.copy(resolve);
+        auto i = std::find(ids.begin(), ids.end(), string_view{*name});
+        if (i==ids.end()) i = ids.insert(ids.end(), string{*name});
+        return make_unique<SlotIdentifier>(*name, i-ids.begin());
+    };
+    selectors.push_back(resolve(static_cast<const ValueExpression&>(exp)));
+    return selectors.size()-1;
+}
+
+void SelectorSet::match(const vector<const Env*>& messages, MatchMatrix& result, Tiling tiling) const
+{
+    size_t n = messages.size();
+    size_t m = selectors.size();
+    result.reset(n, m);
+    auto tm = std::max<size_t>(tiling.messages, 1);
+    auto ts = std::max<size_t>(tiling.selectors, 1);
+
+    BlockEnv env{ids, tm};
+    for (size_t m0 = 0; m0<n; m0 += tm) {
+        auto m1 = std::min(m0+tm, n);
+        env.next();
+        for (size_t s0 = 0; s0<m; s0 += ts) {
+            auto s1 = std::min(s0+ts, m);
+            for (size_t i = m0; i<m1; ++i) {
+                env.select(i-m0, *messages[i]);
+                for (size_t s = s0; s<s1; ++s) {
+                    if (probedEval(*selectors[s], env)==BN_TRUE) result.set(i, s);
+                }
+            }
+        }
+    }
+}
+
+void SelectorSet::match(const Env& message, vector<size_t>& matched) const
+{
+    matched.clear();
+    BlockEnv env{ids, 1};
+    env.next();
+    env.select(0, message);
+    for (size_t s = 0; s<selectors.size(); ++s) {
+        if (probedEval(*selectors[s], env)==BN_TRUE) matched.push_back(s);
+    }
+}
+
+}
@@ -0,0 +1,119 @@
+#ifndef SELECTOR_SET_H
+#define SELECTOR_SET_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+class Env;
+class Expression;
+class ValueExpression;
+
+/**
+ * Which selectors matched which messages: a bit per (message, selector) pair
+ * stored a row of 64 bit words per message.
+ */
+class MatchMatrix {
+    std::size_t messages_ = 0;
+    std::size_t selectors_ = 0;
+    std::size_t words = 0;
+    std::vector<uint64_t> bits;
+
+public:
+    void reset(std::size_t messages, std::size_t selectors) {
+        messages_ = messages;
+        selectors_ = selectors;
+        words = (selectors+63)/64;
+        bits.assign(messages*words, 0);
+    }
+
+    std::size_t messages() const {
+        return messages_;
+    }
+
+    std::size_t selectors() const {
+        return selectors_;
+    }
+
+    void set(std::size_t message, std::size_t selector) {
+        bits[message*words + selector/64] |= uint64_t(1) << (selector%64);
+    }
+
+    bool test(std::size_t message, std::size_t selector) const {
+        return (bits[message*words + selector/64] >> (selector%64)) & 1;
+    }
+
+    // The ids of the selectors that matched a message in increasing order
+    SELECTORS_EXPORT void matches(std::size_t message, std::vector<std::size_t>& ids) const;
+};
+
+// How to divide the message x selector work into blocks
+struct Tiling {
+    std::size_t messages = 32;
+    std::size_t selectors = 256;
+};
+
+/**
+ * A set of compiled selectors to match messages against together.
+ *
+ * Selectors are identified by the order they were added, starting from 0.
+ * The set keeps its own copy of each selector with the properties resolved
+ * to slots, so it does not need the original expressions after add().
+ *
+ * Matching does not change the set, so several threads can match against
+ * the same set at once as long as none of them adds selectors.
+ */
+class SelectorSet {
+    std::vector<std::string> ids; // All the properties referred to by the set
+    std::vector<std::unique_ptr<ValueExpression>> selectors;
+
+public:
+    SELECTORS_EXPORT SelectorSet();
+    SELECTORS_EXPORT ~SelectorSet();
+    SelectorSet(SelectorSet&&) = default;
+    SelectorSet& operator=(SelectorSet&&) = default;
+
+    SELECTORS_EXPORT std::size_t add(const Expression&);
+
+    std::size_t size() const {
+        return selectors.size();
+    }
+
+    // Match every message against every selector one block at a time so
+    // that the selectors and messages of the block stay in cache
+    SELECTORS_EXPORT void match(const std::vector<const Env*>& messages, MatchMatrix&, Tiling = {}) const;
+
+    // The ids of the selectors that match a single message
+    SELECTORS_EXPORT void match(const Env& message, std::vector<std::size_t>& matched) const;
+};
+
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef SELECTOR_SHAPE_H
+#define SELECTOR_SHAPE_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+class Env;
+class Expression;
+
+/**
+ * Evaluate an expression specialised for the shape of each message: which
+ * of the properties the expression refers to the message has.
+ *
+ * The first message of each shape makes a residual expression, the
+ * expression simplified knowing that its missing properties are UNKNOWN and
+ * the others are not null, which later messages of the same shape evaluate
+ * instead. Often the shape alone decides whether a message matches, and then
+ * none of its values are looked at beyond finding the shape.
+ *
+ * Only the first 64 properties in the expression are part of the shape and
+ * at most maxShapes residuals are kept: messages of other shapes evaluate
+ * the whole expression. The expression must outlive the context, which is
+ * not thread safe.
+ */
+class ShapeEval {
+public:
+    struct Shape {
+        uint64_t present;
+        std::unique_ptr<Expression> residual; // Unless decided
+        bool decided;
+        bool matches;                         // If decided
+    };
+
+private:
+    const Expression& expression;
+    std::vector<std::string> ids;
+    std::vector<Shape> shapes_;
+    std::size_t maxShapes;
+    uint64_t decided_ = 0;
+
+    const Shape* shape(uint64_t present);
+
+public:
+    SELECTORS_EXPORT explicit ShapeEval(const Expression&, std::size_t maxShapes = 16);
+    SELECTORS_EXPORT ~ShapeEval();
+
+    ShapeEval(const ShapeEval&) = delete;
+    ShapeEval& operator=(const ShapeEval&) = delete;
+
+    // Only whether the message matches: a residual can give FALSE where the
+    // whole expression gives UNKNOWN
+    SELECTORS_EXPORT bool eval(const Env&);
+
+    // The shapes seen so far, in the order they were first seen
+    const std::vector<Shape>& shapes() const {
+        return shapes_;
+    }
+
+    // How many evaluations the shape alone decided
+    uint64_t decided() const {
+        return decided_;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,317 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorShared.h"
+
+#include "SelectorEnv.h"
+#include "SelectorFlat.h"
+#include "SelectorNode.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace selector {
+
+namespace {
+
+const char MAGIC[8] = {'S', 'E', 'L', 'S', 'T', 'O', 'R', 'E'};
+
+[[noreturn]] void throwSystemError(const char* what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+size_t align(size_t n)
+{
+    return (n+7) & ~size_t(7);
+}
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "Store counters are shared between processes");
+
+}
+
+// The segment is this header, then the offset of each selector's program
+// from the start of the segment, then the programs
+struct SharedSelectorStore::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t capacity;
+    uint64_t size;
+    uint64_t programs; // Offset of the first program
+    std::atomic<uint32_t> count;
+    std::atomic<uint64_t> used;
+    pthread_mutex_t lock; // Held while adding
+};
+
+// Releases the store lock however add() leaves
+class StoreLock {
+    pthread_mutex_t& lock;
+
+public:
+    explicit StoreLock(pthread_mutex_t& l) :
+        lock(l)
+    {
+        int r = pthread_mutex_lock(&lock);
+        // The previous writer died while adding: it never published anything
+        // so the store is as it was before it started
+        if (r==EOWNERDEAD) r = pthread_mutex_consistent(&lock);
+        if (r!=0) throw std::system_error(r, std::generic_category(), "Locking selector store");
+    }
+
+    ~StoreLock() {
+        pthread_mutex_unlock(&lock);
+    }
+};
+
+SharedSelectorStore::SharedSelectorStore(int fd, bool w) :
+    fd_(fd),
+    writable(w)
+{
+    struct stat st;
+    if (fstat(fd_, &st)<0) {
+        ::close(fd_);
+        throwSystemError("Sizing selector store");
+    }
+    mapped = st.st_size;
+    void* base = MAP_FAILED;
+    if (mapped>=sizeof(Header)) base = mmap(nullptr, mapped, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd_, 0);
+    if (base==MAP_FAILED) {
+        auto e = errno;
+        ::close(fd_);
+        if (mapped<sizeof(Header)) throw std::runtime_error("Not a selector store");
+        throw std::system_error(e, std::generic_category(), "Mapping selector store");
+    }
+    header = static_cast<Header*>(base);
+}
+
+SharedSelectorStore::SharedSelectorStore(SharedSelectorStore&& o) noexcept :
+    header(std::exchange(o.header, nullptr)),
+    mapped(std::exchange(o.mapped, 0)),
+    fd_(std::exchange(o.fd_, -1)),
+    writable(o.writable),
+    checked(o.checked.exchange(0))
+{}
+
+SharedSelectorStore& SharedSelectorStore::operator=(SharedSelectorStore&& o) noexcept
+{
+    std::swap(header, o.header);
+    std::swap(mapped, o.mapped);
+    std::swap(fd_, o.fd_);
+    std::swap(writable, o.writable);
+    checked = o.checked.exchange(checked);
+    return *this;
+}
+
+SharedSelectorStore::~SharedSelectorStore()
+{
+    if (header) munmap(header, mapped);
+    if (fd_>=0) ::close(fd_);
+}
+
+SharedSelectorStore SharedSelectorStore::create(const string& name, size_t bytes, size_t capacity)
+{
+    auto programs = align(sizeof(Header) + capacity*sizeof(uint64_t));
+    if (capacity>UINT32_MAX || bytes<programs) throw std::invalid_argument("Selector store too small for its capacity");
+
+    int fd = name.empty() ?
+        memfd_create("selectors", MFD_CLOEXEC) :
+        shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd<0) throwSystemError("Creating selector store");
+    if (ftruncate(fd, bytes)<0) {
+        auto e = errno;
+        ::close(fd);
+        if (!name.empty()) shm_unlink(name.c_str());
+        throw std::system_error(e, std::generic_category(), "Sizing selector store");
+    }
+
+    // The constructor closes the descriptor if it can't map it
+    auto store = [&] {
+        try {
+            return SharedSelectorStore{fd, true};
+        } catch (...) {
+            if (!name.empty()) shm_unlink(name.c_str());
+            throw;
+        }
+    }();
+    auto h = store.header;
+    h->version = VERSION;
+    h->capacity = capacity;
+    h->size = bytes;
+    h->programs = programs;
+    new (&h->count) std::atomic<uint32_t>{0};
+    new (&h->used) std::atomic<uint64_t>{programs};
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&h->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    // Only recognisable as a store once it is set up
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(h->magic, MAGIC, sizeof(MAGIC));
+    return store;
+}
+
+SharedSelectorStore SharedSelectorStore::attach(int fd, bool writable)
+{
+    int d = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (d<0) throwSystemError("Attaching selector store");
+    SharedSelectorStore store{d, writable};
+    auto h = store.header;
+    if (std::memcmp(h->magic, MAGIC, sizeof(MAGIC))!=0) throw std::runtime_error("Not a selector store");
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (h->version!=VERSION) {
+        throw std::runtime_error("Selector store version " + std::to_string(h->version) +
+                                 " is not supported (expected " + std::to_string(VERSION) + ")");
+    }
+    if (h->size!=store.mapped || h->programs>h->size || h->capacity>(h->size-sizeof(Header))/sizeof(uint64_t) ||
+        h->programs<sizeof(Header) + h->capacity*sizeof(uint64_t)) {
+        throw std::runtime_error("Selector store is corrupt");
+    }
+    store.check(store.size());
+    return store;
+}
+
+SharedSelectorStore SharedSelectorStore::open(const string& name, bool writable)
+{
+    int fd = shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+    if (fd<0) throwSystemError("Opening selector store");
+    try {
+        auto store = attach(fd, writable);
+        ::close(fd);
+        return store;
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+void SharedSelectorStore::unlink(const string& name)
+{
+    if (shm_unlink(name.c_str())<0) throwSystemError("Removing selector store");
+}
+
+const uint64_t* SharedSelectorStore::directory() const
+{
+    return reinterpret_cast<const uint64_t*>(header+1);
+}
+
+// Selectors are never changed once added, so each only needs checking once
+// in each mapping
+void SharedSelectorStore::check(size_t n) const
+{
+    auto c = checked.load(std::memory_order_acquire);
+    if (n<=c) return;
+    if (n>header->capacity) throw std::runtime_error("Selector store is corrupt");
+    auto base = reinterpret_cast<const char*>(header);
+    auto d = directory();
+    for (auto id = c; id<n; ++id) {
+        auto offset = d[id];
+        if (offset<header->programs || offset%alignof(FlatNode)!=0 || offset>header->size-sizeof(FlatProgram) ||
+            !flatValid(*reinterpret_cast<const FlatProgram*>(base + offset), header->size-offset)) {
+            throw std::runtime_error("Selector store is corrupt");
+        }
+    }
+    while (c<n && !checked.compare_exchange_weak(c, n, std::memory_order_release, std::memory_order_acquire)) {}
+}
+
+SharedSelectorStore::Id SharedSelectorStore::add(const Expression& exp)
+{
+    if (!writable) throw std::logic_error("Selector store is mapped read only");
+    string program;
+    FlatWriter writer;
+    if (!writer.program(static_cast<const ValueExpression&>(exp), program)) {
+        throw std::invalid_argument("Selector can't be stored");
+    }
+
+    StoreLock l{header->lock};
+    auto id = header->count.load(std::memory_order_relaxed);
+    auto offset = header->used.load(std::memory_order_relaxed);
+    if (id==header->capacity || program.size()>header->size-offset) throw std::range_error("Selector store is full");
+
+    // Nothing here is visible to readers until the count includes it
+    auto base = reinterpret_cast<char*>(header);
+    std::memcpy(base+offset, program.data(), program.size());
+    const_cast<uint64_t*>(directory())[id] = offset;
+    header->used.store(std::min<uint64_t>(align(offset+program.size()), header->size), std::memory_order_relaxed);
+    header->count.store(id+1, std::memory_order_release);
+    return id;
+}
+
+size_t SharedSelectorStore::size() const
+{
+    return header->count.load(std::memory_order_acquire);
+}
+
+size_t SharedSelectorStore::capacity() const
+{
+    return header->capacity;
+}
+
+size_t SharedSelectorStore::used() const
+{
+    return header->used.load(std::memory_order_relaxed);
+}
+
+BoolOrNone SharedSelectorStore::eval_bool(Id id, const Env& env) const
+{
+    if (id>=size()) throw std::out_of_range("No such selector in store");
+    check(id+1);
+    auto base = reinterpret_cast<const char*>(header);
+    return flatEval(*reinterpret_cast<const FlatProgram*>(base + directory()[id]), env);
+}
+
+void SharedSelectorStore::match(const Env& message, vector<Id>& matched) const
+{
+    matched.clear();
+    auto base = reinterpret_cast<const char*>(header);
+    auto d = directory();
+    Id n = size();
+    check(n);
+    for (Id id = 0; id<n; ++id) {
+        if (flatEval(*reinterpret_cast<const FlatProgram*>(base + d[id]), message)==BN_TRUE) matched.push_back(id);
+    }
+}
+
+}
@@ -0,0 +1,125 @@
+#ifndef SELECTOR_SHARED_H
+#define SELECTOR_SHARED_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorValue.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+class Env;
+class Expression;
+
+/**
+ * Compiled selectors in a shared memory segment that several processes can
+ * map and evaluate in place.
+ *
+ * Selectors are stored in a position independent form so each process can
+ * map the segment at any address and evaluate them directly, without
+ * parsing or copying. String values from stored literals refer into the
+ * mapping.
+ *
+ * Selectors can only be added. Writers (any process with the segment mapped
+ * writable) are serialised by a lock in the segment; a new selector is
+ * written to unused space and then published by incrementing the count,
+ * so readers never lock or see a partly written selector. A writer that
+ * dies while adding leaves the store as it was before the add.
+ *
+ * The segment starts with a format version: opening a segment written in a
+ * different version fails rather than misreading it. Each selector is checked
+ * to be well formed the first time a mapping sees it, so a corrupt segment
+ * fails rather than being evaluated, but a process that can write the
+ * segment can still change a selector after that: every process that maps
+ * the segment writable must be trusted by those that evaluate it.
+ *
+ * Errors from the system calls are thrown as std::system_error and
+ * problems with the segment's contents as std::runtime_error.
+ */
+class SharedSelectorStore {
+    struct Header;
+
+    Header* header = nullptr;
+    std::size_t mapped = 0;
+    int fd_ = -1;
+    bool writable = false;
+    mutable std::atomic<uint32_t> checked{0}; // Selectors known to be well formed
+
+    SharedSelectorStore(int fd, bool writable);
+
+    const uint64_t* directory() const;
+    // Check the selectors up to n, throwing std::runtime_error if any are corrupt
+    void check(std::size_t n) const;
+
+public:
+    typedef uint32_t Id; // Allocated in increasing order starting from 0
+
+    static constexpr uint32_t VERSION = 1;
+
+    // Create a segment of the given size holding up to capacity selectors.
+    // With an empty name the segment is anonymous (memfd) and can be shared
+    // by passing fd() to other processes; otherwise it is a POSIX shared
+    // memory object that must not already exist.
+    SELECTORS_EXPORT static SharedSelectorStore create(const std::string& name, std::size_t bytes, std::size_t capacity);
+    // Map an existing named segment
+    SELECTORS_EXPORT static SharedSelectorStore open(const std::string& name, bool writable = false);
+    // Map the segment open on a file descriptor (which is duplicated)
+    SELECTORS_EXPORT static SharedSelectorStore attach(int fd, bool writable = false);
+    SELECTORS_EXPORT static void unlink(const std::string& name);
+
+    SELECTORS_EXPORT SharedSelectorStore(SharedSelectorStore&&) noexcept;
+    SELECTORS_EXPORT SharedSelectorStore& operator=(SharedSelectorStore&&) noexcept;
+    SELECTORS_EXPORT ~SharedSelectorStore();
+
+    int fd() const {
+        return fd_;
+    }
+
+    // Throws std::range_error if the store is full and std::invalid_argument
+    // if the expression has no stored form
+    SELECTORS_EXPORT Id add(const Expression&);
+
+    SELECTORS_EXPORT std::size_t size() const;
+    SELECTORS_EXPORT std::size_t capacity() const;
+    // Bytes of the segment used so far
+    SELECTORS_EXPORT std::size_t used() const;
+
+    // Throws std::runtime_error if the selector is corrupt
+    SELECTORS_EXPORT BoolOrNone eval_bool(Id, const Env&) const;
+    bool eval(Id id, const Env& env) const {
+        return eval_bool(id, env)==BN_TRUE;
+    }
+
+    // The ids of the selectors that match the message in increasing order
+    SELECTORS_EXPORT void match(const Env& message, std::vector<Id>& matched) const;
+};
+
+}
+
+#endif
@@ -20,18 +20,52 @@
  */
 
 #include "SelectorExpression.h"
+#include "SelectorAllocations.h"
+#include "SelectorArrow.h"
+#include "SelectorBatch.h"
+#include "SelectorBench.h"
+#include "SelectorCache.h"
+#include "SelectorCompile.h"
+#include "SelectorConcurrent.h"
 #include "SelectorEnv.h"
+#include "SelectorFuzz.h"
+#include "SelectorIncremental.h"
+#include "SelectorIndex.h"
+#include "SelectorIntern.h"
+#include "SelectorJson.h"
+#include "SelectorNode.h"
+#include "SelectorParallel.h"
+#include "SelectorPipeline.h"
+#include "SelectorProfile.h"
+#include "SelectorSet.h"
+#include "SelectorShape.h"
+#include "SelectorShared.h"
 #include "SelectorToken.h"
 #include "SelectorValue.h"
+#include "SelectorWorkload.h"
+#include "selectors.h"
 
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
 #include <memory>
+#include <memory_resource>
+#include <numeric>
+#include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
 
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 using std::get;
 using std::string;
 using std::string_view;
@@ -270,6 +304,52 @@ SECTION("tokenString")
     CHECK(v.nextToken() == Token(selector::T_NUMERIC_APPROX, "1e6"));
 }
 
+SECTION("keywords")
+{
+    vector<std::pair<string, TokenType>> words{
+        {"AND", selector::T_AND}, {"and", selector::T_AND}, {"BeTwEeN", selector::T_BETWEEN},
+        {"Escape", selector::T_ESCAPE}, {"FALSE", selector::T_FALSE}, {"iN", selector::T_IN},
+        {"IS", selector::T_IS}, {"likE", selector::T_LIKE}, {"Not", selector::T_NOT},
+        {"NULL", selector::T_NULL}, {"oR", selector::T_OR}, {"true", selector::T_TRUE},
+        {"an", selector::T_IDENTIFIER}, {"andd", selector::T_IDENTIFIER}, {"nul", selector::T_IDENTIFIER},
+        {"_and", selector::T_IDENTIFIER}, {"i_", selector::T_IDENTIFIER}, {"ORR", selector::T_IDENTIFIER},
+        {"n0t", selector::T_IDENTIFIER}, {"tru$", selector::T_IDENTIFIER}, {"betweeN.", selector::T_IDENTIFIER},
+        {"x", selector::T_IDENTIFIER}, {"escapes", selector::T_IDENTIFIER}, {"fals", selector::T_IDENTIFIER}
+    };
+    for (auto& [w, type] : words) {
+        INFO("Word: " << w);
+        verifyTokeniserSuccess(&tokenise, w.c_str(), type, w.c_str(), "");
+    }
+    // Quoted identifiers are never keywords
+    verifyTokeniserSuccess(&tokenise, "\"and\"", selector::T_IDENTIFIER, "and", "");
+}
+
+// Runs of whitespace, identifiers and strings either side of 16 characters
+SECTION("long tokens")
+{
+    for (std::size_t n : {1, 2, 15, 16, 17, 31, 32, 33, 100}) {
+        INFO("Length: " << n);
+        string spaces;
+        for (std::size_t i = 0; i<n; ++i) spaces += " \t\n\v\f\r"[i%6];
+        string identifier;
+        for (std::size_t i = 0; i<n; ++i) identifier += "aZ_$.09"[i%7];
+        identifier[0] = 'q';
+        string text;
+        for (std::size_t i = 0; i<n; ++i) text += i%5==4 ? "''" : "x";
+
+        string exp = spaces + identifier + spaces + "'" + text + "'" + spaces + identifier + "@";
+        Tokeniser t(exp);
+        string unquoted = text;
+        for (auto i = unquoted.find("''"); i!=string::npos; i = unquoted.find("''", i+1)) unquoted.erase(i, 1);
+        CHECK(t.nextToken() == Token(selector::T_IDENTIFIER, identifier));
+        CHECK(t.nextToken() == Token(selector::T_STRING, unquoted));
+        CHECK(t.nextToken() == Token(selector::T_IDENTIFIER, identifier));
+        CHECK_THROWS_AS(t.nextToken(), TokenException);
+    }
+    // A quote never closed
+    verifyTokeniserFail(&tokenise, "'a string long enough to need more than one block''");
+}
+
 }
 
 auto test_selector(const string& s) -> unique_ptr<Expression>
@@ -531,4 +611,1757 @@ SECTION("NullEval")
 
 }
 
+auto plan_admits(const IndexPlan& plan, const Env& env) -> bool
+{
+    if (plan.fullScan) return true;
+    for (auto& k : plan.keys) {
+        if (k.contains(env.value(k.identifier))) return true;
+    }
+    return false;
+}
+
+TEST_CASE( "Selector Index Plan" ) {
+
+SECTION("extractKeys")
+{
+    auto e = test_selector("a = 5 AND b > 3 OR a IN (7,8)");
+    auto p = index_plan(*e, {"a"});
+    INFO("Plan: " << p);
+    REQUIRE(!p.fullScan);
+    REQUIRE(p.keys.size()==1);
+    CHECK(p.keys[0].identifier=="a");
+    CHECK(p.keys[0].points.size()==3);
+    CHECK(p.keys[0].ranges.empty());
+    CHECK(p.keys[0].contains(5));
+    CHECK(p.keys[0].contains(7.0));
+    CHECK(!p.keys[0].contains(6));
+    CHECK(!p.keys[0].contains("5"sv));
+
+    CHECK(index_plan(*e, {"b"}).fullScan);
+    CHECK(index_plan(*e, {}).fullScan);
+
+    // Points are cheaper than ranges
+    p = index_plan(*e, {"a", "b"});
+    REQUIRE(p.keys.size()==1);
+    CHECK(p.keys[0].identifier=="a");
+
+    p = index_plan(*test_selector("a > 3 AND a <= 10 OR b BETWEEN 1 AND 2 OR 20 < a"), {"a", "b"});
+    INFO("Plan: " << p);
+    REQUIRE(p.keys.size()==2);
+    CHECK(p.keys[0].ranges.size()==2);
+    CHECK(p.keys[0].contains(10));
+    CHECK(!p.keys[0].contains(3));
+    CHECK(!p.keys[0].contains(20));
+    CHECK(p.keys[0].contains(20.5));
+    CHECK(p.keys[1].contains(2));
+
+    p = index_plan(*test_selector("a = 'hello' OR a IN ('there', 'hello') OR a"), {"a"});
+    REQUIRE(p.keys.size()==1);
+    CHECK(p.keys[0].points.size()==3);
+    CHECK(p.keys[0].contains(true));
+}
+
+SECTION("emptyPlans")
+{
+    for (auto s : {"a = 1 AND a = 2", "a BETWEEN 1 AND 10 AND a > 20", "a > 'x'", "FALSE", "a+1", "a IN (1, 2) AND a > 5"}) {
+        auto p = index_plan(*test_selector(s), {"a"});
+        INFO("Selector: " << s << " Plan: " << p);
+        CHECK(!p.fullScan);
+        CHECK(p.keys.empty());
+    }
+    for (auto s : {"", "TRUE", "NOT a = 1", "a <> 1", "a IS NOT NULL", "a LIKE 'x%'", "a = 1 OR b = 2", "a IN (1, b)"}) {
+        auto p = index_plan(*test_selector(s), {"a"});
+        INFO("Selector: " << s << " Plan: " << p);
+        CHECK(p.fullScan);
+    }
+}
+
+SECTION("soundness")
+{
+    auto selectors = {
+        "a = 5 AND b > 3 OR a IN (7,8)",
+        "a > 3 AND a <= 10 OR b BETWEEN 1 AND 2",
+        "a >= 2.5 AND (a < 4 OR a = 'x') AND b IS NULL",
+        "(a = 1 OR a = 2.0) AND (a > 1.5 OR b = 'z')",
+        "a",
+        "NOT (a < 3) OR b IN ('z', 4)"
+    };
+    vector<selector::Value> values = {
+        selector::Value{}, 1, 2, 2.5, 3, 4, 5, 7.0, 8, 10, 11, "x"sv, "z"sv, true, false
+    };
+    for (auto s : selectors) {
+        auto e = test_selector(s);
+        auto p = index_plan(*e, {"a", "b"});
+        INFO("Selector: " << s << " Plan: " << p);
+        for (auto& a : values) {
+            for (auto& b : values) {
+                TestSelectorEnv env;
+                if (!unknown(a)) env.set("a", a);
+                if (!unknown(b)) env.set("b", b);
+                INFO("a=" << a << " b=" << b);
+                if (eval(*e, env)) CHECK(plan_admits(p, env));
+            }
+        }
+    }
+}
+
+}
+
+auto simplified_repr(const string& s) -> string
+{
+    auto e = simplify(*test_selector(s));
+    std::ostringstream o;
+    o << *e;
+    return o.str();
+}
+
+TEST_CASE( "Selector Simplifier" ) {
+
+SECTION("rewrites")
+{
+    CHECK(simplified_repr("NOT (NOT a)") == "I:a");
+    CHECK(simplified_repr("a > 5 AND a > 3") == "(I:a>EXACT:5)");
+    CHECK(simplified_repr("a > 3 AND 5 < a") == "(I:a>EXACT:5)");
+    CHECK(simplified_repr("a >= 1 AND a <= 10 AND a < 20") == "I:a BETWEEN EXACT:1 AND EXACT:10");
+    CHECK(simplified_repr("a IN (1, 2, 3) AND a > 2") == "(I:a==EXACT:3)");
+    CHECK(simplified_repr("x IN ('a')") == "(I:x=='a')");
+    CHECK(simplified_repr("x NOT IN ('a', 'a')") == "(I:x!='a')");
+    CHECK(simplified_repr("a = 1 OR a = 2 OR a = 1") == "I:a IN (EXACT:1, EXACT:2)");
+    CHECK(simplified_repr("a AND a") == "I:a");
+    CHECK(simplified_repr("a AND (b OR a)") == "I:a");
+    CHECK(simplified_repr("a OR (b AND a) OR c") == "(I:a OR I:c)");
+    CHECK(simplified_repr("NOT (a AND b)") == "(NOT(I:a) OR NOT(I:b))");
+    CHECK(simplified_repr("NOT (a OR b IS NULL)") == "(NOT(I:a) AND IsNonNull(I:b))");
+    CHECK(simplified_repr("TRUE AND a = 1 + 2") == "(I:a==EXACT:3)");
+    CHECK(simplified_repr("a OR 'x' OR 1 > 2") == "I:a");
+    CHECK(simplified_repr("(a OR FALSE) = 1") == "((I:a OR BOOL:false)==EXACT:1)");
+    CHECK(simplified_repr("(NOT NOT a AND TRUE) IS NULL") == "IsNull((I:a AND BOOL:true))");
+    CHECK(simplified_repr("") == "BOOL:true");
+}
+
+SECTION("contradictions")
+{
+    for (auto s : {"x = 1 AND x = 2", "x BETWEEN 1 AND 10 AND x > 20", "x > 5 AND (x < 3 OR FALSE)",
+                   "a IN (1, 2) AND a = 3", "a = 'x' AND a > 1", "1 = 2", "a BETWEEN 5 AND 1", "a > 'x'",
+                   "NOT (a <> 1 OR TRUE)", "b AND 1 + 'x'", "(a = 1 AND a = 2) OR (b < 0 AND b >= 0)"}) {
+        INFO("Selector: " << s << " -> " << simplified_repr(s));
+        CHECK(unsatisfiable(*test_selector(s)));
+    }
+    for (auto s : {"", "x = 1 OR x = 2", "NOT (NOT a)", "a > 5 AND a > 3", "a = 1 AND b = 2",
+                   "(a = 1 AND a = 2) IS NULL", "NOT (a = 1 AND a = 2)", "a <> 1 AND a <> 2"}) {
+        INFO("Selector: " << s << " -> " << simplified_repr(s));
+        CHECK(!unsatisfiable(*test_selector(s)));
+    }
+}
+
+SECTION("equivalence")
+{
+    auto selectors = {
+        "NOT (NOT a)",
+        "NOT (NOT (NOT a))",
+        "a > 5 AND a > 3",
+        "x = 1 AND x = 2",
+        "x BETWEEN 1 AND 10 AND x > 2",
+        "a IN (1, 2.0, 'x') AND (a > 1 OR b)",
+        "a IN (1, 2, 3) AND a <> 2 AND a >= 2",
+        "NOT (a < 3 OR b IS NULL) AND NOT (b AND a)",
+        "a = 1 OR a IN (2, 3) OR a > 7 OR a > 9",
+        "a AND (a OR b) AND NOT NOT b",
+        "(a OR b) AND (a OR b) OR a = 1",
+        "a NOT IN (1) OR b IN ('x')",
+        "a + 1 > 2 AND 1 + 1 = 2",
+        "a LIKE 'x%' AND a LIKE 'x%'"
+    };
+    vector<selector::Value> values = {
+        selector::Value{}, 1, 2, 2.0, 3, 5, 7.5, 10, "x"sv, "xy"sv, true, false
+    };
+    for (auto s : selectors) {
+        for (auto w : {"%s", "(%s) IS NULL", "NOT (%s)", "(%s) = FALSE"}) {
+            string sel{w};
+            sel.replace(sel.find("%s"), 2, s);
+            auto e = test_selector(sel);
+            auto se = simplify(*e);
+            INFO("Selector: " << sel << " -> " << *se);
+            for (auto& a : values) {
+                for (auto& b : values) {
+                    TestSelectorEnv env;
+                    if (!unknown(a)) env.set("a", a);
+                    if (!unknown(b)) env.set("b", b);
+                    if (!unknown(a)) env.set("x", a);
+                    INFO("a=" << a << " b=" << b);
+                    CHECK(eval(*se, env)==eval(*e, env));
+                }
+            }
+        }
+    }
+}
+
+}
+
+TEST_CASE( "Selector Result Cache" ) {
+
+SECTION("identifiers")
+{
+    CHECK(identifiers(*test_selector("a = 5 AND b > 3 OR a IN (7, c) OR d LIKE 'x%'")) == vector<string>{"a", "b", "c", "d"});
+    CHECK(identifiers(*test_selector("1 = 1")).empty());
+}
+
+SECTION("memoise")
+{
+    auto e = test_selector("type = 'order' AND region IN ('eu', 'us') AND size / 2 > 10");
+    ResultCache cache(*e, 4);
+
+    vector<TestSelectorEnv> envs(4);
+    envs[0].set("type", "order"sv);
+    envs[0].set("region", "eu"sv);
+    envs[0].set("size", 30);
+    envs[0].set("other", 1);
+    envs[1].set("type", "order"sv);
+    envs[1].set("region", "eu"sv);
+    envs[1].set("size", 30);
+    envs[1].set("other", 2);
+    envs[2].set("type", "order"sv);
+    envs[2].set("region", "us"sv);
+    envs[2].set("size", 21);
+    envs[3].set("type", "order"sv);
+    envs[3].set("region", "us"sv);
+    envs[3].set("size", 21.0);
+
+    for (int i = 0; i<3; ++i) {
+        for (auto& env : envs) {
+            CHECK(cache.eval(env)==eval(*e, env));
+        }
+    }
+    // Properties not in the selector don't matter but 21 and 21.0 are different keys
+    CHECK(cache.misses()==3);
+    CHECK(cache.hits()==9);
+    CHECK(cache.hitRate()==0.75);
+
+    cache.clear();
+    CHECK(cache.hits()==0);
+    CHECK(cache.misses()==0);
+}
+
+SECTION("copiesStrings")
+{
+    auto e = test_selector("a = 'hello'");
+    ResultCache cache(*e);
+    string buffer{"hello"};
+    TestSelectorEnv env;
+    env.set("a", string_view{buffer});
+    CHECK(cache.eval(env));
+    buffer = "jello";
+    CHECK(!cache.eval(env));
+    buffer = "hello";
+    CHECK(cache.eval(env));
+    CHECK(cache.hits()==1);
+}
+
+SECTION("eviction")
+{
+    auto e = test_selector("a > 50");
+    ResultCache cache(*e, 2);
+    for (int round = 0; round<2; ++round) {
+        for (int i = 0; i<100; ++i) {
+            TestSelectorEnv env;
+            env.set("a", i);
+            CHECK(cache.eval(env)==(i>50));
+        }
+    }
+    CHECK(cache.hits()+cache.misses()==200);
+    CHECK(cache.misses()>100);
+}
+
+SECTION("lookups")
+{
+    struct CountingEnv : Env {
+        selector::Value n;
+        mutable int lookups = 0;
+        CountingEnv(int64_t i) : n(i) {}
+        const selector::Value& value(string_view) const override { ++lookups; return n; }
+    };
+
+    // A miss evaluates with the values it loaded to look for a hit
+    auto e = test_selector("a > 5 AND b < 10 AND a+b = 12 AND c IS NOT NULL");
+    ResultCache cache(*e);
+    CountingEnv env{6};
+    CHECK(cache.eval(env));
+    CHECK(cache.misses()==1);
+    CHECK(env.lookups==3);
+    CHECK(cache.eval(env));
+    CHECK(cache.hits()==1);
+    CHECK(env.lookups==6);
+}
+
+}
+
+TEST_CASE( "Selector Incremental Eval" ) {
+
+SECTION("reuse")
+{
+    auto e = test_selector("a = 1 AND (b > 2 OR c LIKE 'x%')");
+    IncrementalEval inc(*e);
+    TestSelectorEnv env;
+    env.set("a", 1);
+    env.set("b", 1);
+    env.set("c", "yes"sv);
+
+    CHECK(!inc.eval(env));
+    auto n = inc.evaluations();
+    CHECK(!inc.eval(env));
+    CHECK(inc.evaluations()==n);
+
+    // c, the LIKE, the OR and the AND
+    env.set("c", "xylophone"sv);
+    inc.changed("c");
+    CHECK(inc.eval(env));
+    CHECK(inc.evaluations()==n+4);
+
+    // Not referenced by the selector
+    inc.changed("d");
+    CHECK(inc.eval(env));
+    CHECK(inc.evaluations()==n+4);
+
+    env.set("a", 2);
+    inc.changed("a");
+    CHECK(!inc.eval(env));
+    CHECK(inc.evaluations()==n+7);
+
+    // The AND is decided by a alone
+    inc.reset();
+    CHECK(!inc.eval(env));
+    CHECK(inc.evaluations()==n+10);
+}
+
+SECTION("stages")
+{
+    auto e = test_selector("(region IN ('eu', 'us') OR priority > 5) AND NOT (type IS NULL) AND size BETWEEN 1 AND 100");
+    IncrementalEval inc(*e);
+    TestSelectorEnv env;
+    auto check = [&](string_view property, const selector::Value& v) {
+        env.set(property, v);
+        inc.changed(property);
+        INFO("Set " << property << "=" << v);
+        CHECK(inc.eval_bool(env)==e->eval_bool(env));
+    };
+    check("size", 50);
+    check("region", "asia"sv);
+    check("priority", 7);
+    check("type", "order"sv);
+    check("region", "eu"sv);
+    check("priority", 1);
+    check("size", 500);
+    check("size", 5.5);
+    CHECK(inc.eval(env));
+}
+
+}
+
+auto selected(const vector<uint64_t>& selection, std::size_t row) -> bool
+{
+    return (selection[row/64] >> (row%64)) & 1;
+}
+
+TEST_CASE( "Selector Batch Filter" ) {
+
+SECTION("dictionaryColumns")
+{
+    const std::size_t rows = 200;
+    vector<string_view> regions{"eu", "us", "asia", "eu-west"};
+    vector<string_view> types{"order", "quote"};
+    vector<int32_t> regionCodes(rows);
+    vector<int32_t> typeCodes(rows);
+    vector<selector::Value> sizes(rows);
+    vector<uint8_t> typeValidity((rows+7)/8);
+    for (std::size_t r = 0; r<rows; ++r) {
+        regionCodes[r] = r%7==6 ? -1 : r%4;
+        typeCodes[r] = (r/3)%2;
+        if (r%5) typeValidity[r/8] |= 1 << (r%8);
+        if (r%11) sizes[r] = int64_t(r);
+    }
+    DictionaryColumn region{regions.data(), regions.size(), regionCodes.data()};
+    DictionaryColumn type{types.data(), types.size(), typeCodes.data(), typeValidity.data()};
+    ValueColumn size{sizes.data()};
+    Batch batch{rows};
+    batch.add("region", region);
+    batch.add("type", type);
+    batch.add("size", size);
+
+    for (auto s : {"region = 'eu'", "region IN ('eu', 'asia')", "region LIKE 'eu%'", "region IS NULL",
+                   "NOT region LIKE 'eu%' AND type = 'order'", "region = 'us' OR size > 150",
+                   "type IS NOT NULL AND region <> 'asia' AND size BETWEEN 10 AND 100", "region = type", "TRUE", "size < 20"}) {
+        auto e = test_selector(s);
+        vector<uint64_t> selection;
+        filter(*e, batch, selection);
+        REQUIRE(selection.size()==(rows+63)/64);
+        INFO("Selector: " << s);
+        for (std::size_t r = 0; r<rows; ++r) {
+            TestSelectorEnv env;
+            if (regionCodes[r]>=0) env.set("region", regions[regionCodes[r]]);
+            if (r%5) env.set("type", types[typeCodes[r]]);
+            if (!unknown(sizes[r])) env.set("size", sizes[r]);
+            INFO("Row: " << r);
+            CHECK(selected(selection, r)==eval(*e, env));
+        }
+    }
+}
+
+}
+
+TEST_CASE( "Selector Set Match" ) {
+
+    vector<unique_ptr<Expression>> selectors;
+    for (auto s : {"A = 'x'", "B > 10", "A IS NULL", "A = 'y' OR B BETWEEN 5 AND 15", "C", "NOT C",
+                   "A LIKE '_' AND B < 20", "D IN ('p', 'q')", "FALSE", "B + 1 = 8", "A = 'x' AND NOT C"}) {
+        selectors.push_back(test_selector(s));
+    }
+    SelectorSet set;
+    for (auto& e : selectors) set.add(*e);
+    REQUIRE(set.size()==selectors.size());
+
+    vector<TestSelectorEnv> envs(100);
+    vector<const Env*> messages;
+    for (std::size_t i = 0; i<envs.size(); ++i) {
+        auto& env = envs[i];
+        if (i%3) env.set("A", i%3==1 ? "x"sv : "y"sv);
+        if (i%7) env.set("B", int64_t(i%25));
+        if (i%2) env.set("C", i%4==1);
+        if (i%5==0) env.set("D", i%10 ? "p"sv : "r"sv);
+        messages.push_back(&env);
+    }
+
+    // Small tiles so that the blocks don't line up with the data
+    for (auto tiling : {Tiling{}, Tiling{3, 4}, Tiling{1, 1}, Tiling{64, 7}}) {
+        MatchMatrix result;
+        set.match(messages, result, tiling);
+        REQUIRE(result.messages()==messages.size());
+        REQUIRE(result.selectors()==selectors.size());
+        for (std::size_t i = 0; i<envs.size(); ++i) {
+            vector<std::size_t> ids;
+            result.matches(i, ids);
+            vector<std::size_t> single;
+            set.match(envs[i], single);
+            CHECK(ids==single);
+            for (std::size_t s = 0; s<selectors.size(); ++s) {
+                INFO("Message: " << i << " Selector: " << *selectors[s]);
+                CHECK(result.test(i, s)==eval(*selectors[s], envs[i]));
+            }
+        }
+    }
+
+    // More than a word of selectors per message
+    SelectorSet wide;
+    vector<unique_ptr<Expression>> thresholds;
+    for (int t = 0; t<150; ++t) {
+        thresholds.push_back(test_selector("B >= " + std::to_string(t%25)));
+        wide.add(*thresholds.back());
+    }
+    MatchMatrix result;
+    wide.match(messages, result);
+    vector<std::size_t> ids;
+    result.matches(8, ids);
+    CHECK(ids.size()==6*9);
+    CHECK(ids.back()==133);
+    result.matches(7, ids);
+    CHECK(ids.empty());
+}
+
+
+TEST_CASE( "Selector Concurrent Set" ) {
+
+SECTION("updates")
+{
+    ConcurrentSelectorSet set{2};
+    ConcurrentSelectorSet::Reader reader{set};
+    ConcurrentSelectorSet::Reader other{set};
+    CHECK_THROWS_AS(ConcurrentSelectorSet::Reader{set}, std::range_error);
+
+    CHECK(set.subscribe(make_selector("A > 1"))==0);
+    CHECK(set.subscribe(make_selector("A > 2"))==1);
+    CHECK(set.subscribe(make_selector("A IS NULL"))==2);
+    CHECK(set.subscribe(make_selector("A < 5"))==3);
+    CHECK(set.size()==4);
+
+    TestSelectorEnv env;
+    env.set("A", int64_t(3));
+    vector<ConcurrentSelectorSet::Id> matched;
+    reader.match(env, matched);
+    CHECK(matched==vector<ConcurrentSelectorSet::Id>{0, 1, 3});
+
+    CHECK(set.unsubscribe(1));
+    CHECK_FALSE(set.unsubscribe(1));
+    CHECK_FALSE(set.unsubscribe(7));
+    CHECK(set.subscribe(make_selector("A = 3"))==4);
+    other.match(env, matched);
+    CHECK(matched==vector<ConcurrentSelectorSet::Id>{0, 3, 4});
+    CHECK(set.size()==4);
+
+    // No reader is matching so nothing needs to be kept
+    CHECK(set.reclaim()==0);
+}
+
+SECTION("churn")
+{
+    // TestSelectorEnv logs through Catch which isn't thread safe
+    struct NumberEnv : Env {
+        selector::Value n;
+        NumberEnv(int64_t i) : n(i) {}
+        const selector::Value& value(string_view) const override { return n; }
+    };
+
+    // Selector i is "N = i%8" so a reader can check every match it gets
+    ConcurrentSelectorSet set;
+    const int readers = 3;
+    std::atomic<bool> done{false};
+    std::atomic<int> errors{0};
+    std::atomic<long> matches{0};
+    vector<std::thread> threads;
+    for (int r = 0; r<readers; ++r) {
+        threads.emplace_back([&, r] {
+            ConcurrentSelectorSet::Reader reader{set};
+            NumberEnv env{r};
+            vector<ConcurrentSelectorSet::Id> matched;
+            while (!done) {
+                reader.match(env, matched);
+                for (auto id : matched) {
+                    if (id%8!=ConcurrentSelectorSet::Id(r)) ++errors;
+                }
+                if (!std::is_sorted(matched.begin(), matched.end())) ++errors;
+                matches += matched.size();
+            }
+        });
+    }
+
+    vector<ConcurrentSelectorSet::Id> live;
+    for (ConcurrentSelectorSet::Id i = 0; i<5000; ++i) {
+        REQUIRE(set.subscribe(make_selector("N = " + std::to_string(i%8)))==i);
+        live.push_back(i);
+        if (live.size()>200) {
+            auto j = live.begin() + (i*7919)%live.size();
+            REQUIRE(set.unsubscribe(*j));
+            live.erase(j);
+        }
+    }
+    done = true;
+    for (auto& t : threads) t.join();
+
+    CHECK(errors==0);
+    CHECK(set.size()==live.size());
+    CHECK(set.reclaim()==0);
+}
+
+}
+
+
+TEST_CASE( "Selector Parallel Match" ) {
+
+    CHECK(estimated_cost(*test_selector("A = 1"))==3);
+    CHECK(estimated_cost(*test_selector("A LIKE 'x%'"))>estimated_cost(*test_selector("A = 'x' AND B = 'y'")));
+
+    // TestSelectorEnv logs through Catch which isn't thread safe
+    struct MapEnv : Env {
+        unordered_map<string_view, selector::Value> values;
+        const selector::Value& value(string_view v) const override {
+            auto i = values.find(v);
+            return i!=values.end() ? i->second : EMPTY;
+        }
+    };
+
+    vector<unique_ptr<Expression>> selectors;
+    vector<const Expression*> list;
+    SelectorSet set;
+    for (int i = 0; i<500; ++i) {
+        auto n = std::to_string(i%17);
+        selectors.push_back(test_selector(i%5==0 ? "A LIKE '%" + n + "'" : "B > " + n + " AND C <> " + n));
+        list.push_back(selectors.back().get());
+        set.add(*selectors.back());
+    }
+
+    vector<MapEnv> envs(40);
+    for (std::size_t i = 0; i<envs.size(); ++i) {
+        envs[i].values["A"] = i%4 ? "x7"sv : "x16"sv;
+        if (i%3) envs[i].values["B"] = int64_t(i%20);
+        envs[i].values["C"] = int64_t(i%9);
+    }
+
+    for (std::size_t threads : {1, 2, 3, 8}) {
+        ParallelMatcher matcher{list, threads, threads==8 ? 0u : 1000u};
+        REQUIRE(matcher.threads()==threads);
+        std::size_t total = 0;
+        for (std::size_t p = 0; p<threads; ++p) total += matcher.cost(p);
+        CHECK(total==std::accumulate(list.begin(), list.end(), std::size_t(0),
+                                     [](std::size_t c, const Expression* e) { return c + estimated_cost(*e); }));
+
+        vector<std::size_t> expected;
+        vector<std::size_t> matched;
+        for (auto& env : envs) {
+            set.match(env, expected);
+            matcher.match(env, matched);
+            CHECK(matched==expected);
+        }
+    }
+
+    // No more partitions than selectors
+    ParallelMatcher few{{list[0], list[1]}, 4};
+    CHECK(few.threads()==2);
+    ParallelMatcher none{{}, 4};
+    vector<std::size_t> matched{7};
+    none.match(envs[0], matched);
+    CHECK(matched.empty());
+}
+
+
+TEST_CASE( "Selector Shared Store" ) {
+
+SECTION("evaluation")
+{
+    vector<string> texts{
+        "A = 'x'", "B > 10", "A IS NULL", "A IS NOT NULL", "A = 'y' OR B BETWEEN 5 AND 15", "C", "NOT C",
+        "A LIKE '_' AND B < 20", "A LIKE 'x%'", "A LIKE '%y_%'", "A NOT LIKE '%'", "A LIKE 'a!%%' ESCAPE '!'",
+        "A LIKE '!_!!' ESCAPE '!'", "D IN ('p', 'q', 3)", "D NOT IN ('p', 1)", "B NOT IN (2, 3.0, E)", "FALSE", "",
+        "B + 1 = 8", "-B < -5 AND B * 2.5 >= B / 3", "A = 'x' AND NOT C", "B <> 4 OR E", "(B-3)/0 > 1", "E = E"};
+    auto store = SharedSelectorStore::create("", 1 << 16, texts.size());
+    vector<unique_ptr<Expression>> selectors;
+    for (std::size_t i = 0; i<texts.size(); ++i) {
+        selectors.push_back(test_selector(texts[i]));
+        REQUIRE(store.add(*selectors.back())==i);
+    }
+    CHECK(store.size()==texts.size());
+    CHECK_THROWS_AS(store.add(*selectors[0]), std::range_error);
+
+    // Another mapping of the segment, at another address
+    auto reader = SharedSelectorStore::attach(store.fd());
+    CHECK(reader.size()==texts.size());
+    CHECK_THROWS_AS(reader.add(*selectors[0]), std::logic_error);
+
+    for (int i = 0; i<120; ++i) {
+        TestSelectorEnv env;
+        vector<string_view> as{"x", "y", "xyz", "a%b", "_!", "ab", "yy"};
+        if (i%8) env.set("A", as[i%7]);
+        if (i%5) env.set("B", i%3 ? selector::Value(int64_t(i%25)) : selector::Value(double(i%25)));
+        if (i%2) env.set("C", i%4==1);
+        if (i%3) env.set("D", i%6==1 ? selector::Value("p"sv) : selector::Value(int64_t(i%4)));
+        if (i%7==0) env.set("E", true);
+        for (std::size_t s = 0; s<texts.size(); ++s) {
+            INFO(texts[s]);
+            CHECK(reader.eval_bool(s, env)==selectors[s]->eval_bool(env));
+        }
+    }
+}
+
+SECTION("segments")
+{
+    auto fd = memfd_create("empty", 0);
+    REQUIRE(ftruncate(fd, 4096)==0);
+    CHECK_THROWS_AS(SharedSelectorStore::attach(fd), std::runtime_error);
+    close(fd);
+    CHECK_THROWS_AS(SharedSelectorStore::create("", 64, 100), std::invalid_argument);
+    CHECK_THROWS_AS(SharedSelectorStore::open("/selectors-test-missing"), std::system_error);
+}
+
+SECTION("corrupt")
+{
+    auto store = SharedSelectorStore::create("", 1 << 12, 4);
+    auto at = store.used();
+    auto a = test_selector("A = 'x' AND B IN (1, 2)");
+    store.add(*a);
+    auto size = store.used()-at;
+    auto base = static_cast<char*>(mmap(nullptr, 1 << 12, PROT_READ | PROT_WRITE, MAP_SHARED, store.fd(), 0));
+    REQUIRE(base!=MAP_FAILED);
+    auto program = base+at;
+    string original{program, size};
+
+    // Each a field of the program header or its first node
+    auto corrupt = [&](std::size_t offset, auto value) {
+        std::memcpy(program+offset, &value, sizeof(value));
+        CHECK_THROWS_AS(SharedSelectorStore::attach(store.fd()), std::runtime_error);
+        std::memcpy(program, original.data(), size);
+    };
+    corrupt(0, uint32_t(1) << 30);  // Nodes
+    corrupt(0, uint32_t(0));
+    corrupt(4, uint32_t(1) << 30);  // String bytes
+    corrupt(4, uint32_t(0));
+    corrupt(8, uint8_t(200));       // Operator
+    corrupt(12, uint32_t(1));       // Children
+    corrupt(16, uint32_t(0));       // First child
+    corrupt(16, uint32_t(1000));
+
+    TestSelectorEnv env;
+    env.set("A", "x"sv);
+    env.set("B", int64_t(2));
+    auto reader = SharedSelectorStore::attach(store.fd());
+    CHECK(reader.eval(0, env));
+
+    // Selectors added after attaching are checked when first evaluated
+    at = store.used();
+    store.add(*test_selector("A LIKE 'x%'"));
+    std::memset(base+at+4, 0, 4);
+    CHECK_THROWS_AS(reader.eval_bool(1, env), std::runtime_error);
+    vector<SharedSelectorStore::Id> matched;
+    CHECK_THROWS_AS(reader.match(env, matched), std::runtime_error);
+    CHECK(reader.eval(0, env));
+    munmap(base, 1 << 12);
+}
+
+SECTION("processes")
+{
+    string name = "/selectors-test-" + std::to_string(getpid());
+    auto store = SharedSelectorStore::create(name, 1 << 16, 100);
+    auto a = test_selector("A > 1");
+    store.add(*a);
+
+    // Another process adds a selector and checks it sees the first
+    auto child = fork();
+    REQUIRE(child>=0);
+    if (child==0) {
+        int r = 1;
+        try {
+            auto other = SharedSelectorStore::open(name, true);
+            TestSelectorEnv env;
+            env.set("A", int64_t(2));
+            if (other.size()==1 && other.eval(0, env) && other.add(*make_selector("A < 10"))==1) r = 0;
+        } catch (...) {
+        }
+        _exit(r);
+    }
+    int status = 0;
+    REQUIRE(waitpid(child, &status, 0)==child);
+    CHECK(WIFEXITED(status));
+    CHECK(WEXITSTATUS(status)==0);
+
+    SharedSelectorStore::unlink(name);
+    CHECK(store.size()==2);
+    TestSelectorEnv env;
+    env.set("A", int64_t(20));
+    vector<SharedSelectorStore::Id> matched;
+    store.match(env, matched);
+    CHECK(matched==vector<SharedSelectorStore::Id>{0});
+    CHECK(store.used()<=1 << 16);
+}
+
+}
+
+TEST_CASE( "Selector Pipeline Stage" ) {
+
+SECTION("ring")
+{
+    SpscRing<int> ring{5};
+    CHECK(ring.capacity()==8);
+    for (int i = 0; i<8; ++i) CHECK(ring.tryPush(i));
+    CHECK_FALSE(ring.tryPush(8));
+    int out[16];
+    REQUIRE(ring.tryPop(out, 3)==3);
+    CHECK(out[2]==2);
+    CHECK(ring.tryPush(8));
+    ring.close();
+    REQUIRE(ring.pop(out, 16)==6);
+    CHECK(out[5]==8);
+    CHECK(ring.pop(out, 16)==0);
+}
+
+    // TestSelectorEnv logs through Catch which isn't thread safe
+    struct NumberEnv : Env {
+        selector::Value n;
+        NumberEnv(int64_t i) : n(i) {}
+        const selector::Value& value(string_view) const override { return n; }
+    };
+    vector<NumberEnv> envs;
+    for (int i = 0; i<5000; ++i) envs.emplace_back(i);
+
+    auto expression = test_selector("N/7*7 = N");
+    SelectorSet set;
+    auto s0 = test_selector("N > 4990");
+    auto s1 = test_selector("N BETWEEN 100 AND 199");
+    set.add(*s0);
+    set.add(*s1);
+
+    for (auto mode : {WaitMode::BLOCK, WaitMode::BUSY_POLL}) {
+        for (std::size_t batch : {1, 16}) {
+            for (bool useSet : {false, true}) {
+                // Small rings so that both ends wait for each other
+                SpscRing<const Env*> in{8};
+                SpscRing<Delivery> out{4};
+                std::unique_ptr<FilterStage> stage;
+                if (useSet) stage = std::make_unique<FilterStage>(set, in, out, StageOptions{batch, mode});
+                else stage = std::make_unique<FilterStage>(*expression, in, out, StageOptions{batch, mode});
+
+                std::thread producer{[&] {
+                    for (auto& env : envs) in.push(&env, mode);
+                    in.close();
+                }};
+                std::thread filter{[&] { stage->run(); }};
+                vector<Delivery> delivered;
+                Delivery d[8];
+                while (auto n = out.pop(d, 8, mode)) delivered.insert(delivered.end(), d, d+n);
+                producer.join();
+                filter.join();
+
+                auto& c = stage->counters();
+                CHECK(c.messages==envs.size());
+                CHECK(c.deliveries==delivered.size());
+                CHECK(c.batches>=envs.size()/batch);
+                if (useSet) {
+                    REQUIRE(delivered.size()==9+100);
+                    CHECK(delivered[0].message==&envs[100]);
+                    CHECK(delivered[0].selector==1);
+                    CHECK(delivered.back().message==&envs.back());
+                    CHECK(delivered.back().selector==0);
+                } else {
+                    REQUIRE(delivered.size()==(envs.size()+6)/7);
+                    bool ordered = true;
+                    for (std::size_t i = 0; i<delivered.size(); ++i) ordered = ordered && delivered[i].message==&envs[7*i];
+                    CHECK(ordered);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE( "Selector Bulk Compile" ) {
+    vector<string> texts;
+    for (int i = 0; i<1000; ++i) {
+        switch (i%5) {
+        case 0: texts.push_back("A = " + std::to_string(i)); break;
+        case 1: texts.push_back("B LIKE 'x%' OR A > " + std::to_string(i%7)); break;
+        case 2: texts.push_back("A = 'unterminated"); break;
+        case 3: texts.push_back("C IN (1, 2, " + std::to_string(i%3) + ")"); break;
+        default: texts.push_back(""); break;
+        }
+    }
+    for (std::size_t threads : {1, 3, 0}) {
+        INFO("threads " << threads);
+        auto compiled = compile_selectors(texts, threads);
+        REQUIRE(compiled.size()==texts.size());
+        std::size_t failed = 0;
+        for (std::size_t i = 0; i<texts.size(); ++i) {
+            auto& c = compiled[i];
+            if (i%5==2) {
+                failed += !c.expression && !c.error.empty();
+                continue;
+            }
+            REQUIRE(c.expression);
+            CHECK(c.error.empty());
+            // The same as compiling it alone
+            TestSelectorEnv env;
+            env.set("A", int64_t(i%10));
+            env.set("B", "xy"sv);
+            env.set("C", int64_t(i%4));
+            CHECK(eval(*c.expression, env)==eval(*make_selector(texts[i]), env));
+        }
+        CHECK(failed==200);
+        // Identical texts share their expression
+        CHECK(compiled[1].expression==compiled[36].expression);
+        CHECK(compiled[4].expression==compiled[9].expression);
+        CHECK(compiled[0].expression!=compiled[5].expression);
+    }
+    CHECK(compile_selectors(vector<string_view>{}).empty());
+
+    // An expression keeps its arena after the others from it have gone. On
+    // one thread so that the counters see every allocation
+    using selector::bench::AllocationCounter;
+    std::shared_ptr<const Expression> kept;
+    std::size_t arenaAllocations;
+    {
+        AllocationCounter counter;
+        kept = compile_selectors(texts, 1)[3].expression;
+        arenaAllocations = counter.count();
+    }
+    std::size_t heapAllocations;
+    vector<CompiledSelector> heap;
+    {
+        AllocationCounter counter;
+        heap = compile_selectors(texts, 1, std::pmr::new_delete_resource());
+        heapAllocations = counter.count();
+    }
+    CHECK(arenaAllocations<heapAllocations/2);
+    TestSelectorEnv env;
+    env.set("A", int64_t(3));
+    env.set("C", int64_t(3));
+    CHECK(eval(*kept, env)==eval(*make_selector(texts[3]), env));
+    CHECK(eval(*heap[3].expression, env)==eval(*kept, env));
+}
+
+TEST_CASE( "Selector Workload Generator" ) {
+    using namespace selector::workload;
+
+SECTION("reproducible")
+{
+    auto texts = [](uint64_t seed) {
+        Generator g{seed};
+        std::ostringstream os;
+        for (auto& s : g.selectors(50)) os << s.text << "\n";
+        for (auto& m : g.messages(50, {})) os << m << "\n";
+        return os.str();
+    };
+    CHECK(texts(3)==texts(3));
+    CHECK(texts(3)!=texts(4));
+
+    Zipf uniform{4, 0.0};
+    Zipf skewed{4, 2.0};
+    Random rng{1};
+    vector<int> u(4), z(4);
+    for (int i = 0; i<4000; ++i) {
+        ++u[uniform(rng)];
+        ++z[skewed(rng)];
+    }
+    CHECK(u[0]>800);
+    CHECK(u[3]>800);
+    CHECK(z[0]>z[1]);
+    CHECK(z[1]>z[2]);
+    CHECK(z[0]>2000);
+}
+
+SECTION("selectors")
+{
+    Generator g{11, Vocabulary{8, 100, 1.0}};
+    SelectorOptions o;
+    o.like = 10;
+    o.depth = 4;
+    o.nesting = 0.7;
+    o.negation = 0.3;
+    std::size_t witnessed = 0;
+    for (auto& s : g.selectors(300, o)) {
+        INFO(s.text);
+        auto e = make_selector(s.text);
+        if (s.witnessed) {
+            ++witnessed;
+            CHECK(eval(*e, s.witness));
+        }
+    }
+    CHECK(witnessed>290);
+}
+
+SECTION("match rate")
+{
+    // With uniform values an IN list rarely matches by chance
+    Generator g{5, Vocabulary{16, 1000, 0.0}};
+    SelectorOptions o;
+    o.equality = o.comparison = o.like = o.between = o.null = o.arithmetic = o.boolean = 0;
+    o.depth = 0;
+    o.negation = 0.0;
+    auto selectors = g.selectors(1, o);
+    REQUIRE(selectors[0].text.find(" IN (")!=string::npos);
+    auto e = make_selector(selectors[0].text);
+    auto matching = [&](double rate) {
+        MessageOptions m;
+        m.matchRate = rate;
+        std::size_t matched = 0;
+        for (auto& msg : g.messages(1000, selectors, m)) matched += eval(*e, msg);
+        return matched;
+    };
+    CHECK(matching(1.0)==1000);
+    CHECK(matching(0.0)<20);
+    auto some = matching(0.3);
+    CHECK(some>240);
+    CHECK(some<360);
+}
+
+SECTION("differential")
+{
+    // The tree and the shared store's interpreter agree on a generated corpus
+    Generator g{17, Vocabulary{12, 50, 0.8}};
+    auto selectors = g.selectors(200);
+    MessageOptions o;
+    o.matchRate = 0.5;
+    o.present = 0.6;
+    auto messages = g.messages(100, selectors, o);
+    auto store = SharedSelectorStore::create("", 1 << 20, selectors.size());
+    vector<unique_ptr<Expression>> compiled;
+    for (auto& s : selectors) {
+        compiled.push_back(make_selector(s.text));
+        store.add(*compiled.back());
+    }
+    for (auto& m : messages) {
+        for (std::size_t s = 0; s<compiled.size(); ++s) {
+            INFO(selectors[s].text << " with " << m);
+            CHECK(store.eval_bool(s, m)==compiled[s]->eval_bool(m));
+        }
+    }
+}
+}
+
+TEST_CASE( "Selector Allocation Free Eval" ) {
+    using selector::bench::AllocationCounter;
+
+SECTION("counter")
+{
+    AllocationCounter outer;
+    {
+        AllocationCounter inner;
+        auto p = std::make_unique<string>(100, 'x');
+        CHECK(inner.count()==2);
+        CHECK(inner.bytes()>100);
+    }
+    CHECK(outer.count()==2);
+    std::thread other{[] { vector<int> v(10); }};
+    other.join();
+    CHECK(outer.count()<=3); // Starting the thread may allocate, but not what it does
+}
+
+SECTION("every node")
+{
+    vector<string> texts{
+        "A = 'x'", "B > 10", "B <> 3 AND B <= 20 AND B >= 1 AND B < 30", "A IS NULL", "A IS NOT NULL",
+        "A = 'y' OR B BETWEEN 5 AND 15", "B NOT BETWEEN 5 AND 15", "C", "NOT C", "C = TRUE",
+        "A LIKE '_' AND B < 20", "A LIKE 'x%'", "A LIKE '%a_bb%b%'", "A NOT LIKE '%'", "A LIKE 'a!%%' ESCAPE '!'",
+        "D IN ('p', 'q', 3)", "D NOT IN ('p', 1)", "B NOT IN (2, 3.0, E)", "FALSE", "",
+        "B + 1 = 8", "-B < -5 AND B * 2.5 >= B / 3", "(B-3)/0 > 1", "(B - 1.5) * 2 + B / 4 > 0.1", "E = E",
+        "a_rather_long_property_name_beyond_any_small_string = 'and a long value beyond any small string'"};
+    vector<unique_ptr<Expression>> selectors;
+    for (auto& t : texts) selectors.push_back(test_selector(t));
+
+    selector::workload::Generator g{23, selector::workload::Vocabulary{12, 100, 1.0}};
+    selector::workload::SelectorOptions o;
+    o.like = 8;
+    o.depth = 4;
+    for (auto& s : g.selectors(200, o)) selectors.push_back(test_selector(s.text));
+    auto messages = g.messages(50, {});
+
+    const string longName = "a_rather_long_property_name_beyond_any_small_string";
+    const string longValue = "and a long value beyond any small string";
+    vector<selector::workload::Message> envs;
+    vector<string_view> as{"x", "y", "xyz", "a%b", "aabbab", "", "yy"};
+    for (int i = 0; i<40; ++i) {
+        selector::workload::Message env;
+        if (i%8) env.set("A", as[i%7]);
+        if (i%5) env.set("B", i%3 ? selector::Value(int64_t(i%25)) : selector::Value(double(i%25)));
+        if (i%2) env.set("C", i%4==1);
+        if (i%3) env.set("D", i%6==1 ? selector::Value("p"sv) : selector::Value(int64_t(i%4)));
+        if (i%7==0) env.set("E", true);
+        if (i%2==0) env.set(longName, string_view{longValue});
+        envs.push_back(env);
+    }
+
+    std::size_t matched = 0;
+    AllocationCounter counter;
+    for (auto& e : selectors) {
+        for (auto& env : envs) {
+            matched += eval(*e, env);
+            e->eval(env);
+        }
+        for (auto& m : messages) matched += eval(*e, m);
+    }
+    CHECK(counter.count()==0);
+    CHECK(matched>0);
+}
+
+SECTION("C interface")
+{
+    const string longName = "a_rather_long_property_name_beyond_any_small_string";
+    auto e = selector_expression((longName + " LIKE 'x%y' AND n > 2").c_str());
+    REQUIRE(e);
+    auto env = selector_environment();
+    selector_environment_set(env, longName.c_str(), selector_value_string("x long enough to be on the heap y"));
+    selector_environment_set(env, "n", selector_value_exact(3));
+    {
+        AllocationCounter counter;
+        bool r = false;
+        for (int i = 0; i<100; ++i) r = selector_expression_eval(e, env);
+        CHECK(counter.count()==0);
+        CHECK(r);
+    }
+    selector_environment_free(env);
+    selector_expression_free(e);
+}
+}
+
+TEST_CASE( "Selector Profiled Eval" ) {
+
+SECTION("counts")
+{
+    auto e = test_selector("a = 1 AND (b > 2 OR c LIKE 'x%')");
+    ProfiledEval p(*e);
+    auto& nodes = p.nodes();
+    REQUIRE(nodes.size()>=3);
+    CHECK(nodes[0].depth==0);
+    CHECK(nodes[1].depth==1);
+    for (std::size_t i = 1; i<nodes.size(); ++i) CHECK(nodes[i].depth<=nodes[i-1].depth+1);
+    std::ostringstream text;
+    text << *e;
+    CHECK(nodes[0].text==text.str());
+
+    TestSelectorEnv env;
+    env.set("a", 1);
+    env.set("b", 1);
+    env.set("c", "xylophone"sv);
+    CHECK(p.eval(env));
+    CHECK(nodes[0].evaluations==1);
+    CHECK(nodes[0].trues==1);
+    for (auto& n : nodes) CHECK(n.evaluations==1);
+
+    // The OR and everything below it is skipped
+    env.set("a", 2);
+    CHECK(!p.eval(env));
+    CHECK(nodes[0].evaluations==2);
+    CHECK(nodes[0].falses==1);
+    auto skipped = std::count_if(nodes.begin(), nodes.end(), [](auto& n) { return n.evaluations==1; });
+    CHECK(skipped>0);
+
+    // c is unset, so the LIKE is unknown but b decides the OR
+    env.set("a", 1);
+    env.set("b", 3);
+    env.set("c", selector::Value{});
+    CHECK(p.eval(env));
+    CHECK(nodes[0].trues==2);
+
+    std::ostringstream table;
+    table << p;
+    CHECK(table.str().find(nodes[0].text)!=string::npos);
+
+    p.reset();
+    for (auto& n : nodes) CHECK(n.evaluations==0);
+}
+
+SECTION("differential")
+{
+    workload::Generator g{7};
+    auto selectors = g.selectors(50);
+    auto messages = g.messages(200, selectors, {0.7, 0.3});
+    for (auto& s : selectors) {
+        auto e = make_selector(s.text);
+        ProfiledEval p(*e);
+        for (auto& m : messages) {
+            INFO(s.text << " with " << m);
+            CHECK(p.eval_bool(m)==e->eval_bool(m));
+        }
+        CHECK(p.nodes()[0].evaluations==messages.size());
+        CHECK(p.nodes()[0].trues+p.nodes()[0].falses+p.nodes()[0].unknowns==messages.size());
+    }
+}
+
+}
+
+TEST_CASE( "Selector Memory Resources" ) {
+    using selector::bench::AllocationCounter;
+
+    // Counts what is outstanding from new_delete_resource()
+    class CountingResource : public std::pmr::memory_resource {
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+            ++allocations;
+            outstanding += bytes;
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+            outstanding -= bytes;
+            std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override {
+            return this==&o;
+        }
+
+    public:
+        std::size_t allocations = 0;
+        std::size_t outstanding = 0;
+    };
+
+    const string text = "A = 'x' AND B IN (1, 2, 3) AND C LIKE 'a_rather_long_pattern%' AND D NOT IN ('a_rather_long_string', 'y')";
+    TestSelectorEnv env;
+    env.set("A", "x"sv);
+    env.set("B", 2);
+    env.set("C", "a_rather_long_pattern indeed"sv);
+    env.set("D", "z"sv);
+
+SECTION("resource")
+{
+    CountingResource r;
+    {
+        auto e = make_selector(text, &r);
+        CHECK(r.allocations>=12);
+        CHECK(r.outstanding>0);
+        CHECK(eval(*e, env));
+
+        // Copies come from wherever is current
+        auto allocations = r.allocations;
+        auto s = simplify(*e);
+        CHECK(r.allocations==allocations);
+        e.reset();
+        CHECK(r.outstanding==0);
+        CHECK(eval(*s, env));
+    }
+    CHECK_THROWS_AS(make_selector("A = 'x' AND B IN (1, 2", &r), std::range_error);
+    CHECK(r.outstanding==0);
+}
+
+SECTION("no heap")
+{
+    std::byte buffer[8192];
+    std::pmr::monotonic_buffer_resource arena{buffer, sizeof(buffer), std::pmr::null_memory_resource()};
+    // The text of literals is interned the first time it's seen, and shared after
+    auto interned = make_selector(text);
+    std::unique_ptr<Expression> e;
+    {
+        AllocationCounter counter;
+        e = make_selector(text, &arena);
+        CHECK(counter.count()==0);
+    }
+    CHECK(eval(*e, env));
+    AllocationCounter counter;
+    e.reset();
+    e = make_selector("a_property_name_too_long_for_a_small_string > 1", &arena);
+    e.reset();
+    CHECK(counter.count()==0);
+}
+
+SECTION("arena")
+{
+    auto e = make_arena_selector(text);
+    auto plain = make_selector(text);
+    CHECK(e->eval_bool(env)==plain->eval_bool(env));
+    env.set("B", 4);
+    CHECK(e->eval_bool(env)==plain->eval_bool(env));
+    std::ostringstream os1, os2;
+    os1 << *e;
+    os2 << *plain;
+    CHECK(os1.str()==os2.str());
+
+    auto s = simplify(*e);
+    e.reset();
+    CHECK(s->eval_bool(env)==plain->eval_bool(env));
+
+    AllocationCounter counter;
+    auto a = make_arena_selector(text);
+    auto arenaAllocations = counter.count();
+    auto p = make_selector(text);
+    CHECK(arenaAllocations<counter.count()-arenaAllocations);
+}
+
+SECTION("tokens")
+{
+    CountingResource r;
+    {
+        Tokeniser t{"a_rather_long_identifier = 'a string longer than any small string' OR b", &r};
+        CHECK(t.nextToken()==Token(selector::T_IDENTIFIER, "a_rather_long_identifier"));
+        CHECK(t.nextToken()==Token(selector::T_EQUAL, "="));
+        CHECK(t.nextToken()==Token(selector::T_STRING, "a string longer than any small string"));
+        CHECK(r.allocations>=3);
+    }
+    CHECK(r.outstanding==0);
+}
+}
+
+TEST_CASE( "Selector Interned Strings" ) {
+
+SECTION("intern")
+{
+    string a = "interned";
+    string b = "interned";
+    auto ia = intern(a);
+    CHECK(ia==a);
+    CHECK(ia.data()!=a.data());
+    CHECK(intern(b).data()==ia.data());
+    CHECK(intern("other").data()!=ia.data());
+    CHECK(ia.data()[ia.size()]==0);
+    CHECK(selector_intern(a.c_str())==ia.data());
+
+    vector<std::thread> threads;
+    vector<vector<const char*>> seen(4);
+    for (std::size_t t = 0; t<seen.size(); ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i<1000; ++i) seen[t].push_back(intern("s" + std::to_string(i)).data());
+        });
+    }
+    for (auto& t : threads) t.join();
+    for (auto& s : seen) CHECK(s==seen[0]);
+}
+
+SECTION("equality")
+{
+    TestSelectorEnv env;
+    auto equal = [&](const selector::Value& a, const selector::Value& b) {
+        env.set("A", a);
+        env.set("B", b);
+        auto eq = eval_selector("A = B", env);
+        CHECK(eq!=eval_selector("A <> B", env));
+        CHECK(eq==eval_selector("A IN ('w', B)", env));
+        return eq;
+    };
+    InternedString ix{"x"};
+    InternedString ix2{"x"};
+    InternedString iy{"y"};
+    auto x = ix.value();
+    auto y = iy.value();
+    selector::Value plain{"x"sv};
+    CHECK(x.interned);
+    CHECK(!plain.interned);
+    CHECK(equal(x, ix2.value()));
+    CHECK(!equal(x, y));
+    // Otherwise the text is compared
+    CHECK(equal(x, plain));
+    CHECK(equal(plain, x));
+    CHECK(!equal(y, plain));
+
+    // Interned values are compared by pointer alone
+    string copy{"x"};
+    selector::Value impostor{string_view{copy}};
+    impostor.interned = true;
+    CHECK(!equal(impostor, x));
+    CHECK(equal(impostor, plain));
+
+    // The same text is equal without comparing it
+    auto xy = "xy"sv;
+    selector::Value px{xy.substr(0, 1)};
+    CHECK(equal(px, px));
+    CHECK(equal(px, string_view{copy}));
+    CHECK(!equal(px, xy));
+
+    // The tag takes no room
+    CHECK(sizeof(selector::Value)==sizeof(selector::Value::value));
+}
+
+SECTION("literals")
+{
+    // The string literals of an expression
+    std::function<void (const ValueExpression&, vector<selector::Value>&)> literals =
+        [&](const ValueExpression& e, vector<selector::Value>& ls) {
+            selector::Value v;
+            if (e.literal(v) && characters(v)) ls.push_back(v);
+            vector<const ValueExpression*> cs;
+            e.children(cs);
+            for (auto c : cs) literals(*c, ls);
+        };
+    auto texts = [&](const Expression& e) {
+        vector<selector::Value> vs;
+        literals(static_cast<const ValueExpression&>(e), vs);
+        vector<string_view> ls;
+        for (auto& v : vs) {
+            CHECK(v.interned);
+            ls.push_back(std::get<string_view>(v.value));
+        }
+        return ls;
+    };
+
+    // Equal literals share their interned text, as do the copies that
+    // simplifying makes
+    InternedString x{"x"};
+    auto e = make_selector("A = 'x' OR (B = 'y' AND C IN ('x', 'y', 'z'))");
+    auto ls = texts(*e);
+    REQUIRE(ls.size()==5);
+    CHECK(ls[0].data()==x.view().data());
+    CHECK(ls[2].data()==x.view().data());
+    CHECK(ls[1].data()==ls[3].data());
+    CHECK(ls[0].data()!=ls[1].data());
+    CHECK(ls[0].data()[ls[0].size()]==0);
+    auto s = simplify(*e);
+    auto sl = texts(*s);
+    REQUIRE(!sl.empty());
+    CHECK(std::find_if(ls.begin(), ls.end(), [&](string_view l) { return l.data()==sl[0].data(); })!=ls.end());
+    CHECK(texts(*make_arena_selector("A = 'x'"))[0].data()==x.view().data());
+
+    // A string value from the C interface is the literal's own text, so
+    // comparing them is comparing pointers (selector_value_t is a Value)
+    auto cv = selector_value_string("x");
+    auto& v = *reinterpret_cast<const selector::Value*>(cv);
+    CHECK(v.interned);
+    CHECK(std::get<string_view>(v.value).data()==ls[0].data());
+    auto ce = selector_expression("A = 'x' AND A IN ('w', 'x') AND A <> 'y'");
+    REQUIRE(ce);
+    auto cenv = selector_environment();
+    selector_environment_set(cenv, "A", cv);
+    CHECK(selector_expression_eval(ce, cenv));
+    selector_expression_free(ce);
+    selector_environment_free(cenv);
+
+    // Text is only interned while something uses it
+    auto n = interned_count();
+    auto d = make_selector("A = 'a literal only this expression has'");
+    CHECK(interned_count()==n+1);
+    auto ds = simplify(*d);
+    d.reset();
+    CHECK(interned_count()==n+1);
+    TestSelectorEnv env;
+    env.set("A", "a literal only this expression has"sv);
+    CHECK(eval(*ds, env));
+    ds.reset();
+    CHECK(interned_count()==n);
+
+    auto dv = selector_value_string("a string only this value has");
+    auto dr = selector_value("'a string only this value has'");
+    CHECK(interned_count()==n+1);
+    selector_value_free(dv);
+    CHECK(interned_count()==n+1);
+    selector_value_free(dr);
+    CHECK(interned_count()==n);
+
+    auto denv = selector_environment();
+    selector_environment_set(denv, "A", selector_value_string("a string only this environment has"));
+    CHECK(interned_count()==n+1);
+    selector_environment_free(denv);
+    CHECK(interned_count()==n);
+
+    // intern() keeps its strings for good
+    intern("a string interned for good");
+    CHECK(interned_count()==n+1);
+}
+}
+
+
+TEST_CASE( "Selector JSON Env" ) {
+using selector::JsonEnv;
+
+SECTION("values")
+{
+    string json = R"( { "s": "text", "i": -42, "big": 123456789012345678901,
+        "x": 2.5e3, "t": true, "f": false, "n": null,
+        "o": {"i": 1, "a": [1, "}]", {"k": "\"{"}]}, "a": [[], {}], "last": 7 } )";
+    JsonEnv env(json);
+    auto& s = env.value("s");
+    REQUIRE(s.value.index()==selector::Value::T_STRING);
+    CHECK(std::get<string_view>(s.value)=="text");
+    // Unescaped strings are views into the buffer
+    CHECK(std::get<string_view>(s.value).data()==json.data()+json.find("text"));
+    CHECK(std::get<int64_t>(env.value("i").value)==-42);
+    CHECK(std::get<double>(env.value("big").value)==Approx(123456789012345678901.0));
+    CHECK(std::get<double>(env.value("x").value)==2500.0);
+    CHECK(std::get<bool>(env.value("t").value));
+    CHECK(!std::get<bool>(env.value("f").value));
+    CHECK(unknown(env.value("n")));
+    CHECK(unknown(env.value("o")));
+    CHECK(unknown(env.value("a")));
+    CHECK(std::get<int64_t>(env.value("last").value)==7);
+    CHECK(unknown(env.value("missing")));
+    // Keys inside nested objects aren't properties
+    CHECK(unknown(env.value("k")));
+    CHECK(env.complete());
+
+    CHECK(eval(*make_selector("s = 'text' AND i < 0 AND x BETWEEN 2000 AND 3000 AND t AND NOT f"), env));
+    CHECK(eval(*make_selector("n IS NULL AND missing IS NULL AND last = 7"), env));
+}
+
+SECTION("lazy")
+{
+    string json = R"({"a": 1, "b": 2, "c": 3, "a": 4, "d": )";
+    JsonEnv env(json);
+    // Later members are not looked at until asked for
+    CHECK(std::get<int64_t>(env.value("b").value)==2);
+    CHECK(std::get<int64_t>(env.value("a").value)==1);
+    // The same value each time without scanning again
+    CHECK(&env.value("b")==&env.value("b"));
+    CHECK(std::get<int64_t>(env.value("c").value)==3);
+    // The truncated end is only found by scanning to it
+    CHECK(unknown(env.value("d")));
+    CHECK(!env.complete());
+    CHECK(std::get<int64_t>(env.value("a").value)==1);
+}
+
+SECTION("escapes")
+{
+    string json = R"({"q\"k": "a\"b\\c\/d\n", "u": "é€😀", "bad": "\x", "lone": "\udc00", "esc": 1})";
+    JsonEnv env(json);
+    CHECK(std::get<string_view>(env.value("q\"k").value)=="a\"b\\c/d\n");
+    CHECK(std::get<string_view>(env.value("u").value)=="\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+    CHECK(unknown(env.value("bad")));
+    CHECK(unknown(env.value("lone")));
+    CHECK(std::get<int64_t>(env.value("esc").value)==1);
+    CHECK(env.complete());
+}
+
+SECTION("malformed")
+{
+    auto check = [](string_view json, bool complete) {
+        INFO(json);
+        JsonEnv env(json);
+        CHECK(unknown(env.value("z")));
+        CHECK(env.complete()==complete);
+    };
+    check("{}", true);
+    check(" { } trailing", true);
+    check("", false);
+    check("[1, 2]", false);
+    check(R"({"a" 1})", false);
+    check(R"({"a": 1 "b": 2})", false);
+    check(R"({"a": 1,})", false);
+    check(R"({"a": })", false);
+    check(R"({"a": "unterminated})", false);
+    check(R"({"a": {"b": [1, 2})", false);
+
+    JsonEnv env(R"({"a": 01x, "b": tru, "c": "ok", "d": })");
+    CHECK(unknown(env.value("a")));
+    CHECK(unknown(env.value("b")));
+    CHECK(std::get<string_view>(env.value("c").value)=="ok");
+    CHECK(unknown(env.value("d")));
+}
+}
+
+TEST_CASE( "Selector Shape Eval" ) {
+    using namespace selector::workload;
+
+SECTION("shapes")
+{
+    auto e = test_selector("(a > 5 AND b = 'x') OR (c IS NOT NULL AND d LIKE 'x%') OR e IS NULL");
+    ShapeEval shaped(*e);
+    TestSelectorEnv env;
+    // Without e the shape decides
+    CHECK(shaped.eval(env));
+    env.set("a", 7);
+    CHECK(shaped.eval(env));
+    CHECK(shaped.decided()==2);
+    REQUIRE(shaped.shapes().size()==2);
+    CHECK(shaped.shapes()[0].decided);
+    CHECK(shaped.shapes()[0].matches);
+
+    // With only e nothing can match
+    TestSelectorEnv onlyE;
+    onlyE.set("e", 1);
+    CHECK(!shaped.eval(onlyE));
+    CHECK(shaped.decided()==3);
+    CHECK(!shaped.shapes().back().matches);
+
+    // a, b and e: only the first term remains
+    TestSelectorEnv abe;
+    abe.set("a", 7);
+    abe.set("b", "x"sv);
+    abe.set("e", 1);
+    CHECK(shaped.eval(abe));
+    REQUIRE(shaped.shapes().size()==4);
+    CHECK(!shaped.shapes().back().decided);
+    CHECK(estimated_cost(*shaped.shapes().back().residual)<estimated_cost(*e));
+    abe.set("b", "y"sv);
+    CHECK(!shaped.eval(abe));
+    CHECK(shaped.shapes().size()==4);
+    CHECK(shaped.decided()==3);
+}
+
+SECTION("limit")
+{
+    auto e = test_selector("a IS NULL OR b = 1");
+    ShapeEval shaped(*e, 1);
+    TestSelectorEnv env;
+    CHECK(shaped.eval(env));
+    env.set("a", 1);
+    env.set("b", 1);
+    CHECK(shaped.eval(env));
+    env.set("b", 2);
+    CHECK(!shaped.eval(env));
+    CHECK(shaped.shapes().size()==1);
+    CHECK(shaped.decided()==1);
+}
+
+SECTION("differential")
+{
+    // Specialised and whole expressions match the same messages of every shape
+    Generator g{23, Vocabulary{12, 50, 0.8}};
+    auto selectors = g.selectors(200);
+    MessageOptions o;
+    o.matchRate = 0.5;
+    o.present = 0.5;
+    auto messages = g.messages(200, selectors, o);
+    for (auto& s : selectors) {
+        auto e = make_selector(s.text);
+        ShapeEval shaped(*e, 64);
+        for (auto& m : messages) {
+            INFO(s.text << " with " << m);
+            CHECK(shaped.eval(m)==eval(*e, m));
+        }
+    }
+}
+}
+
+TEST_CASE( "Selector Fuzz Corpus" ) {
+    // Inputs that once took far too long to parse, simplify or evaluate
+    std::size_t inputs = 0;
+    for (auto& f : std::filesystem::directory_iterator(SELECTORS_FUZZ_CORPUS)) {
+        std::ifstream in(f.path(), std::ios::binary);
+        string input{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+        auto data = reinterpret_cast<const uint8_t*>(input.data());
+        auto cost = fuzz::run(data, input.size());
+        INFO(f.path().filename() << ": " << cost.perByte() << " work per byte");
+        CHECK(cost.perByte()<fuzz::maxWorkPerByte);
+        // The count doesn't depend on the machine or what else it is doing
+        CHECK(fuzz::run(data, input.size()).work==cost.work);
+        ++inputs;
+    }
+    CHECK(inputs>0);
+
+    // A chain twice as long costs about twice as much
+    auto chain = [](int n) {
+        string s;
+        for (int i = 0; i<n; ++i) s += (i ? " OR " : "") + ("(s = 'v"s + std::to_string(i) + "' AND n > " + std::to_string(i) + ")");
+        return fuzz::run(reinterpret_cast<const uint8_t*>(s.data()), s.size()).work;
+    };
+    CHECK(chain(2000) < 2.5*chain(1000));
+}
+
+// An Arrow array and its schema over buffers owned by the test
+struct ArrowField {
+    ArrowSchema schema{};
+    ArrowArray array{};
+    vector<const void*> buffers;
+
+    ArrowField(const char* format, const char* name, int64_t length, vector<const void*> b, int64_t nulls = 0) :
+        buffers(std::move(b))
+    {
+        schema.format = format;
+        schema.name = name;
+        array.length = length;
+        array.null_count = nulls;
+        array.n_buffers = buffers.size();
+        array.buffers = buffers.data();
+    }
+
+    ArrowField(const ArrowField&) = delete;
+};
+
+// Offsets and characters of an Arrow string array
+template <typename Offset>
+struct ArrowStrings {
+    vector<Offset> offsets{0};
+    string chars;
+
+    explicit ArrowStrings(const vector<string_view>& strings) {
+        for (auto s : strings) {
+            chars += s;
+            offsets.push_back(chars.size());
+        }
+    }
+};
+
+TEST_CASE( "Selector Arrow Filter" ) {
+    // The batch is a slice of longer arrays whose start isn't on a byte
+    const int64_t rows = 150;
+    const int64_t offset = 5;
+    const int64_t total = offset+rows+9;
+    auto setBit = [](vector<uint8_t>& b, int64_t i) { b[i/8] |= 1 << (i%8); };
+
+    vector<int64_t> sizes(total);
+    vector<uint8_t> sizesValid((total+7)/8);
+    vector<double> prices(total);
+    vector<uint8_t> urgent((total+7)/8);
+    vector<string_view> names(total);
+    vector<uint8_t> namesValid((total+7)/8);
+    vector<string_view> customers(total);
+    vector<int32_t> regionCodes(total);
+    vector<uint8_t> regionsValid((total+7)/8);
+    vector<int8_t> typeCodes(total);
+    const vector<string_view> regionEntries{"eu", "us", "asia", "eu-west"};
+    const vector<string_view> typeEntries{"order", "quote", "trade"};
+    const vector<string_view> nameList{"alpha", "beta", "", "gamma delta"};
+    for (int64_t i = 0; i<total; ++i) {
+        sizes[i] = i*7%100;
+        if (i%6) setBit(sizesValid, i);
+        prices[i] = i*1.5;
+        if (i%3==0) setBit(urgent, i);
+        names[i] = nameList[i%4];
+        if (i%5) setBit(namesValid, i);
+        customers[i] = i%2 ? "customer-1"sv : "customer-22"sv;
+        regionCodes[i] = i%4;
+        if (i%7) setBit(regionsValid, i);
+        typeCodes[i] = i%3;
+    }
+    ArrowStrings<int32_t> nameStrings{names};
+    ArrowStrings<int64_t> customerStrings{customers};
+    ArrowStrings<int32_t> regionStrings{regionEntries};
+    ArrowStrings<int32_t> typeStrings{typeEntries};
+
+    ArrowField size{"l", "size", total, {sizesValid.data(), sizes.data()}, -1};
+    ArrowField price{"g", "price", total, {nullptr, prices.data()}};
+    ArrowField flag{"b", "urgent", total, {nullptr, urgent.data()}};
+    ArrowField name{"u", "name", total, {namesValid.data(), nameStrings.offsets.data(), nameStrings.chars.data()}, 30};
+    ArrowField customer{"U", "customer", total, {nullptr, customerStrings.offsets.data(), customerStrings.chars.data()}};
+    ArrowField region{"i", "region", total, {regionsValid.data(), regionCodes.data()}, 22};
+    ArrowField regionDictionary{"u", nullptr, 4, {nullptr, regionStrings.offsets.data(), regionStrings.chars.data()}};
+    region.schema.dictionary = &regionDictionary.schema;
+    region.array.dictionary = &regionDictionary.array;
+    ArrowField type{"c", "type", total, {nullptr, typeCodes.data()}};
+    ArrowField typeDictionary{"u", nullptr, 3, {nullptr, typeStrings.offsets.data(), typeStrings.chars.data()}};
+    type.schema.dictionary = &typeDictionary.schema;
+    type.array.dictionary = &typeDictionary.array;
+    ArrowField timestamp{"tsu:", "timestamp", total, {nullptr, sizes.data()}};
+
+    vector<ArrowSchema*> schemas;
+    vector<ArrowArray*> arrays;
+    for (auto f : {&size, &price, &flag, &name, &customer, &region, &type, &timestamp}) {
+        schemas.push_back(&f->schema);
+        arrays.push_back(&f->array);
+    }
+    ArrowField batch{"+s", "", rows, {nullptr}};
+    batch.schema.n_children = batch.array.n_children = schemas.size();
+    batch.schema.children = schemas.data();
+    batch.array.children = arrays.data();
+    batch.array.offset = offset;
+
+SECTION("columns")
+{
+    ArrowBatch b{batch.schema, batch.array};
+    CHECK(b.batch().size()==rows);
+    CHECK(b.skipped()==vector<string>{"timestamp"});
+    // The int32 indexed dictionary can be evaluated by entry
+    CHECK(dynamic_cast<const DictionaryColumn*>(b.batch().column("region")));
+    CHECK(!dynamic_cast<const DictionaryColumn*>(b.batch().column("type")));
+    CHECK(!b.batch().column("timestamp"));
+    auto v = b.batch().column("customer")->value(0);
+    REQUIRE(v.type()==selector::Value::T_STRING);
+    CHECK(std::get<string_view>(v.value).data()==customerStrings.chars.data()+customerStrings.offsets[offset]);
+}
+
+SECTION("filter")
+{
+    for (auto s : {"size > 50", "size IS NULL", "price BETWEEN 20 AND 100", "urgent", "NOT urgent AND size < 30",
+                   "name LIKE '%a%'", "name = ''", "name IS NULL OR customer = 'customer-1'",
+                   "region IN ('eu', 'asia')", "region LIKE 'eu%' AND type <> 'quote'", "region IS NULL",
+                   "type = 'trade' OR price > 200", "timestamp IS NULL", "timestamp > 0"}) {
+        auto e = test_selector(s);
+        vector<uint64_t> selection;
+        filter(*e, batch.schema, batch.array, selection);
+        REQUIRE(selection.size()==(rows+63)/64);
+        // Every bit is overwritten and nothing after the last word
+        vector<uint64_t> c((rows+63)/64 + 1, ~uint64_t(0));
+        auto ce = selector_expression(s);
+        CHECK(selector_expression_filter_arrow(ce, &batch.schema, &batch.array, c.data()));
+        selector_expression_free(ce);
+        CHECK(c.back()==~uint64_t(0));
+        c.pop_back();
+        CHECK(c==selection);
+        INFO("Selector: " << s);
+        for (int64_t r = 0; r<rows; ++r) {
+            auto i = r+offset;
+            TestSelectorEnv env;
+            if (i%6) env.set("size", sizes[i]);
+            env.set("price", prices[i]);
+            env.set("urgent", i%3==0);
+            if (i%5) env.set("name", names[i]);
+            env.set("customer", customers[i]);
+            if (i%7) env.set("region", regionEntries[regionCodes[i]]);
+            env.set("type", typeEntries[typeCodes[i]]);
+            INFO("Row: " << r);
+            CHECK(selected(selection, r)==eval(*e, env));
+        }
+    }
+}
+
+SECTION("bad codes")
+{
+    // Codes that aren't entries of the dictionary are missing values
+    vector<int32_t> codes{0, 100000000, -50000000, 4, -1, 3};
+    ArrowField bad{"i", "region", 6, {nullptr, codes.data()}};
+    bad.schema.dictionary = &regionDictionary.schema;
+    bad.array.dictionary = &regionDictionary.array;
+    ArrowSchema* badSchemas[] = {&bad.schema};
+    ArrowArray* badArrays[] = {&bad.array};
+    ArrowField badBatch{"+s", "", 6, {nullptr}};
+    badBatch.schema.n_children = badBatch.array.n_children = 1;
+    badBatch.schema.children = badSchemas;
+    badBatch.array.children = badArrays;
+    for (auto [s, expected] : {std::pair{"region = 'eu'", 0x01ull}, std::pair{"region IS NULL", 0x1eull},
+                               std::pair{"region IN ('eu', 'eu-west')", 0x21ull}, std::pair{"region LIKE 'e%' OR region IS NULL", 0x3full}}) {
+        vector<uint64_t> selection;
+        filter(*test_selector(s), badBatch.schema, badBatch.array, selection);
+        INFO("Selector: " << s);
+        CHECK(selection==vector<uint64_t>{expected});
+    }
+}
+
+SECTION("errors")
+{
+    ArrowField notStruct{"l", "", rows, {nullptr, sizes.data()}};
+    CHECK_THROWS_AS(ArrowBatch(notStruct.schema, notStruct.array), std::invalid_argument);
+    batch.array.offset = total;
+    CHECK_THROWS_AS(ArrowBatch(batch.schema, batch.array), std::invalid_argument);
+    auto ce = selector_expression("TRUE");
+    CHECK(!selector_expression_filter_arrow(ce, &batch.schema, &batch.array, nullptr));
+    selector_expression_free(ce);
+}
+}
+
 }
@@ -21,13 +21,17 @@
 
 #include "SelectorToken.h"
 
-#include <algorithm>
 #include <cassert>
-#include <cctype>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <string_view>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace std::literals;
 
 namespace selector {
@@ -46,102 +50,229 @@ TokenException::TokenException(const std::string& msg) :
     range_error(msg)
 {}
 
-// Lexically, reserved words are a subset of identifiers
-// so we parse an identifier first then check if it is a reserved word and
-// convert it if it is a reserved word
+// Character classes: a table rather than <cctype> so that classifying is a
+// load, and doesn't depend on the locale
 namespace {
 
-struct RWEntry {
-    const char* word;
-    TokenType type;
+enum : uint8_t {
+    C_SPACE = 1,
+    C_IDENTIFIER_START = 2,
+    C_IDENTIFIER_PART = 4,
+    C_DIGIT = 8,
+    C_XDIGIT = 16
+};
+
+struct CharClasses {
+    uint8_t classes[256] = {};
+
+    constexpr CharClasses() {
+        for (auto c : " \t\n\v\f\r"sv) classes[uint8_t(c)] |= C_SPACE;
+        for (int c = 'a'; c<='z'; ++c) {
+            classes[c] |= C_IDENTIFIER_START | C_IDENTIFIER_PART;
+            classes[c-'a'+'A'] |= C_IDENTIFIER_START | C_IDENTIFIER_PART;
+        }
+        for (int c = '0'; c<='9'; ++c) classes[c] |= C_IDENTIFIER_PART | C_DIGIT | C_XDIGIT;
+        for (int c = 'a'; c<='f'; ++c) {
+            classes[c] |= C_XDIGIT;
+            classes[c-'a'+'A'] |= C_XDIGIT;
+        }
+        for (auto c : "_$"sv) classes[uint8_t(c)] |= C_IDENTIFIER_START | C_IDENTIFIER_PART;
+        classes[uint8_t('.')] |= C_IDENTIFIER_PART;
+    }
 };
 
-inline bool caseless(const char* s1, const char* s2)
+constexpr CharClasses charClasses;
+
+inline bool is(char c, uint8_t cls)
 {
-    do {
-        char ls1 = std::tolower(*s1);
-        char ls2 = std::tolower(*s2);
-        if (ls1<ls2)
-            return true;
-        else if (ls1>ls2)
-            return false;
-    } while ( *s1++ && *s2++ );
-    // Equal
-    return false;
+    return charClasses.classes[uint8_t(c)] & cls;
 }
 
-inline bool operator<(const RWEntry& lhs, const RWEntry& rhs) {
-    return caseless(lhs.word, rhs.word);
+// The first character from p that isn't whitespace or that can't be part of
+// an identifier: SSE2 looks at 16 characters at a time
+#ifdef __SSE2__
+// Whether each byte is in [lo, hi]
+inline __m128i inRange(__m128i v, char lo, char hi)
+{
+    auto d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(char(hi-lo))), d);
 }
 
+inline const char* firstNot(const char* p, const char* e, int mask(__m128i), uint8_t cls)
+{
+    for (; e-p>=16; p += 16) {
+        auto in = unsigned(mask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+        if (in!=0xffff) return p + __builtin_ctz(~in);
+    }
+    while (p!=e && is(*p, cls)) ++p;
+    return p;
 }
 
-bool tokeniseReservedWord(Token& tok)
+inline int spaceMask(__m128i v)
 {
-    // This must be sorted!!
-    static const RWEntry reserved[] = {
-        {"and", T_AND},
-        {"between", T_BETWEEN},
-        {"escape", T_ESCAPE},
-        {"false", T_FALSE},
-        {"in", T_IN},
-        {"is", T_IS},
-        {"like", T_LIKE},
-        {"not", T_NOT},
-        {"null", T_NULL},
-        {"or", T_OR},
-        {"true", T_TRUE}
-    };
+    return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), inRange(v, '\t', '\r')));
+}
 
-    const int reserved_size = sizeof(reserved)/sizeof(RWEntry);
+inline int identifierMask(__m128i v)
+{
+    // Setting 0x20 makes letters lower case and nothing else a letter
+    auto letter = inRange(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+    auto digit = inRange(v, '0', '9');
+    auto other = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+                 _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('$')), _mm_cmpeq_epi8(v, _mm_set1_epi8('.'))));
+    return _mm_movemask_epi8(_mm_or_si128(letter, _mm_or_si128(digit, other)));
+}
 
-    if ( tok.type != T_IDENTIFIER ) return false;
+inline const char* skipSpace(const char* p, const char* e)
+{
+    return firstNot(p, e, spaceMask, C_SPACE);
+}
+
+inline const char* skipIdentifier(const char* p, const char* e)
+{
+    return firstNot(p, e, identifierMask, C_IDENTIFIER_PART);
+}
+#else
+inline const char* skipSpace(const char* p, const char* e)
+{
+    while (p!=e && is(*p, C_SPACE)) ++p;
+    return p;
+}
+
+inline const char* skipIdentifier(const char* p, const char* e)
+{
+    while (p!=e && is(*p, C_IDENTIFIER_PART)) ++p;
+    return p;
+}
+#endif
 
-    RWEntry rw;
-    rw.word = tok.val.c_str();
-    auto entry = std::equal_range(&reserved[0], &reserved[reserved_size], rw);
+// Lexically, reserved words are a subset of identifiers
+// so we parse an identifier first then check if it is a reserved word and
+// convert it if it is a reserved word
+struct Keyword {
+    std::string_view word; // Lower case
+    TokenType type = T_EOS;
+};
 
-    if ( entry.first==entry.second ) return false;
+constexpr Keyword keywords[] = {
+    {"and", T_AND},
+    {"between", T_BETWEEN},
+    {"escape", T_ESCAPE},
+    {"false", T_FALSE},
+    {"in", T_IN},
+    {"is", T_IS},
+    {"like", T_LIKE},
+    {"not", T_NOT},
+    {"null", T_NULL},
+    {"or", T_OR},
+    {"true", T_TRUE}
+};
+
+constexpr std::size_t KEYWORD_SLOTS = 16;
 
-    tok.type = entry.first->type;
+// Letters, and only letters, are made lower case by setting 0x20
+constexpr unsigned fold(char c)
+{
+    return uint8_t(c) | 0x20;
+}
+
+// Picks a slot from the length and the first and last characters
+struct KeywordHash {
+    unsigned first = 0;
+    unsigned last = 0;
+
+    constexpr std::size_t operator()(std::string_view w) const {
+        return (fold(w.front())*first + fold(w.back())*last + w.size()) % KEYWORD_SLOTS;
+    }
+};
+
+// Search for multipliers that give every keyword a slot of its own
+constexpr KeywordHash perfectHash()
+{
+    for (unsigned a = 1; a<64; ++a) {
+        for (unsigned b = 0; b<64; ++b) {
+            KeywordHash h{a, b};
+            bool used[KEYWORD_SLOTS] = {};
+            bool perfect = true;
+            for (auto& k : keywords) {
+                auto slot = h(k.word);
+                perfect = perfect && !used[slot];
+                used[slot] = true;
+            }
+            if (perfect) return h;
+        }
+    }
+    return {};
+}
+
+constexpr KeywordHash keywordHash = perfectHash();
+static_assert(keywordHash.first!=0, "No perfect hash for the keywords");
+
+struct KeywordTable {
+    Keyword slots[KEYWORD_SLOTS] = {};
+
+    constexpr KeywordTable() {
+        for (auto& k : keywords) slots[keywordHash(k.word)] = k;
+    }
+};
+
+constexpr KeywordTable keywordTable;
+
+}
+
+bool tokeniseReservedWord(Token& tok)
+{
+    if ( tok.type != T_IDENTIFIER || tok.val.empty() ) return false;
+
+    std::string_view w = tok.val;
+    auto& k = keywordTable.slots[keywordHash(w)];
+    if ( k.word.size()!=w.size() ) return false;
+    for (std::size_t i = 0; i<w.size(); ++i) {
+        if ( fold(w[i])!=uint8_t(k.word[i]) ) return false;
+    }
+
+    tok.type = k.type;
     return true;
 }
 
+// Assigning in place keeps the text in the token's own memory resource
+inline void setToken(Token& tok, TokenType type, std::string_view val)
+{
+    tok.type = type;
+    tok.val = val;
+}
+
 // parsing strings is complicated by the need to allow embedded quotes by doubling the quote character
 bool processString(std::string_view& sv, char quoteChar, TokenType type, Token& tok)
 {
     // We only get here once the tokeniser recognises the initial quote for a string
-    // so we don't need to check for it again.
-    auto e = sv.cend();
-    auto q = std::find(sv.cbegin()+1, e, quoteChar);
+    // so we don't need to check for it again. memchr() searches many
+    // characters at a time.
+    auto find = [&](const char* p) {
+        auto q = static_cast<const char*>(std::memchr(p, quoteChar, sv.data()+sv.size()-p));
+        return q ? q : sv.data()+sv.size();
+    };
+    auto e = sv.data()+sv.size();
+    auto q = find(sv.data()+1);
     if ( q==e ) return false;
 
-    std::string content(sv.cbegin()+1, q);
+    // Build the content in place so it stays in the token's memory resource
+    tok.type = type;
+    tok.val.assign(sv.data()+1, q);
     ++q;
 
     while ( q!=e && *q==quoteChar ) {
         auto p = q;
-        q = std::find(p+1, e, quoteChar);
+        q = find(p+1);
         if ( q==e ) return false;
-        content += std::string(p, q);
+        tok.val.append(p, q);
         ++q;
     }
 
-    tok = Token(type, content);
-    sv.remove_prefix(q - sv.cbegin());
+    sv.remove_prefix(q - sv.data());
     return true;
 }
 
-inline bool isIdentifierStart(char c)
-{
-    return std::isalpha(c) || c=='_' || c=='$';
-}
-
-inline bool isIdentifierPart(char c)
-{
-    return std::isalnum(c) || c=='_' || c=='$' || c=='.';
-}
-
 bool tokenise(std::string_view& sv, Token& tok)
 {
     auto t = sv.cbegin();
@@ -174,8 +305,13 @@ bool tokenise(std::string_view& sv, Token& tok)
     while (true)
     switch (state) {
     case START:
-        if (t==e) {tok = Token(T_EOS, "<END>"); return true;}
-        else if (std::isspace(*t)) {++t; sv.remove_prefix(1); continue;}
+        if (t==e) {setToken(tok, T_EOS, "<END>"); return true;}
+        else if (is(*t, C_SPACE)) {
+            auto n = skipSpace(sv.data(), sv.data()+sv.size()) - sv.data();
+            t += n;
+            sv.remove_prefix(n);
+            continue;
+        }
         else switch (*t) {
         case '(': tokType = T_LPAREN; state = ACCEPT_INC; continue;
         case ')': tokType = T_RPAREN; state = ACCEPT_INC; continue;
@@ -200,33 +336,34 @@ bool tokenise(std::string_view& sv, Token& tok)
         default:
             break;
         }
-        if (isIdentifierStart(*t)) {++t; state = IDENTIFIER;}
+        if (is(*t, C_IDENTIFIER_START)) {++t; state = IDENTIFIER;}
         else if (*t=='\'') {return processString(sv, '\'', T_STRING, tok);}
         else if (*t=='\"') {return processString(sv, '\"', T_IDENTIFIER, tok);}
         else if (*t=='0') {++t; state = ZERO;}
-        else if (std::isdigit(*t)) {++t; state = DIGIT;}
+        else if (is(*t, C_DIGIT)) {++t; state = DIGIT;}
         else if (*t=='.') {++t; state = DECIMAL_START;}
         else state = REJECT;
         continue;
-    case IDENTIFIER:
-        if (t==e) {state = ACCEPT_IDENTIFIER;}
-        else if (isIdentifierPart(*t)) {++t; state = IDENTIFIER;}
-        else state = ACCEPT_IDENTIFIER;
+    case IDENTIFIER: {
+        auto p = sv.data() + (t-sv.cbegin());
+        t += skipIdentifier(p, sv.data()+sv.size()) - p;
+        state = ACCEPT_IDENTIFIER;
         continue;
+    }
     case DECIMAL_START:
         if (t==e) {state = REJECT;}
-        else if (std::isdigit(*t)) {++t; state = DECIMAL;}
+        else if (is(*t, C_DIGIT)) {++t; state = DECIMAL;}
         else state = REJECT;
         continue;
     case EXPONENT_SIGN:
         if (t==e) {state = REJECT;}
         else if (*t=='-' || *t=='+') {++t; state = EXPONENT_START;}
-        else if (std::isdigit(*t)) {++t; state = EXPONENT;}
+        else if (is(*t, C_DIGIT)) {++t; state = EXPONENT;}
         else state = REJECT;
         continue;
     case EXPONENT_START:
         if (t==e) {state = REJECT;}
-        else if (std::isdigit(*t)) {++t; state = EXPONENT;}
+        else if (is(*t, C_DIGIT)) {++t; state = EXPONENT;}
         else state = REJECT;
         continue;
     case ZERO:
@@ -238,13 +375,13 @@ bool tokenise(std::string_view& sv, Token& tok)
         continue;
     case HEXDIGIT_START:
         if (t==e) {state = REJECT;}
-        else if (std::isxdigit(*t)) {++t; state = HEXDIGIT;}
+        else if (is(*t, C_XDIGIT)) {++t; state = HEXDIGIT;}
         else state = REJECT;
         continue;
     case HEXDIGIT:
         if (t==e) {tokType = T_NUMERIC_EXACT; state = ACCEPT_NOINC;}
         else if (*t=='l' || *t=='L') {tokType = T_NUMERIC_EXACT; state = ACCEPT_INC;}
-        else if (std::isxdigit(*t) || *t=='_') {++t; state = HEXDIGIT;}
+        else if (is(*t, C_XDIGIT) || *t=='_') {++t; state = HEXDIGIT;}
         else if (*t=='p' || *t=='P') {++t; state = EXPONENT_SIGN;}
         else {tokType = T_NUMERIC_EXACT; state = ACCEPT_NOINC;}
         continue;
@@ -262,28 +399,28 @@ bool tokenise(std::string_view& sv, Token& tok)
     case OCTDIGIT:
         if (t==e) {tokType = T_NUMERIC_EXACT; state = ACCEPT_NOINC;}
         else if (*t=='l' || *t=='L') {tokType = T_NUMERIC_EXACT; state = ACCEPT_INC;}
-        else if ((std::isdigit(*t) && *t<'8') || *t=='_') {++t; state = OCTDIGIT;}
+        else if ((is(*t, C_DIGIT) && *t<'8') || *t=='_') {++t; state = OCTDIGIT;}
         else {tokType = T_NUMERIC_EXACT; state = ACCEPT_NOINC;}
         continue;
     case DIGIT:
         if (t==e) {tokType = T_NUMERIC_EXACT; state = ACCEPT_NOINC;}
         else if (*t=='l' || *t=='L') {tokType = T_NUMERIC_EXACT; state = ACCEPT_INC;}
         else if (*t=='f' || *t=='F' || *t=='d' || *t=='D') {tokType = T_NUMERIC_APPROX; state = ACCEPT_INC;}
-        else if (std::isdigit(*t) || *t=='_') {++t; state = DIGIT;}
+        else if (is(*t, C_DIGIT) || *t=='_') {++t; state = DIGIT;}
         else if (*t=='.') {++t; state = DECIMAL;}
         else if (*t=='e' || *t=='E') {++t; state = EXPONENT_SIGN;}
         else {tokType = T_NUMERIC_EXACT; state = ACCEPT_NOINC;}
         continue;
     case DECIMAL:
         if (t==e) {tokType = T_NUMERIC_APPROX; state = ACCEPT_NOINC;}
-        else if (std::isdigit(*t) || *t=='_') {++t; state = DECIMAL;}
+        else if (is(*t, C_DIGIT) || *t=='_') {++t; state = DECIMAL;}
         else if (*t=='e' || *t=='E') {++t; state = EXPONENT_SIGN;}
         else if (*t=='f' || *t=='F' || *t=='d' || *t=='D') {tokType = T_NUMERIC_APPROX; state = ACCEPT_INC;}
         else {tokType = T_NUMERIC_APPROX; state = ACCEPT_NOINC;}
         continue;
     case EXPONENT:
         if (t==e) {tokType = T_NUMERIC_APPROX; state = ACCEPT_NOINC;}
-        else if (std::isdigit(*t)) {++t; state = EXPONENT;}
+        else if (is(*t, C_DIGIT)) {++t; state = EXPONENT;}
         else if (*t=='f' || *t=='F' || *t=='d' || *t=='D') {tokType = T_NUMERIC_APPROX; state = ACCEPT_INC;}
         else {tokType = T_NUMERIC_APPROX; state = ACCEPT_NOINC;}
         continue;
@@ -291,13 +428,13 @@ bool tokenise(std::string_view& sv, Token& tok)
         ++t;
     case ACCEPT_NOINC: {
         std::string_view::size_type l = t-sv.cbegin();
-        tok = Token(tokType, std::string_view{sv.cbegin(), l});
+        setToken(tok, tokType, std::string_view{sv.cbegin(), l});
         sv.remove_prefix(l);
         return true;
     }
     case ACCEPT_IDENTIFIER: {
         std::string_view::size_type l = t-sv.cbegin();
-        tok = Token(T_IDENTIFIER, std::string_view{sv.cbegin(), l});
+        setToken(tok, T_IDENTIFIER, std::string_view{sv.cbegin(), l});
         sv.remove_prefix(l);
         tokeniseReservedWord(tok);
         return true;
@@ -307,7 +444,8 @@ bool tokenise(std::string_view& sv, Token& tok)
     };
 }
 
-Tokeniser::Tokeniser(std::string_view input0) :
+Tokeniser::Tokeniser(std::string_view input0, std::pmr::memory_resource* resource) :
+    tokens(resource),
     tokp(0),
     input(input0),
     inp(input.cbegin())
@@ -328,7 +466,7 @@ const Token& Tokeniser::nextToken()
     // Don't extend stream of tokens further than the end of stream;
     if ( tokp>0 && tokens[tokp-1].type==T_EOS ) return tokens[tokp-1];
 
-    tokens.push_back(Token());
+    tokens.emplace_back();
     Token& tok = tokens[tokp++];
 
     if (tokenise(input, tok)) return tok;
@@ -22,8 +22,11 @@
  *
  */
 
+#include <deque>
 #include <iosfwd>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <vector>
 
@@ -63,18 +66,40 @@ typedef enum {
     T_GREQ
 } TokenType;
 
+// Tokens keep their text in the memory resource of the vector they're in
 struct Token {
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
     TokenType type;
-    std::string val;
+    std::pmr::string val;
 
     Token()
     {}
 
-    Token(TokenType t, std::string_view v) :
+    explicit Token(const allocator_type& a) :
+        val(a)
+    {}
+
+    Token(TokenType t, std::string_view v, const allocator_type& a = {}) :
         type(t),
-        val(v)
+        val(v, a)
+    {}
+
+    Token(const Token& t, const allocator_type& a) :
+        type(t.type),
+        val(t.val, a)
+    {}
+
+    Token(Token&& t, const allocator_type& a) :
+        type(t.type),
+        val(std::move(t.val), a)
     {}
 
+    Token(const Token&) = default;
+    Token(Token&&) = default;
+    Token& operator=(const Token&) = default;
+    Token& operator=(Token&&) = default;
+
     bool operator==(const Token& r) const
     {
         return
@@ -96,16 +121,19 @@ public:
 SELECTORS_EXPORT
 bool tokenise(std::string_view& sv, Token& tok);
 
+// The tokens are kept in resource: parsing passes a scratch arena. Tokens
+// stay where they are as more are read, so references to them last as long
+// as the Tokeniser.
 class
 Tokeniser {
-    std::vector<Token> tokens;
+    std::pmr::deque<Token> tokens;
     unsigned int tokp;
 
     std::string_view input;
     std::string_view::const_iterator inp;
 
 public:
-    SELECTORS_EXPORT explicit Tokeniser(std::string_view input);
+    SELECTORS_EXPORT explicit Tokeniser(std::string_view input, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
     SELECTORS_EXPORT void returnTokens(unsigned int n = 1);
     SELECTORS_EXPORT const Token& nextToken();
     SELECTORS_EXPORT std::string_view remaining();
@@ -46,6 +46,10 @@ overload(Ts&&...) -> overload<std::remove_reference_t<Ts>...>;
 
 namespace selector {
 
+// Values are copied and stored everywhere: the interned tag mustn't make them
+// any bigger than the variant
+static_assert(sizeof(Value)==sizeof(Value::value));
+
 ostream& operator<<(ostream& os, const Value& v)
 {
     std::visit(overload(
@@ -69,8 +73,26 @@ inline bool promoteNumeric(Value& v1, Value& v2)
     }
 }
 
+// Both strings interned: the same text is the same pointer
+inline bool bothInterned(const Value& v1, const Value& v2)
+{
+    return v1.interned && v2.interned && characters(v1) && characters(v2);
+}
+
+// Strings that are the same text (say two uses of one literal) are equal
+// without comparing their characters
+inline bool sameText(const Value& v1, const Value& v2)
+{
+    if (!characters(v1) || !characters(v2)) return false;
+    auto s1 = get<string_view>(v1.value);
+    auto s2 = get<string_view>(v2.value);
+    return s1.data()==s2.data() && s1.size()==s2.size();
+}
+
 bool operator==(Value v1, Value v2)
 {
+    if (bothInterned(v1, v2)) return get<string_view>(v1.value).data()==get<string_view>(v2.value).data();
+    if (sameText(v1, v2)) return true;
     promoteNumeric(v1, v2);
     if (!sameType(v1,v2)) return false;
 
@@ -79,6 +101,8 @@ bool operator==(Value v1, Value v2)
 
 bool operator!=(Value v1, Value v2)
 {
+    if (bothInterned(v1, v2)) return get<string_view>(v1.value).data()!=get<string_view>(v2.value).data();
+    if (sameText(v1, v2)) return false;
     promoteNumeric(v1, v2);
     if (!sameType(v1,v2)) return false;
 
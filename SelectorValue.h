@@ -43,7 +43,12 @@ enum BoolOrNone : uint8_t {
 // is responsible for managing its lifetime.
 class Value {
 public:
-    std::variant<std::monostate, bool, int64_t, double, std::string_view> value;
+    // The tag below goes in the variant's padding
+    [[no_unique_address]] std::variant<std::monostate, bool, int64_t, double, std::string_view> value;
+    // Whether a string's text is interned (see InternedString::value()): two
+    // interned strings are equal just when they are the same text, so they
+    // compare by pointer
+    bool interned = false;
     // NB: Must keep this in the same order as the variant or strange things will happen
     enum : uint8_t {
         T_UNKNOWN,
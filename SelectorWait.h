@@ -0,0 +1,52 @@
+#ifndef SELECTOR_WAIT_H
+#define SELECTOR_WAIT_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Low latency waiting for threads that hand work to each other through
+// atomic variables: spin briefly, then sleep on a futex (on Linux).
+
+#include <atomic>
+#include <cstdint>
+
+#include "selectors_export.h"
+
+namespace selector {
+
+// A hint to the processor that this thread is spinning
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Sleep while word still holds seen: a wake_all() after word changes always
+// wakes the sleeper, or stops it sleeping at all. May return spuriously.
+SELECTORS_EXPORT void wait_on(std::atomic<uint32_t>& word, uint32_t seen);
+SELECTORS_EXPORT void wake_all(std::atomic<uint32_t>& word);
+
+}
+
+#endif
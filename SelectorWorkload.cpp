@@ -0,0 +1,427 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "SelectorWorkload.h"
+
+#include "SelectorExpression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using std::get;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace selector::workload {
+
+namespace {
+
+enum Kind { STRING, EXACT, INEXACT, FLAG };
+
+Kind kind(size_t identifier)
+{
+    return Kind(identifier % 4);
+}
+
+const char* const PREFIXES[] = {"str", "int", "real", "flag"};
+const char* const SYLLABLES[] = {"ka", "lo", "mi", "ne", "ru", "sa", "to", "vi"};
+
+// Distinct for every k: the syllables are its base 8 digits
+string word(size_t k)
+{
+    string w;
+    do {
+        w += SYLLABLES[k%8];
+        k /= 8;
+    } while (k>0);
+    return w;
+}
+
+// Rounds towards minus infinity unlike /
+int64_t floorDiv(int64_t a, int64_t b)
+{
+    return a/b - (a%b!=0 && (a<0)!=(b<0));
+}
+
+// Inexact literals always have a decimal point so they stay inexact
+string realText(double d)
+{
+    std::ostringstream os;
+    os << std::setprecision(std::numeric_limits<double>::max_digits10) << d;
+    auto s = os.str();
+    if (s.find_first_of(".e")==string::npos) s += ".0";
+    return s;
+}
+
+string quote(string_view s)
+{
+    string q = "'";
+    for (char c : s) {
+        if (c=='\'') q += '\'';
+        q += c;
+    }
+    return q + "'";
+}
+
+template <typename R>
+size_t below(R& rng, size_t n)
+{
+    return n ? rng()%n : 0;
+}
+
+template <typename R>
+bool chance(R& rng, double p)
+{
+    return uniform(rng)<p;
+}
+
+// Pick an index in proportion to its weight
+template <typename R>
+size_t weighted(R& rng, const vector<unsigned>& weights)
+{
+    unsigned total = 0;
+    for (auto w : weights) total += w;
+    auto r = below(rng, total);
+    for (size_t i = 0; i<weights.size(); ++i) {
+        if (r<weights[i]) return i;
+        r -= weights[i];
+    }
+    return 0;
+}
+
+// Every property in b over those in a
+Message merge(const Message& a, const Message& b)
+{
+    Message m = a;
+    for (auto& [name, v] : b.properties) m.set(name, v);
+    return m;
+}
+
+}
+
+Zipf::Zipf(size_t n, double s)
+{
+    double total = 0.0;
+    for (size_t i = 0; i<std::max<size_t>(n, 1); ++i) {
+        total += 1.0/std::pow(double(i+1), s);
+        cdf.push_back(total);
+    }
+    for (auto& c : cdf) c /= total;
+}
+
+void Message::set(const string& name, const Value& v)
+{
+    for (auto& p : properties) {
+        if (p.first==name) {
+            p.second = v;
+            return;
+        }
+    }
+    properties.emplace_back(name, v);
+}
+
+const Value& Message::value(const string_view name) const
+{
+    static const Value EMPTY{};
+    for (auto& p : properties) {
+        if (p.first==name) return p.second;
+    }
+    return EMPTY;
+}
+
+std::ostream& operator<<(std::ostream& os, const Message& m)
+{
+    const char* separator = "";
+    for (auto& [name, v] : m.properties) {
+        if (unknown(v)) continue;
+        os << separator << name << "=";
+        switch (v.type()) {
+        case Value::T_BOOL:    os << (get<bool>(v.value) ? "TRUE" : "FALSE"); break;
+        case Value::T_EXACT:   os << get<int64_t>(v.value); break;
+        case Value::T_INEXACT: os << realText(get<double>(v.value)); break;
+        default:               os << quote(get<string_view>(v.value)); break;
+        }
+        separator = ", ";
+    }
+    return os;
+}
+
+// A piece of selector with a message that makes it true and one that makes it false
+struct Generator::Clause {
+    string text;
+    bool compound = false;
+    Message whenTrue;
+    Message whenFalse;
+
+    string operand() const {
+        return compound ? "(" + text + ")" : text;
+    }
+};
+
+Generator::Generator(uint64_t seed, Vocabulary v) :
+    rng(seed),
+    vocabulary(v),
+    zipf(v.values, v.skew)
+{
+    vocabulary.identifiers = std::max<size_t>(vocabulary.identifiers, 1);
+    vocabulary.values = std::max<size_t>(vocabulary.values, 1);
+    for (size_t i = 0; i<vocabulary.identifiers; ++i) names.push_back(PREFIXES[kind(i)] + std::to_string(i));
+    for (size_t k = 0; k<=vocabulary.values; ++k) words.push_back(word(k));
+}
+
+string_view Generator::keep(string s)
+{
+    texts.push_back(std::move(s));
+    return texts.back();
+}
+
+// The value of rank for a property: low ranks are the most common. Ranks
+// from 0 to values-1 are found in messages, others only where a predicate
+// needs a value that doesn't match.
+Value Generator::value(size_t identifier, int64_t rank) const
+{
+    switch (kind(identifier)) {
+    case STRING:  return string_view{words[std::clamp<int64_t>(rank, 0, vocabulary.values)]};
+    case EXACT:   return rank;
+    case INEXACT: return rank*0.25;
+    default:      return rank%2==0;
+    }
+}
+
+string Generator::literal(size_t identifier, int64_t rank) const
+{
+    switch (kind(identifier)) {
+    case STRING:  return quote(words[std::clamp<int64_t>(rank, 0, vocabulary.values)]);
+    case EXACT:   return std::to_string(rank);
+    case INEXACT: return realText(rank*0.25);
+    default:      return rank%2==0 ? "TRUE" : "FALSE";
+    }
+}
+
+Generator::Clause Generator::predicate(const SelectorOptions& o, vector<bool>& used)
+{
+    enum { EQUALITY, COMPARISON, IN, LIKE, BETWEEN, NULLS, ARITHMETIC, BOOLEAN };
+    // The kinds of property each kind of predicate can use
+    const vector<vector<Kind>> suits{
+        {STRING, EXACT, INEXACT, FLAG}, {EXACT, INEXACT}, {STRING, EXACT}, {STRING},
+        {EXACT, INEXACT}, {STRING, EXACT, INEXACT, FLAG}, {EXACT}, {FLAG}};
+    auto p = weighted(rng, {o.equality, o.comparison, o.in, o.like, o.between, o.null, o.arithmetic, o.boolean});
+
+    auto candidates = [&](const vector<Kind>& kinds, bool unused) {
+        vector<size_t> c;
+        for (size_t i = 0; i<names.size(); ++i) {
+            if ((!unused || !used[i]) && std::find(kinds.begin(), kinds.end(), kind(i))!=kinds.end()) c.push_back(i);
+        }
+        return c;
+    };
+    auto c = candidates(suits[p], true);
+    if (c.empty()) {
+        // Any unused property can be tested for equality
+        c = candidates(suits[EQUALITY], true);
+        if (c.empty()) c = candidates(suits[p], false);
+        else p = EQUALITY;
+        if (c.empty()) {
+            c = candidates(suits[EQUALITY], false);
+            p = EQUALITY;
+        }
+    }
+    auto id = c[below(rng, c.size())];
+    used[id] = true;
+    auto& name = names[id];
+    int64_t r = zipf(rng);
+
+    Clause cl;
+    auto truth = [&](const Value& t, const Value& f) {
+        cl.whenTrue.set(name, t);
+        cl.whenFalse.set(name, f);
+    };
+    // One in four predicates that can be are the negative form
+    bool negative = below(rng, 4)==0;
+
+    switch (p) {
+    case EQUALITY:
+        cl.text = name + (negative ? " <> " : " = ") + literal(id, r);
+        truth(value(id, r), value(id, r+1));
+        break;
+    case COMPARISON: {
+        static const char* const OPS[] = {" < ", " > ", " <= ", " >= "};
+        auto op = below(rng, 4);
+        cl.text = name + OPS[op] + literal(id, r);
+        switch (op) {
+        case 0:  truth(value(id, r-1), value(id, r)); break;
+        case 1:  truth(value(id, r+1), value(id, r)); break;
+        case 2:  truth(value(id, r), value(id, r+1)); break;
+        default: truth(value(id, r), value(id, r-1)); break;
+        }
+        negative = false;
+        break;
+    }
+    case IN: {
+        auto n = o.inMin + below(rng, o.inMax>o.inMin ? o.inMax-o.inMin+1 : 1);
+        n = std::max<size_t>(n, 1);
+        cl.text = name + (negative ? " NOT IN (" : " IN (");
+        for (size_t i = 0; i<n; ++i) {
+            cl.text += (i ? ", " : "") + literal(id, i==0 ? r : zipf(rng));
+        }
+        cl.text += ")";
+        truth(value(id, r), value(id, vocabulary.values));
+        break;
+    }
+    case LIKE: {
+        const string& w = words[r];
+        string pattern;
+        string matching = w;
+        string escape;
+        switch (weighted(rng, {o.prefix, o.suffix, o.contains, o.single, o.escaped})) {
+        case 0: pattern = w.substr(0, 2) + "%"; break;
+        case 1: pattern = "%" + w.substr(w.size()-2); break;
+        case 2: pattern = "%" + w.substr(w.size()/2-1, 2) + "%"; break;
+        case 3: pattern = w; pattern[w.size()/2] = '_'; break;
+        default:
+            pattern = w.substr(0, 2) + "\\_%";
+            escape = " ESCAPE '\\'";
+            matching = w.substr(0, 2) + "_";
+            break;
+        }
+        cl.text = name + (negative ? " NOT LIKE " : " LIKE ") + quote(pattern) + escape;
+        truth(keep(matching), string_view{words[0]}.substr(0, 0));
+        break;
+    }
+    case BETWEEN: {
+        int64_t upper = r + below(rng, vocabulary.values/10+1);
+        cl.text = name + (negative ? " NOT BETWEEN " : " BETWEEN ") + literal(id, r) + " AND " + literal(id, upper);
+        truth(value(id, r), value(id, upper+1));
+        break;
+    }
+    case NULLS:
+        cl.text = name + (negative ? " IS NOT NULL" : " IS NULL");
+        truth(Value{}, value(id, r));
+        break;
+    case ARITHMETIC: {
+        if (below(rng, 2)) {
+            int64_t k = 1 + below(rng, 9);
+            int64_t d = zipf(rng);
+            cl.text = name + " * " + std::to_string(k) + " + " + std::to_string(r) + " > " + std::to_string(d);
+            auto t = floorDiv(d-r, k);
+            truth(t+1, t);
+        } else {
+            int64_t d = zipf(rng);
+            cl.text = name + " - " + std::to_string(r) + " < " + std::to_string(d);
+            truth(r+d-1, r+d);
+        }
+        negative = false;
+        break;
+    }
+    default:
+        cl.text = name;
+        truth(true, false);
+        negative = false;
+        break;
+    }
+    if (negative) std::swap(cl.whenTrue, cl.whenFalse);
+    return cl;
+}
+
+Generator::Clause Generator::clause(const SelectorOptions& o, unsigned depth, vector<bool>& used)
+{
+    Clause cl;
+    if (depth>0 && chance(rng, o.nesting)) {
+        auto a = clause(o, depth-1, used);
+        auto b = clause(o, depth-1, used);
+        cl.compound = true;
+        if (below(rng, 3)) {
+            cl.text = a.operand() + " AND " + b.operand();
+            cl.whenTrue = merge(a.whenTrue, b.whenTrue);
+            cl.whenFalse = merge(a.whenFalse, b.whenTrue);
+        } else {
+            cl.text = a.operand() + " OR " + b.operand();
+            cl.whenTrue = merge(a.whenTrue, b.whenFalse);
+            cl.whenFalse = merge(a.whenFalse, b.whenFalse);
+        }
+    } else {
+        cl = predicate(o, used);
+    }
+    if (chance(rng, o.negation)) {
+        cl.text = "NOT (" + cl.text + ")";
+        cl.compound = false;
+        std::swap(cl.whenTrue, cl.whenFalse);
+    }
+    return cl;
+}
+
+// A predicate using a property more than once can leave the matching
+// message wrong so it is checked, and the selector remade if it's wrong
+Selector Generator::selector(const SelectorOptions& o)
+{
+    Selector s;
+    for (int attempt = 0; attempt<100 && !s.witnessed; ++attempt) {
+        vector<bool> used(names.size());
+        auto cl = clause(o, o.depth, used);
+        s.text = std::move(cl.text);
+        s.witness = std::move(cl.whenTrue);
+        s.witnessed = eval(*make_selector(s.text), s.witness);
+    }
+    return s;
+}
+
+vector<Selector> Generator::selectors(size_t n, const SelectorOptions& o)
+{
+    vector<Selector> v;
+    v.reserve(n);
+    for (size_t i = 0; i<n; ++i) v.push_back(selector(o));
+    return v;
+}
+
+Message Generator::message(const MessageOptions& o)
+{
+    Message m;
+    for (size_t i = 0; i<names.size(); ++i) {
+        if (chance(rng, o.present)) m.set(names[i], value(i, zipf(rng)));
+    }
+    return m;
+}
+
+vector<Message> Generator::messages(size_t n, const vector<Selector>& selectors, const MessageOptions& o)
+{
+    vector<Message> v;
+    v.reserve(n);
+    for (size_t i = 0; i<n; ++i) {
+        v.push_back(message(o));
+        if (selectors.empty() || !chance(rng, o.matchRate)) continue;
+        auto& s = selectors[below(rng, selectors.size())];
+        if (s.witnessed) v.back() = merge(v.back(), s.witness);
+    }
+    return v;
+}
+
+}
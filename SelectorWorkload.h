@@ -0,0 +1,186 @@
+#ifndef SELECTOR_WORKLOAD_H
+#define SELECTOR_WORKLOAD_H
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Synthetic selectors and messages for benchmarks and tests: this is not
+// part of the library
+
+#include "SelectorEnv.h"
+#include "SelectorValue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iosfwd>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace selector::workload {
+
+// Everything is drawn from this so a seed gives the same workload everywhere
+using Random = std::mt19937_64;
+
+// Uniform in [0, 1): unlike std::uniform_real_distribution this is the same
+// for every standard library
+template <typename R>
+double uniform(R& rng)
+{
+    return double(rng()-R::min()) / (double(R::max()-R::min()) + 1.0);
+}
+
+// Draws 0..n-1 with probability proportional to 1/(i+1)^s: s=0 is uniform
+class Zipf {
+    std::vector<double> cdf;
+
+public:
+    Zipf(std::size_t n, double s);
+
+    template <typename R>
+    std::size_t operator()(R& rng) const {
+        auto u = uniform(rng);
+        std::size_t lo = 0;
+        std::size_t hi = cdf.size()-1;
+        while (lo<hi) {
+            auto mid = (lo+hi)/2;
+            if (cdf[mid]<=u) lo = mid+1;
+            else hi = mid;
+        }
+        return lo;
+    }
+};
+
+// The properties messages have and the values they take
+struct Vocabulary {
+    // Properties are named str0, int1, real2, flag3, str4... cycling through
+    // string, exact, inexact and boolean values
+    std::size_t identifiers = 16;
+    std::size_t values = 1000;  // Distinct values of each property
+    double skew = 1.0;          // Zipf exponent of values in messages and selectors
+};
+
+// Choices made building a selector: kinds of predicate are picked in
+// proportion to their weights
+struct SelectorOptions {
+    unsigned equality = 6;    // = and <>
+    unsigned comparison = 4;  // < > <= >=
+    unsigned in = 2;          // IN and NOT IN
+    unsigned like = 2;        // LIKE and NOT LIKE
+    unsigned between = 1;     // BETWEEN and NOT BETWEEN
+    unsigned null = 1;        // IS NULL and IS NOT NULL
+    unsigned arithmetic = 1;
+    unsigned boolean = 1;     // A bare boolean property
+
+    std::size_t inMin = 2;    // Size of IN lists
+    std::size_t inMax = 8;
+
+    // Shapes of LIKE pattern: 'ab%', '%ab', '%ab%', 'a_c' and 'ab\_%' ESCAPE '\'
+    unsigned prefix = 4;
+    unsigned suffix = 2;
+    unsigned contains = 2;
+    unsigned single = 1;
+    unsigned escaped = 1;
+
+    unsigned depth = 3;       // Most levels of AND and OR
+    double nesting = 0.5;     // Chance of an AND or OR at each level
+    double negation = 0.1;    // Chance of a NOT around any clause
+};
+
+struct MessageOptions {
+    double present = 0.8;     // Chance of each property being set
+    double matchRate = 0.0;   // Fraction of messages built to match one of the selectors
+};
+
+// A property name and value: an unknown value means the property is absent
+using Properties = std::vector<std::pair<std::string, Value>>;
+
+// String values refer to text owned by the Generator that made them
+class Message : public Env {
+public:
+    Properties properties;
+
+    void set(const std::string& name, const Value& v);
+
+    const Value& value(const std::string_view name) const override;
+};
+
+// Properties as name=value, name=value... with strings quoted as in a selector
+std::ostream& operator<<(std::ostream&, const Message&);
+
+struct Selector {
+    std::string text;
+    bool witnessed = false; // Whether witness is known to match
+    Message witness;        // Sets every property the selector uses
+};
+
+/**
+ * Generates selectors following the grammar in SelectorExpression.cpp and
+ * messages to match against them.
+ *
+ * Everything a generator produces is determined by its seed, its vocabulary
+ * and the sequence of calls made.
+ *
+ * Each selector comes with a message that matches it, which is how messages
+ * are built to give a chosen match rate. A selector avoids using any property
+ * twice while it can so that such a message can be found.
+ */
+class Generator {
+    Random rng;
+    Vocabulary vocabulary;
+    Zipf zipf;
+    std::vector<std::string> names;
+    std::vector<std::string> words;   // String values: words[vocabulary.values] is never in a message
+    std::deque<std::string> texts;    // Other strings values refer to
+
+    struct Clause;
+    Clause clause(const SelectorOptions&, unsigned depth, std::vector<bool>& used);
+    Clause predicate(const SelectorOptions&, std::vector<bool>& used);
+    Value value(std::size_t identifier, int64_t rank) const;
+    std::string literal(std::size_t identifier, int64_t rank) const;
+    std::string_view keep(std::string);
+
+public:
+    explicit Generator(uint64_t seed, Vocabulary = {});
+
+    Generator(const Generator&) = delete;
+    Generator& operator=(const Generator&) = delete;
+
+    const std::vector<std::string>& identifiers() const {
+        return names;
+    }
+
+    Selector selector(const SelectorOptions& = {});
+    std::vector<Selector> selectors(std::size_t n, const SelectorOptions& = {});
+
+    Message message(const MessageOptions& = {});
+
+    // A matchRate fraction of these messages are built to match a selector
+    // picked at random: the actual rate will be higher as others match by chance
+    std::vector<Message> messages(std::size_t n, const std::vector<Selector>&, const MessageOptions& = {});
+};
+
+}
+
+#endif
@@ -0,0 +1,580 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Benchmarks for matching many messages against many selectors
+//
+// Usage: selector_bench [--counters] [set messages selectors | churn readers | parallel selectors | pipeline selectors | eval | tokenise selectors | compile selectors]
+// With no arguments runs every benchmark over a range of sizes. --counters
+// adds hardware event counts per operation where the system allows it.
+
+#include "SelectorAllocations.h"
+#include "SelectorBench.h"
+#include "SelectorCompile.h"
+#include "SelectorConcurrent.h"
+#include "SelectorEnv.h"
+#include "SelectorExpression.h"
+#include "SelectorIntern.h"
+#include "SelectorJson.h"
+#include "SelectorParallel.h"
+#include "SelectorPipeline.h"
+#include "SelectorSet.h"
+#include "SelectorShape.h"
+#include "SelectorToken.h"
+#include "SelectorValue.h"
+
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::unique_ptr;
+using std::vector;
+
+using namespace selector;
+using namespace std::literals;
+
+namespace {
+
+const vector<string> regions{"eu", "eu-west", "us", "us-east", "asia", "apac", "latam", "africa"};
+const vector<string> types{"order", "quote", "trade", "cancel"};
+
+class MessageEnv : public Env {
+    std::unordered_map<string_view, Value> properties;
+
+public:
+    void set(string_view name, const Value& v) {
+        properties[name] = v;
+    }
+
+    const Value& value(const string_view name) const override {
+        static const Value EMPTY{};
+        auto i = properties.find(name);
+        return i==properties.end() ? EMPTY : i->second;
+    }
+};
+
+struct Workload {
+    vector<string> customers;
+    vector<MessageEnv> envs;
+    vector<const Env*> messages;
+    vector<unique_ptr<Expression>> selectors;
+};
+
+void makeMessages(Workload& w, size_t n, std::mt19937& rng)
+{
+    for (int c = 0; c<1000; ++c) w.customers.push_back("c" + std::to_string(c));
+    auto pick = [&](const vector<string>& v) -> string_view { return v[rng()%v.size()]; };
+    w.envs.resize(n);
+    for (auto& env : w.envs) {
+        env.set("region", pick(regions));
+        env.set("type", pick(types));
+        env.set("priority", int64_t(rng()%10));
+        env.set("size", int64_t(rng()%10000));
+        env.set("price", (rng()%100000)/100.0);
+        if (rng()%4) env.set("customer", pick(w.customers));
+        if (rng()%2) env.set("urgent", rng()%8==0);
+        w.messages.push_back(&env);
+    }
+}
+
+string selectorText(const Workload& w, std::mt19937& rng)
+{
+    auto pick = [&](const vector<string>& v) { return "'" + v[rng()%v.size()] + "'"; };
+    auto number = [&](unsigned limit) { return std::to_string(rng()%limit); };
+    switch (rng()%7) {
+    case 0: return "region = " + pick(regions);
+    case 1: return "priority > " + number(10) + " AND type = " + pick(types);
+    case 2: return "type IN (" + pick(types) + ", " + pick(types) + ") AND size < " + number(10000);
+    case 3: return "customer = " + pick(w.customers) + " OR urgent";
+    case 4: return "price BETWEEN " + number(500) + " AND " + number(1000);
+    case 5: return "region LIKE '" + regions[rng()%regions.size()].substr(0, 2) + "%' AND priority >= " + number(10);
+    default: return "size > " + number(10000) + " AND NOT urgent";
+    }
+}
+
+void makeSelectors(Workload& w, size_t m, std::mt19937& rng)
+{
+    for (size_t i = 0; i<m; ++i) {
+        w.selectors.emplace_back(make_selector(selectorText(w, rng)));
+    }
+}
+
+void benchmark(size_t n, size_t m)
+{
+    std::mt19937 rng{42};
+    Workload w;
+    makeMessages(w, n, rng);
+    makeSelectors(w, m, rng);
+    SelectorSet set;
+    for (auto& e : w.selectors) set.add(*e);
+
+    std::cout << n << " messages x " << m << " selectors\n";
+    size_t pairs = n*m;
+    size_t matched = 0;
+    std::cout << bench::run("  each pair", pairs, [&] {
+        matched = 0;
+        for (auto env : w.messages) {
+            for (auto& e : w.selectors) matched += eval(*e, *env);
+        }
+    }) << "\n";
+    MatchMatrix result;
+    std::cout << bench::run("  set, single block", pairs, [&] {
+        set.match(w.messages, result, Tiling{n, m});
+    }) << "\n";
+    std::cout << bench::run("  set, tiled", pairs, [&] {
+        set.match(w.messages, result);
+    }) << "\n";
+    std::cout << "  matched " << matched << " pairs\n";
+
+    bench::AllocationCounter allocations;
+    for (auto env : w.messages) {
+        for (auto& e : w.selectors) eval(*e, *env);
+    }
+    std::cout << "  " << std::setprecision(3) << double(allocations.count())/pairs << " allocations per pair\n";
+}
+
+// A selector set shared by matching threads with a global lock
+class LockedSet {
+    std::mutex lock;
+    vector<std::pair<ConcurrentSelectorSet::Id, unique_ptr<Expression>>> selectors;
+    ConcurrentSelectorSet::Id nextId = 0;
+
+public:
+    ConcurrentSelectorSet::Id subscribe(unique_ptr<Expression> e) {
+        std::lock_guard<std::mutex> l{lock};
+        selectors.emplace_back(nextId, std::move(e));
+        return nextId++;
+    }
+
+    void unsubscribe(ConcurrentSelectorSet::Id id) {
+        std::lock_guard<std::mutex> l{lock};
+        selectors.erase(std::find_if(selectors.begin(), selectors.end(), [=](auto& s) { return s.first==id; }));
+    }
+
+    void match(const Env& env, vector<ConcurrentSelectorSet::Id>& matched) {
+        std::lock_guard<std::mutex> l{lock};
+        matched.clear();
+        for (auto& [id, e] : selectors) {
+            if (eval(*e, env)) matched.push_back(id);
+        }
+    }
+};
+
+// Match throughput of several readers while a writer keeps replacing the
+// oldest selector (if churning) for a fixed time
+template <typename Set, typename Match>
+void churnRun(const string& name, const Workload& w, Set& set, size_t readers, bool churning, Match match)
+{
+    const auto duration = std::chrono::milliseconds(500);
+    std::mt19937 rng{7};
+    vector<ConcurrentSelectorSet::Id> live;
+    for (size_t i = 0; i<w.selectors.size(); ++i) live.push_back(set.subscribe(make_selector(selectorText(w, rng))));
+    std::atomic<bool> done{false};
+    std::atomic<size_t> matches{0};
+    vector<std::thread> threads;
+    for (size_t r = 0; r<readers; ++r) {
+        threads.emplace_back([&, r] {
+            auto f = match(set);
+            vector<ConcurrentSelectorSet::Id> matched;
+            size_t n = 0;
+            for (size_t i = r; !done; ++i, ++n) {
+                f(*w.messages[i%w.messages.size()], matched);
+            }
+            matches += n;
+        });
+    }
+
+    size_t updates = 0;
+    auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now()<end) {
+        if (!churning) {
+            std::this_thread::sleep_for(duration/10);
+            continue;
+        }
+        set.unsubscribe(live[updates%live.size()]);
+        live[updates%live.size()] = set.subscribe(make_selector(selectorText(w, rng)));
+        ++updates;
+    }
+    done = true;
+    for (auto& t : threads) t.join();
+
+    double seconds = std::chrono::duration<double>(duration).count();
+    std::cout << "  " << std::left << std::setw(38) << name << std::right << std::fixed << std::setprecision(0)
+              << std::setw(12) << matches/seconds << " matches/s"
+              << std::setw(10) << updates/seconds << " updates/s\n";
+}
+
+void churn(size_t readers)
+{
+    std::mt19937 rng{42};
+    Workload w;
+    makeMessages(w, 1000, rng);
+    makeSelectors(w, 1000, rng);
+
+    std::cout << readers << " readers x 1000 selectors\n";
+    for (bool churning : {false, true}) {
+        string suffix = churning ? ", churning" : ", stable";
+        {
+            ConcurrentSelectorSet set;
+            churnRun("concurrent set" + suffix, w, set, readers, churning, [](ConcurrentSelectorSet& s) {
+                return [reader = std::make_shared<ConcurrentSelectorSet::Reader>(s)](const Env& env, auto& matched) {
+                    reader->match(env, matched);
+                };
+            });
+        }
+        {
+            LockedSet set;
+            churnRun("global lock" + suffix, w, set, readers, churning, [](LockedSet& s) {
+                return [&s](const Env& env, auto& matched) { s.match(env, matched); };
+            });
+        }
+    }
+}
+
+// Latency of matching one message at a time against a large set as the
+// number of threads sharing the work grows
+void parallel(size_t m)
+{
+    std::mt19937 rng{42};
+    Workload w;
+    // Enough messages for a meaningful p99 without taking too long
+    makeMessages(w, std::clamp<size_t>(10000000/std::max<size_t>(m, 1), 200, 2000), rng);
+    makeSelectors(w, m, rng);
+    vector<const Expression*> list;
+    for (auto& e : w.selectors) list.push_back(e.get());
+
+    std::cout << "1 message x " << m << " selectors\n";
+    size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+    vector<size_t> counts{1};
+    for (size_t t = 2; t<=std::max<size_t>(cores, 4); t *= 2) counts.push_back(t);
+    vector<size_t> matched;
+    for (auto threads : counts) {
+        ParallelMatcher matcher{list, threads};
+        bench::Latencies latencies;
+        for (size_t i = 0; i<10; ++i) matcher.match(*w.messages[i], matched); // Warm up
+        for (auto env : w.messages) latencies.time([&] { matcher.match(*env, matched); });
+        std::cout << "  " << std::left << std::setw(38) << std::to_string(threads) + " threads" << std::right
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(12) << latencies.percentile(0.5)/1000 << " us p50"
+                  << std::setw(12) << latencies.percentile(0.99)/1000 << " us p99\n";
+    }
+    std::cout << "  (" << cores << " cores)\n";
+}
+
+// Compiling a large subscription set at startup as the number of threads grows
+void compile(size_t m)
+{
+    std::mt19937 rng{42};
+    Workload w;
+    makeMessages(w, 1, rng);
+    vector<string> texts;
+    for (size_t i = 0; i<m; ++i) texts.push_back(selectorText(w, rng));
+    vector<string_view> views(texts.begin(), texts.end());
+    std::unordered_map<string_view, size_t> distinct;
+    for (auto t : views) ++distinct[t];
+
+    std::cout << "compile " << m << " selectors (" << distinct.size() << " distinct)\n";
+    std::cout << bench::run("  make_selector each", m, [&] {
+        for (auto t : views) make_selector(t);
+    }, 1) << "\n";
+    std::cout << bench::run("  make_arena_selector each", m, [&] {
+        for (auto t : views) make_arena_selector(t);
+    }, 1) << "\n";
+    std::cout << bench::run("  make_selector into one arena", m, [&] {
+        std::pmr::monotonic_buffer_resource arena;
+        for (auto t : views) make_selector(t, &arena);
+    }, 1) << "\n";
+    size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+    for (size_t threads = 1; threads<=std::max<size_t>(cores, 4); threads *= 2) {
+        std::cout << bench::run("  " + std::to_string(threads) + " threads, heap", m, [&] {
+            compile_selectors(views, threads, std::pmr::new_delete_resource());
+        }, 1) << "\n";
+        std::cout << bench::run("  " + std::to_string(threads) + " threads, arenas", m, [&] {
+            compile_selectors(views, threads);
+        }, 1) << "\n";
+    }
+    std::cout << "  (" << cores << " cores)\n";
+}
+
+// Tokenising alone, per byte of selector text
+void tokenise(size_t m)
+{
+    std::mt19937 rng{42};
+    Workload w;
+    makeMessages(w, 1, rng);
+    vector<string> texts;
+    size_t bytes = 0;
+    for (size_t i = 0; i<m; ++i) {
+        texts.push_back(selectorText(w, rng));
+        bytes += texts.back().size();
+    }
+    auto all = [&](const vector<string>& ts) {
+        size_t tokens = 0;
+        for (auto& t : ts) {
+            Tokeniser tokeniser{t};
+            while (tokeniser.nextToken().type!=T_EOS) ++tokens;
+        }
+        return tokens;
+    };
+    std::cout << "tokenise, ns per byte\n";
+    std::cout << bench::run("  " + std::to_string(m) + " selectors", bytes, [&] { all(texts); }) << "\n";
+
+    string in = "customer_region NOT IN (";
+    for (int i = 0; i<5000; ++i) in += (i ? ", 'customer''s account " : "'customer''s account ") + std::to_string(i) + "'";
+    in += ")   AND   quite_a_long_identifier_name   IS   NOT   NULL";
+    vector<string> big{in};
+    std::cout << bench::run("  IN list of 5000 strings", in.size(), [&] { all(big); }) << "\n";
+}
+
+// An environment as cheap as it can be, so the cost of calling into the
+// library dominates
+class FieldEnv final : public Env {
+    Value a{int64_t(7)};
+    Value b{"x"sv};
+    Value c{true};
+
+public:
+    FieldEnv() = default;
+
+    explicit FieldEnv(const Value& b0) :
+        b(b0)
+    {}
+
+    const Value& value(const string_view name) const override {
+        static const Value EMPTY{};
+        if (name.size()!=1) return EMPTY;
+        switch (name[0]) {
+        case 'a': return a;
+        case 'b': return b;
+        case 'c': return c;
+        default:  return EMPTY;
+        }
+    }
+};
+
+// Evaluating small selectors one call at a time: selector_bench_static runs
+// this against the library built as one static translation unit, which link
+// time optimisation can inline into the loop
+void single()
+{
+#ifdef SELECTORS_STATIC_DEFINE
+    std::cout << "single evaluations, static library\n";
+#else
+    std::cout << "single evaluations, shared library\n";
+#endif
+    FieldEnv env;
+    const size_t n = 1000000;
+    for (auto text : {"c", "a = 7", "a > 5 AND b = 'x'", "a BETWEEN 1 AND 10 OR d IS NULL", "b LIKE 'x%'"}) {
+        auto e = make_selector(text);
+        size_t matched = 0;
+        std::cout << bench::run("  "s + text, n, [&] {
+            for (size_t i = 0; i<n; ++i) matched += eval(*e, env);
+        }) << "\n";
+        if (matched==0) std::cout << "  (no matches)\n";
+    }
+}
+
+// An IN list of strings of the same length and prefix matched by a value
+// that is interned, as selector_value_string() makes them, or not: interned
+// values compare with the interned literals by pointer
+void strings()
+{
+    std::cout << "string IN list of 64\n";
+    string in;
+    for (int i = 0; i<64; ++i) in += (i ? ", 'customer-" : "'customer-") + std::to_string(100000+i) + "'";
+    auto e = make_selector("b IN (" + in + ")");
+    const size_t n = 1000000;
+    for (auto [name, text] : {std::pair{"last", "customer-100063"}, std::pair{"absent", "customer-200000"}}) {
+        for (bool interned : {false, true}) {
+            string copy{text};
+            InternedString t{text};
+            FieldEnv env{interned ? t.value() : Value{string_view{copy}}};
+            size_t matched = 0;
+            std::cout << bench::run("  "s + name + (interned ? ", interned" : ""), n, [&] {
+                for (size_t i = 0; i<n; ++i) matched += eval(*e, env);
+            }) << "\n";
+        }
+    }
+}
+
+// Messages of four shapes against a selector with a term for each: the
+// shape decides two of them outright and leaves one term of the others
+void shapes()
+{
+    std::cout << "shape specialised evaluation\n";
+    auto e = make_selector("(region = 'eu' AND price > 100) OR (customer IS NOT NULL AND type IN ('order', 'quote'))"
+                           " OR (priority > 5 AND urgent) OR (region LIKE 'us%' AND type = 'trade')");
+    vector<MessageEnv> envs(4);
+    envs[0].set("region", "eu"sv);
+    envs[0].set("price", 150);
+    envs[1].set("customer", "c1"sv);
+    envs[1].set("type", "trade"sv);
+    envs[2].set("priority", 3);
+    envs[3].set("price", 150);
+    const size_t n = 1000000;
+    size_t matched = 0;
+    std::cout << bench::run("  whole expression", n, [&] {
+        for (size_t i = 0; i<n; ++i) matched += eval(*e, envs[i%4]);
+    }) << "\n";
+    ShapeEval shaped(*e);
+    std::cout << bench::run("  specialised", n, [&] {
+        for (size_t i = 0; i<n; ++i) matched += shaped.eval(envs[i%4]);
+    }) << "\n";
+    if (matched==0) std::cout << "  (no matches)\n";
+}
+
+// Evaluating against a JSON message of 40 members, with a new env for each
+// evaluation as for a stream of messages: lookups only scan as far as the
+// members they need, against scanning the whole object first
+void json()
+{
+    std::cout << "JSON message env\n";
+    string text = R"({"type": "order", "region": "eu-west", "price": 101.25)";
+    for (int i = 0; i<36; ++i) {
+        text += ", \"field" + std::to_string(i) + "\": ";
+        text += i%3==0 ? "{\"nested\": [1, 2, {\"x\": \"}\"}]}" : i%3==1 ? "\"some \\\"quoted\\\" text\"" : "12345";
+    }
+    text += R"(, "customer": "customer-100063"})";
+    const size_t n = 200000;
+    for (auto [name, selector, whole] : {std::tuple{"first members", "type = 'order' AND region LIKE 'eu%'", false},
+                                         std::tuple{"last member", "customer = 'customer-100063'", false},
+                                         std::tuple{"whole object scanned", "type = 'order' AND region LIKE 'eu%'", true}}) {
+        auto e = make_selector(selector);
+        size_t matched = 0;
+        std::cout << bench::run("  "s + name, n, [&] {
+            for (size_t i = 0; i<n; ++i) {
+                JsonEnv env{text};
+                if (whole) env.complete();
+                matched += eval(*e, env);
+            }
+        }) << "\n";
+        if (matched==0) std::cout << "  (no matches)\n";
+    }
+}
+
+// Throughput of a filtering stage between a producer and a consumer thread
+void pipeline(size_t m)
+{
+    std::mt19937 rng{42};
+    Workload w;
+    makeMessages(w, 200000, rng);
+    makeSelectors(w, m, rng);
+    SelectorSet set;
+    for (auto& e : w.selectors) set.add(*e);
+
+    std::cout << "pipeline x " << m << " selectors\n";
+    for (auto mode : {WaitMode::BLOCK, WaitMode::BUSY_POLL}) {
+        for (size_t batch : {1, 16, 64}) {
+            SpscRing<const Env*> in{1024};
+            SpscRing<Delivery> out{1024};
+            FilterStage stage{set, in, out, StageOptions{batch, mode}};
+            auto start = std::chrono::steady_clock::now();
+            std::thread producer{[&] {
+                for (auto env : w.messages) in.push(env, mode);
+                in.close();
+            }};
+            std::thread filter{[&] { stage.run(); }};
+            Delivery d[256];
+            while (out.pop(d, 256, mode)) {}
+            producer.join();
+            filter.join();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+            auto& c = stage.counters();
+            string name = string(mode==WaitMode::BLOCK ? "blocking" : "busy poll") + ", batch " + std::to_string(batch);
+            std::cout << "  " << std::left << std::setw(38) << name << std::right << std::fixed << std::setprecision(0)
+                      << std::setw(12) << c.messages/seconds << " msgs/s"
+                      << std::setw(12) << c.deliveries/seconds << " deliveries/s"
+                      << std::setw(10) << c.inputEmpty << " empty"
+                      << std::setw(10) << c.outputFull << " full\n";
+        }
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc>1 && argv[1]==string("--counters")) {
+        bench::countEvents = true;
+        --argc;
+        ++argv;
+    }
+    string mode = argc>1 ? argv[1] : "";
+    if (mode=="set" && argc==4) {
+        benchmark(std::strtoul(argv[2], nullptr, 10), std::strtoul(argv[3], nullptr, 10));
+    } else if (mode=="churn" && argc==3) {
+        churn(std::strtoul(argv[2], nullptr, 10));
+    } else if (mode=="parallel" && argc==3) {
+        parallel(std::strtoul(argv[2], nullptr, 10));
+    } else if (mode=="pipeline" && argc==3) {
+        pipeline(std::strtoul(argv[2], nullptr, 10));
+    } else if (mode=="compile" && argc==3) {
+        compile(std::strtoul(argv[2], nullptr, 10));
+    } else if (mode=="tokenise" && argc==3) {
+        tokenise(std::strtoul(argv[2], nullptr, 10));
+    } else if (mode=="eval" && argc==2) {
+        single();
+        strings();
+        shapes();
+        json();
+    } else if (argc==1) {
+        for (auto [n, m] : vector<std::pair<size_t, size_t>>{{100000, 20}, {20000, 100}, {2000, 1000}, {200, 10000}, {50, 50000}}) {
+            benchmark(n, m);
+        }
+        for (size_t r : {1, 2, 4}) {
+            churn(r);
+        }
+        for (size_t m : {10000, 100000}) {
+            parallel(m);
+        }
+        for (size_t m : {1, 20}) {
+            pipeline(m);
+        }
+        single();
+        strings();
+        shapes();
+        json();
+        tokenise(100000);
+        compile(100000);
+    } else {
+        std::cerr << "Usage: " << argv[0] << " [--counters] [set messages selectors | churn readers | parallel selectors | pipeline selectors | eval | tokenise selectors | compile selectors]\n";
+        return 1;
+    }
+}
@@ -1,14 +1,201 @@
 #include "selectors.h"
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#if defined(__GLIBC__) && (__GLIBC__>2 || (__GLIBC__==2 && __GLIBC_MINOR__>=33))
+#include <malloc.h>
+#define HAVE_MALLINFO2
+#endif
 
 #ifdef READLINE
 #include <readline/readline.h>
 #include <readline/history.h>
 #endif
 
+// Environments loaded by \\l: timing and profiling cycle through these, or
+// use the current environment if there are none
+static selector_environment_t** loaded = NULL;
+static size_t loadedCount = 0;
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+static int compareDouble(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x>y) - (x<y);
+}
+
+// An optional repeat count before an expression, ended by a colon as an
+// expression may itself start with a number: "1000: a > 1"
+static size_t count(const char** str, size_t def)
+{
+    const char* p = *str;
+    while (isspace((unsigned char)*p)) ++p;
+    if (!isdigit((unsigned char)*p)) return def;
+    char* end;
+    size_t n = strtoull(p, &end, 10);
+    while (isspace((unsigned char)*end)) ++end;
+    if (*end!=':') return def;
+    *str = end+1;
+    return n ? n : def;
+}
+
+static const selector_environment_t* const* environments(const selector_environment_t** current, size_t* n)
+{
+    if (loadedCount==0) {
+        *n = 1;
+        return current;
+    }
+    *n = loadedCount;
+    return (const selector_environment_t* const*)loaded;
+}
+
+// Mean time of n evaluations, then the distribution of the time of each
+static void timeEval(const char* str, const selector_environment_t* env, size_t n)
+{
+    const selector_expression_t* exp = selector_expression(str);
+    if (!exp) return;
+    size_t envCount;
+    const selector_environment_t* const* envs = environments(&env, &envCount);
+
+    size_t matched = 0;
+    for (size_t i = 0; i<n && i<1000; ++i) matched += selector_expression_eval(exp, envs[i%envCount]);
+    matched = 0;
+    double start = now();
+    for (size_t i = 0; i<n; ++i) matched += selector_expression_eval(exp, envs[i%envCount]);
+    double mean = (now()-start)/n;
+
+    double* ns = malloc(n*sizeof(double));
+    for (size_t i = 0; i<n; ++i) {
+        double s = now();
+        selector_expression_eval(exp, envs[i%envCount]);
+        ns[i] = now()-s;
+    }
+    qsort(ns, n, sizeof(double), compareDouble);
+#define PERCENTILE(p) ns[(size_t)((p)*(n-1) + 0.5)]
+    printf("%zu evaluations over %zu environment(s), %zu true\n", n, envCount, matched);
+    printf("mean %.1f ns/eval\n", mean);
+    printf("p50 %.0f  p90 %.0f  p99 %.0f  p99.9 %.0f  max %.0f ns (including reading the clock)\n",
+           PERCENTILE(0.5), PERCENTILE(0.9), PERCENTILE(0.99), PERCENTILE(0.999), ns[n-1]);
+#undef PERCENTILE
+    free(ns);
+    selector_expression_free(exp);
+}
+
+static void profileEval(const char* str, const selector_environment_t* env, size_t n)
+{
+    const selector_expression_t* exp = selector_expression(str);
+    if (!exp) return;
+    size_t envCount;
+    const selector_environment_t* const* envs = environments(&env, &envCount);
+    selector_expression_profile(exp, envs, envCount, n);
+    selector_expression_free(exp);
+}
+
+// Time to compile and the memory the compiled expression holds on to
+static void timeCompile(const char* str, size_t n)
+{
+#ifdef HAVE_MALLINFO2
+    size_t before = mallinfo2().uordblks;
+#endif
+    const selector_expression_t* exp = selector_expression(str);
+    if (!exp) return;
+#ifdef HAVE_MALLINFO2
+    size_t bytes = mallinfo2().uordblks - before;
+#endif
+    selector_expression_free(exp);
+
+    double start = now();
+    for (size_t i = 0; i<n; ++i) selector_expression_free(selector_expression(str));
+    printf("compile %.1f ns\n", (now()-start)/n);
+#ifdef HAVE_MALLINFO2
+    printf("footprint %zu bytes\n", bytes);
+#endif
+}
+
+// One environment per line as name=value, name=value... where each value is a
+// literal as in a selector, which is how selector_workload prints messages
+static void load(const char* file, selector_environment_t* current)
+{
+    while (isspace((unsigned char)*file)) ++file;
+    size_t len = strlen(file);
+    while (len>0 && isspace((unsigned char)file[len-1])) --len;
+    char* name = strndup(file, len);
+    FILE* f = fopen(name, "r");
+    if (!f) {
+        printf("Can't open: %s\n", name);
+        free(name);
+        return;
+    }
+    free(name);
+
+    for (size_t i = 0; i<loadedCount; ++i) selector_environment_free(loaded[i]);
+    free(loaded);
+    loaded = NULL;
+    loadedCount = 0;
+    size_t capacity = 0;
+
+    char* line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, f)!=-1) {
+        const char* p = line;
+        while (isspace((unsigned char)*p)) ++p;
+        if (!*p) continue;
+        selector_environment_t* env = selector_environment();
+        while (*p) {
+            while (isspace((unsigned char)*p) || *p==',') ++p;
+            const char* eq = strchr(p, '=');
+            if (!eq) break;
+            const char* end = eq+1;
+            if (*end=='\'') {
+                // A quote is doubled inside a string
+                for (++end; *end && !(*end=='\'' && end[1]!='\''); end += *end=='\'' ? 2 : 1);
+                if (*end) ++end;
+            } else {
+                while (*end && *end!=',') ++end;
+            }
+            char* var = strndup(p, eq-p);
+            char* text = strndup(eq+1, end-eq-1);
+            const selector_expression_t* exp = selector_expression(text);
+            if (exp) selector_environment_set(env, selector_intern(var), selector_expression_value(exp, current));
+            selector_expression_free(exp);
+            free(text);
+            free(var);
+            p = end;
+        }
+        if (loadedCount==capacity) {
+            capacity = capacity ? 2*capacity : 64;
+            loaded = realloc(loaded, capacity*sizeof(*loaded));
+        }
+        loaded[loadedCount++] = env;
+    }
+    free(line);
+    fclose(f);
+    printf("Loaded %zu environments\n", loadedCount);
+}
+
+static void help()
+{
+    printf("expr           evaluate an expression in the current environment\n"
+           "\\v var=expr    set a variable in the current environment\n"
+           "\\e             print the current environment\n"
+           "\\l file        load environments, one a line as name=value, name=value...\n"
+           "\\t [N:] expr   time N evaluations (100000) over the loaded environments\n"
+           "\\p [N:] expr   count and time the evaluations of each node (100000)\n"
+           "\\c [N:] expr   time N compilations (10000) and measure the compiled size\n"
+           "\\h             this help\n");
+}
+
 void process(const char* str, selector_environment_t* env)
 {
     // Check for special commands
@@ -32,6 +219,30 @@ void process(const char* str, selector_environment_t* env)
             // print env
             selector_environment_dump(env);
             return;
+          case 'l':
+            load(str+1, env);
+            return;
+          case 't': {
+            ++str;
+            size_t n = count(&str, 100000);
+            timeEval(str, env, n);
+            return;
+          }
+          case 'p': {
+            ++str;
+            size_t n = count(&str, 100000);
+            profileEval(str, env, n);
+            return;
+          }
+          case 'c': {
+            ++str;
+            size_t n = count(&str, 10000);
+            timeCompile(str, n);
+            return;
+          }
+          case 'h':
+            help();
+            return;
           default:
             printf("Unrecognized special command: %c\n", *str);
             return;
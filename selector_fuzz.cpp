@@ -0,0 +1,125 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Fuzz target for the cost of parsing and evaluating selectors
+//
+// Usage: selector_fuzz [file | directory]...
+// Built with SELECTORS_FUZZ (which needs clang) it is a libFuzzer program.
+// Besides new coverage it keeps inputs that reach a new power of two of work
+// per byte (see WorkCounter), so the corpus climbs towards slow selectors
+// and values:
+//   selector_fuzz -use_counters=1 corpus selector_fuzz_corpus
+// An input is a selector, then optionally a NUL and the value of every
+// property (see SelectorFuzz.h). With SELECTOR_FUZZ_MAX_COST set an input
+// costing more work than that per byte aborts, so the fuzzer saves it: add
+// it to selector_fuzz_corpus as a regression.
+//
+// Otherwise it runs the inputs in the files and directories given and
+// prints the cost of each, failing if one is over SELECTOR_FUZZ_MAX_COST or
+// by default the regression test's budget.
+
+#include "SelectorFuzz.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace selector;
+
+namespace {
+
+// Counters libFuzzer treats as coverage: one for each power of two of work
+// per byte
+#ifdef __linux__
+__attribute__((used, section("__libfuzzer_extra_counters")))
+#endif
+uint8_t costCounters[64];
+
+double maxCost()
+{
+    static double max = [] {
+        auto m = std::getenv("SELECTOR_FUZZ_MAX_COST");
+        return m ? std::strtod(m, nullptr) : 0.0;
+    }();
+    return max;
+}
+
+fuzz::Cost measure(const uint8_t* data, std::size_t size)
+{
+    auto cost = fuzz::run(data, size);
+    auto perByte = cost.perByte();
+    auto bucket = perByte<1.0 ? 0 : std::min(63, std::ilogb(perByte)+1);
+    ++costCounters[bucket];
+    return cost;
+}
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, std::size_t size)
+{
+    auto cost = measure(data, size);
+    if (maxCost()>0.0 && cost.perByte()>maxCost()) {
+        std::cerr << "Cost " << cost.perByte() << " per byte is over " << maxCost() << "\n";
+        std::abort();
+    }
+    return 0;
+}
+
+#ifndef SELECTORS_LIBFUZZER
+int main(int argc, char** argv)
+{
+    std::vector<std::filesystem::path> inputs;
+    for (int i = 1; i<argc; ++i) {
+        if (std::filesystem::is_directory(argv[i])) {
+            for (auto& f : std::filesystem::directory_iterator(argv[i])) inputs.push_back(f.path());
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
+    if (inputs.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [file | directory]...\n";
+        return 1;
+    }
+
+    std::sort(inputs.begin(), inputs.end());
+    int failures = 0;
+    for (auto& path : inputs) {
+        std::ifstream in(path, std::ios::binary);
+        std::string input{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+        auto data = reinterpret_cast<const uint8_t*>(input.data());
+        auto cost = measure(data, input.size());
+        bool over = cost.perByte()>(maxCost()>0.0 ? maxCost() : fuzz::maxWorkPerByte);
+        failures += over;
+        std::cout << path.filename().string() << ": " << input.size() << " bytes, " << cost.perByte()
+                  << " work per byte"
+                  << (cost.parsed ? "" : ", not a selector") << (over ? ", TOO SLOW" : "") << "\n";
+    }
+    return failures>0;
+}
+#endif
@@ -0,0 +1,305 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// End to end benchmark of routing messages through an in-process topic
+// exchange: publishers decode each message into an environment, match it
+// against the selectors of the subscribers to its topic and count a delivery
+// for every match.
+//
+// Usage: selector_router_bench [name=value ...]
+//   publishers=N   publishing threads (1)
+//   subscribers=N  subscriptions over all topics (1000)
+//   topics=N       (10)
+//   messages=N     per publisher (20000)
+//   mix=simple|mixed|heavy  kind of selectors (mixed)
+//   skew=S         Zipf exponent of property values, 0 for uniform (1.0)
+//   matcher=eval|set  evaluate each selector or match the topic's set (eval)
+//   counters=on    add hardware event counts per message where the system allows it
+// Without any but counters runs a range of configurations.
+
+#include "SelectorBench.h"
+#include "SelectorEnv.h"
+#include "SelectorExpression.h"
+#include "SelectorSet.h"
+#include "SelectorValue.h"
+#include "SelectorWorkload.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::unique_ptr;
+using std::vector;
+
+using namespace selector;
+
+namespace {
+
+struct Config {
+    size_t publishers = 1;
+    size_t subscribers = 1000;
+    size_t topics = 10;
+    size_t messages = 20000;
+    string mix = "mixed";
+    double skew = 1.0;
+    string matcher = "eval";
+};
+
+const vector<string> regions{"eu", "eu-west", "us", "us-east", "asia", "apac", "latam", "africa"};
+const vector<string> types{"order", "quote", "trade", "cancel"};
+
+// A message as it arrives: its properties encoded as text
+struct RawMessage {
+    size_t topic;
+    vector<std::pair<string, string>> properties; // name, value: 'string', integer, decimal or true/false
+};
+
+// The environment built from a raw message for evaluation
+class MessageEnv : public Env {
+    vector<std::pair<string, Value>> properties;
+    vector<string> strings;
+
+public:
+    explicit MessageEnv(const RawMessage& m) {
+        properties.reserve(m.properties.size());
+        strings.reserve(m.properties.size());
+        for (auto& [name, text] : m.properties) {
+            Value v;
+            if (text.front()=='\'') {
+                strings.push_back(text.substr(1, text.size()-2));
+                v = string_view{strings.back()};
+            } else if (text=="true" || text=="false") {
+                v = text=="true";
+            } else if (text.find('.')!=string::npos) {
+                v = std::strtod(text.c_str(), nullptr);
+            } else {
+                v = int64_t(std::strtoll(text.c_str(), nullptr, 10));
+            }
+            properties.emplace_back(name, v);
+        }
+    }
+
+    const Value& value(const string_view name) const override {
+        static const Value EMPTY{};
+        for (auto& p : properties) {
+            if (p.first==name) return p.second;
+        }
+        return EMPTY;
+    }
+};
+
+struct Topic {
+    vector<unique_ptr<Expression>> selectors;
+    vector<size_t> subscribers;
+    SelectorSet set;
+};
+
+string selectorText(const Config& c, std::mt19937& rng)
+{
+    auto pick = [&](const vector<string>& v) { return "'" + v[rng()%v.size()] + "'"; };
+    auto number = [&](unsigned limit) { return std::to_string(rng()%limit); };
+    auto customer = [&] { return "'c" + std::to_string(rng()%1000) + "'"; };
+    if (c.mix=="simple") {
+        return rng()%2 ? "region = " + pick(regions) : "customer = " + customer();
+    }
+    if (c.mix=="heavy") {
+        switch (rng()%4) {
+        case 0: return "region LIKE '%" + regions[rng()%regions.size()].substr(1) + "%' AND note LIKE '%urgent%'";
+        case 1: {
+            string in;
+            for (int i = 0; i<20; ++i) in += (i ? ", " : "") + customer();
+            return "customer IN (" + in + ")";
+        }
+        case 2: return "price * size / 100 > " + number(50000) + " AND priority + 1 BETWEEN 3 AND 8";
+        default: return "(region = " + pick(regions) + " OR type = " + pick(types) + ") AND NOT urgent AND note IS NOT NULL";
+        }
+    }
+    switch (rng()%7) {
+    case 0: return "region = " + pick(regions);
+    case 1: return "priority > " + number(10) + " AND type = " + pick(types);
+    case 2: return "type IN (" + pick(types) + ", " + pick(types) + ") AND size < " + number(10000);
+    case 3: return "customer = " + customer() + " OR urgent";
+    case 4: return "price BETWEEN " + number(500) + " AND " + number(1000);
+    case 5: return "region LIKE '" + regions[rng()%regions.size()].substr(0, 2) + "%' AND priority >= " + number(10);
+    default: return "size > " + number(10000) + " AND NOT urgent";
+    }
+}
+
+vector<RawMessage> makeMessages(const Config& c, size_t n, unsigned seed)
+{
+    std::mt19937 rng{seed};
+    workload::Zipf region{regions.size(), c.skew};
+    workload::Zipf customer{1000, c.skew};
+    workload::Zipf topic{c.topics, c.skew};
+    vector<RawMessage> messages(n);
+    for (auto& m : messages) {
+        m.topic = topic(rng);
+        auto& p = m.properties;
+        p.emplace_back("region", "'" + regions[region(rng)] + "'");
+        p.emplace_back("type", "'" + types[rng()%types.size()] + "'");
+        p.emplace_back("priority", std::to_string(rng()%10));
+        p.emplace_back("size", std::to_string(rng()%10000));
+        p.emplace_back("price", std::to_string(rng()%100000/100) + "." + std::to_string(rng()%100));
+        if (rng()%4) p.emplace_back("customer", "'c" + std::to_string(customer(rng)) + "'");
+        if (rng()%2) p.emplace_back("urgent", rng()%8 ? "false" : "true");
+        if (rng()%3==0) p.emplace_back("note", rng()%5 ? "'routine delivery'" : "'urgent: call back'");
+    }
+    return messages;
+}
+
+void run(const Config& c)
+{
+    std::mt19937 rng{42};
+    vector<Topic> topics(c.topics);
+    for (size_t s = 0; s<c.subscribers; ++s) {
+        auto& t = topics[rng()%topics.size()];
+        t.selectors.push_back(make_selector(selectorText(c, rng)));
+        t.subscribers.push_back(s);
+        t.set.add(*t.selectors.back());
+    }
+
+    vector<vector<RawMessage>> work;
+    for (size_t p = 0; p<c.publishers; ++p) work.push_back(makeMessages(c, c.messages, 100+p));
+
+    vector<std::atomic<uint64_t>> delivered(c.subscribers);
+    vector<bench::Latencies> latencies(c.publishers);
+    vector<bench::Counts> counts(c.publishers);
+    bool useSet = c.matcher=="set";
+    auto start = std::chrono::steady_clock::now();
+    vector<std::thread> publishers;
+    for (size_t p = 0; p<c.publishers; ++p) {
+        publishers.emplace_back([&, p] {
+            vector<size_t> matched;
+            bench::Counters counters;
+            counters.start();
+            for (auto& raw : work[p]) {
+                latencies[p].time([&] {
+                    MessageEnv env{raw};
+                    auto& t = topics[raw.topic];
+                    if (useSet) {
+                        t.set.match(env, matched);
+                        for (auto s : matched) delivered[t.subscribers[s]].fetch_add(1, std::memory_order_relaxed);
+                    } else {
+                        for (size_t s = 0; s<t.selectors.size(); ++s) {
+                            if (eval(*t.selectors[s], env)) delivered[t.subscribers[s]].fetch_add(1, std::memory_order_relaxed);
+                        }
+                    }
+                });
+            }
+            counts[p] = counters.stop();
+        });
+    }
+    for (auto& t : publishers) t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+    uint64_t deliveries = 0;
+    for (auto& d : delivered) deliveries += d;
+    bench::Latencies all;
+    for (auto& l : latencies) all.add(l);
+    bench::Counts total = counts[0];
+    for (size_t p = 1; p<c.publishers; ++p) total += counts[p];
+    auto messages = c.publishers*c.messages;
+
+    std::cout << std::left << std::setw(56)
+              << (std::to_string(c.publishers) + " pub, " + std::to_string(c.subscribers) + " sub, " +
+                  std::to_string(c.topics) + " topics, " + c.mix + ", " + c.matcher)
+              << std::right << std::fixed << std::setprecision(0)
+              << std::setw(10) << messages/seconds << " msgs/s"
+              << std::setw(12) << deliveries/seconds << " dlv/s"
+              << std::setprecision(1)
+              << std::setw(9) << all.percentile(0.5)/1000 << " us p50"
+              << std::setw(9) << all.percentile(0.99)/1000 << " us p99"
+              << std::setw(9) << all.percentile(0.999)/1000 << " us p99.9";
+    bench::perOp(std::cout, total, messages) << "\n";
+}
+
+bool configure(Config& c, const string& arg)
+{
+    auto eq = arg.find('=');
+    if (eq==string::npos) return false;
+    auto name = arg.substr(0, eq);
+    auto value = arg.substr(eq+1);
+    auto number = [&] { return std::strtoul(value.c_str(), nullptr, 10); };
+    // Each publisher needs at least one message and topic
+    if (name=="publishers" && number()>0) c.publishers = number();
+    else if (name=="subscribers") c.subscribers = number();
+    else if (name=="topics" && number()>0) c.topics = number();
+    else if (name=="messages" && number()>0) c.messages = number();
+    else if (name=="mix" && (value=="simple" || value=="mixed" || value=="heavy")) c.mix = value;
+    else if (name=="skew") c.skew = std::strtod(value.c_str(), nullptr);
+    else if (name=="matcher" && (value=="eval" || value=="set")) c.matcher = value;
+    else if (name=="counters" && (value=="on" || value=="off")) bench::countEvents = value=="on";
+    else return false;
+    return true;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    // Run a single configuration if given anything but counters
+    Config given;
+    bool single = false;
+    for (int i = 1; i<argc; ++i) {
+        if (!configure(given, argv[i])) {
+            std::cerr << "Usage: " << argv[0] << " [publishers=N] [subscribers=N] [topics=N] [messages=N]"
+                      << " [mix=simple|mixed|heavy] [skew=S] [matcher=eval|set] [counters=on]\n";
+            return 1;
+        }
+        single = single || string(argv[i]).rfind("counters=", 0)!=0;
+    }
+    if (single) {
+        run(given);
+        return 0;
+    }
+
+    for (auto mix : {"simple", "mixed", "heavy"}) {
+        for (auto matcher : {"eval", "set"}) {
+            for (size_t subscribers : {100, 1000, 10000}) {
+                Config c;
+                c.mix = mix;
+                c.matcher = matcher;
+                c.subscribers = subscribers;
+                c.messages = 2000000/subscribers;
+                run(c);
+            }
+        }
+    }
+    for (size_t publishers : {2, 4}) {
+        Config c;
+        c.publishers = publishers;
+        run(c);
+    }
+}
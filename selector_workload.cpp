@@ -0,0 +1,145 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Print a synthetic workload
+//
+// Usage: selector_workload selectors N [name=value ...]
+//        selector_workload messages N [name=value ...]
+//        selector_workload rate SELECTORS MESSAGES [name=value ...]
+// selectors prints one selector a line, messages one message a line as
+// name=value pairs and rate how often the messages match the selectors.
+// Options:
+//   seed=N identifiers=N values=N skew=S         the vocabulary
+//   equality= comparison= in= like= between= null= arithmetic= boolean=
+//                                                weights of each kind of predicate
+//   inmin=N inmax=N depth=N nesting=P negation=P the shape of selectors
+//   present=P matchrate=P                        messages (matchrate needs selectors)
+
+#include "SelectorExpression.h"
+#include "SelectorWorkload.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::size_t;
+using std::string;
+using std::vector;
+
+using namespace selector;
+using namespace selector::workload;
+
+namespace {
+
+struct Options {
+    uint64_t seed = 1;
+    Vocabulary vocabulary;
+    SelectorOptions selectors;
+    MessageOptions messages;
+};
+
+bool configure(Options& o, const string& arg)
+{
+    auto eq = arg.find('=');
+    if (eq==string::npos) return false;
+    auto name = arg.substr(0, eq);
+    auto text = arg.substr(eq+1);
+    auto n = std::strtoull(text.c_str(), nullptr, 10);
+    auto x = std::strtod(text.c_str(), nullptr);
+    auto& s = o.selectors;
+    if (name=="seed") o.seed = n;
+    else if (name=="identifiers") o.vocabulary.identifiers = n;
+    else if (name=="values") o.vocabulary.values = n;
+    else if (name=="skew") o.vocabulary.skew = x;
+    else if (name=="equality") s.equality = n;
+    else if (name=="comparison") s.comparison = n;
+    else if (name=="in") s.in = n;
+    else if (name=="like") s.like = n;
+    else if (name=="between") s.between = n;
+    else if (name=="null") s.null = n;
+    else if (name=="arithmetic") s.arithmetic = n;
+    else if (name=="boolean") s.boolean = n;
+    else if (name=="inmin") s.inMin = n;
+    else if (name=="inmax") s.inMax = n;
+    else if (name=="depth") s.depth = n;
+    else if (name=="nesting") s.nesting = x;
+    else if (name=="negation") s.negation = x;
+    else if (name=="present") o.messages.present = x;
+    else if (name=="matchrate") o.messages.matchRate = x;
+    else return false;
+    return true;
+}
+
+int usage(const char* program)
+{
+    std::cerr << "Usage: " << program << " selectors N [name=value ...]\n"
+              << "       " << program << " messages N [name=value ...]\n"
+              << "       " << program << " rate SELECTORS MESSAGES [name=value ...]\n";
+    return 1;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc<3) return usage(argv[0]);
+    string command = argv[1];
+    size_t m = std::strtoull(argv[2], nullptr, 10);
+    size_t n = 0;
+    int first = 3;
+    if (command=="rate") {
+        if (argc<4) return usage(argv[0]);
+        n = std::strtoull(argv[3], nullptr, 10);
+        first = 4;
+    } else if (command!="selectors" && command!="messages") {
+        return usage(argv[0]);
+    }
+    Options o;
+    for (int i = first; i<argc; ++i) {
+        if (!configure(o, argv[i])) return usage(argv[0]);
+    }
+
+    Generator g{o.seed, o.vocabulary};
+    if (command=="selectors") {
+        for (auto& s : g.selectors(m, o.selectors)) std::cout << s.text << "\n";
+    } else if (command=="messages") {
+        for (auto& msg : g.messages(m, {}, o.messages)) std::cout << msg << "\n";
+    } else {
+        auto selectors = g.selectors(m, o.selectors);
+        auto messages = g.messages(n, selectors, o.messages);
+        vector<std::unique_ptr<Expression>> compiled;
+        for (auto& s : selectors) compiled.push_back(make_selector(s.text));
+        size_t pairs = 0;
+        size_t matched = 0;
+        for (auto& msg : messages) {
+            size_t k = 0;
+            for (auto& e : compiled) k += eval(*e, msg);
+            pairs += k;
+            matched += k>0;
+        }
+        std::cout << "pairs matching:    " << (m*n ? double(pairs)/(m*n) : 0.0) << "\n"
+                  << "messages matching: " << (n ? double(matched)/n : 0.0) << "\n";
+    }
+}
@@ -21,8 +21,12 @@
 
 #include "selectors.h"
 
+#include "SelectorArrow.h"
 #include "SelectorExpression.h"
+#include "SelectorProfile.h"
 #include "SelectorEnv.h"
+#include "SelectorIntern.h"
+#include "SelectorProbes.h"
 #include "SelectorToken.h"
 #include "SelectorValue.h"
 
@@ -32,51 +36,62 @@
 #include <string>
 #include <string_view>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
 
 using std::string;
 using std::string_view;
 using std::unique_ptr;
 using std::unordered_map;
-using std::unordered_set;
 
 // C interfaces
 
+// Each entry point fires the capi probe with its name
+#define CAPI_ENTRY() SELECTOR_PROBE1(capi, static_cast<const char*>(__func__))
+
 struct selector_expression_t : selector::Expression {};
 
-struct selector_value_t : selector::Value {};
+struct selector_value_t : selector::Value {
+    // Keeps a string's text interned as long as the value
+    selector::InternedString text;
+};
 
 auto constexpr EMPTY = selector::Value{};
 
 struct selector_environment_t : selector::Env {
-    unordered_map<string_view, unique_ptr<const selector::Value>> values;
+    unordered_map<string_view, unique_ptr<const selector_value_t>> values;
 
     const selector::Value& value(const string_view sv) const override {
-	auto i = values.find(string{sv});
+	auto i = values.find(sv);
 	if (i != values.end()) {
             return *i->second;
 	}
 	return EMPTY;
     }
 
-    void set(string_view var, unique_ptr<const selector::Value> val) {
+    void set(string_view var, unique_ptr<const selector_value_t> val) {
 	    values[var] = std::move(val);
     }
 };
 
-const char* selector_intern(string_view str) {
-    static auto strings = unordered_set<string>{};
+// A value to give to the caller, with any string in it interned
+const selector_value_t* new_value(const selector::Value& v) {
+    if (!selector::characters(v)) return new selector_value_t{{v}, {}};
+    selector::InternedString text{std::get<string_view>(v.value)};
+    auto value = text.value();
+    return new selector_value_t{{value}, std::move(text)};
+}
 
-    string s{str};
-    if (auto i=strings.find(s); i!=strings.end()) return i->c_str();
-    else return strings.emplace(s).first->c_str();
+const char* selector_intern(string_view str) {
+    return selector::intern(str).data();
 }
 
 const char* selector_intern(const char* str) {
+    CAPI_ENTRY();
     return selector_intern(string_view{str});
 }
 
 const selector_expression_t* selector_expression(const char* exp) {
+    CAPI_ENTRY();
     try {
         return static_cast<selector_expression_t*>(selector::make_selector(exp).release());
     } catch (std::exception& e) {
@@ -86,76 +101,112 @@ const selector_expression_t* selector_expression(const char* exp) {
 }
 
 void selector_expression_free(const selector_expression_t* exp) {
+    CAPI_ENTRY();
     delete exp;
 }
 
 bool selector_expression_eval(const selector_expression_t* exp, const selector_environment_t* env) {
+    CAPI_ENTRY();
     return eval(*exp, *env);
 }
 
 const selector_value_t* selector_expression_value(const selector_expression_t* exp, const selector_environment_t* env) {
-    auto val = exp->eval(*env);
-    if (selector::characters(val)) val.value = selector_intern(std::get<string_view>(val.value));
-    return static_cast<selector_value_t*>(new selector::Value{val});
+    CAPI_ENTRY();
+    return new_value(exp->eval(*env));
 }
 
 void selector_expression_dump(const selector_expression_t* exp) {
+    CAPI_ENTRY();
     std::cerr << *exp;
 }
 
+// Evaluate iterations times cycling through the environments and dump the counts for each node
+void selector_expression_profile(const selector_expression_t* exp, const selector_environment_t* const* envs, size_t count, size_t iterations) {
+    CAPI_ENTRY();
+    if (count==0) return;
+    selector::ProfiledEval p{*exp};
+    for (size_t i = 0; i<iterations; ++i) p.eval_bool(*envs[i%count]);
+    std::cerr << p;
+}
+
+bool selector_expression_filter_arrow(const selector_expression_t* exp, const ArrowSchema* schema, const ArrowArray* array, uint64_t* selection) {
+    CAPI_ENTRY();
+    try {
+        selector::ArrowBatch batch{*schema, *array};
+        filter(*exp, batch.batch(), selection);
+        return true;
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return false;
+    }
+}
+
 selector_environment_t* selector_environment() {
+    CAPI_ENTRY();
     return new selector_environment_t;
 }
 
 void selector_environment_free(const selector_environment_t* env) {
+    CAPI_ENTRY();
     delete env;
 }
 
 void selector_environment_dump(const selector_environment_t* env) {
+    CAPI_ENTRY();
     for (auto& [k,v] : env->values) {
         std::cerr << k << "=" << *v << "\n";
     };
 }
 
 void selector_environment_set(selector_environment_t* env, const char* var, const selector_value_t* val) {
-    env->set(var, unique_ptr<const selector::Value>{val});
+    CAPI_ENTRY();
+    env->set(var, unique_ptr<const selector_value_t>{val});
 }
 
 const selector_value_t* selector_environment_get(selector_environment_t* env, const char* var) {
+    CAPI_ENTRY();
     return static_cast<const selector_value_t*>(&env->value(var));
 }
 
 const selector_value_t* selector_value_unknown() {
+    CAPI_ENTRY();
     return static_cast<const selector_value_t*>(&EMPTY);
 }
 
 const selector_value_t* selector_value_bool(bool b) {
-    return static_cast<const selector_value_t*>(new selector::Value(b));
+    CAPI_ENTRY();
+    return new_value(b);
 }
 
 const selector_value_t* selector_value_exact(int64_t i) {
-    return static_cast<const selector_value_t*>(new selector::Value(i));
+    CAPI_ENTRY();
+    return new_value(i);
 }
 
 const selector_value_t* selector_value_approx(double d) {
-    return static_cast<const selector_value_t*>(new selector::Value(d));
+    CAPI_ENTRY();
+    return new_value(d);
 }
 
 const selector_value_t* selector_value_string(const char* str) {
-    return static_cast<const selector_value_t*>(new selector::Value(selector_intern(str)));
+    CAPI_ENTRY();
+    return new_value(string_view{str});
 }
 
 const selector_value_t* selector_value(const char* str) {
+    CAPI_ENTRY();
     auto selector_env = std::unique_ptr<const selector_environment_t>{selector_environment()};
     auto selector_exp = std::unique_ptr<const selector_expression_t>{selector_expression(str)};
     return selector_expression_value(selector_exp.get(), selector_env.get());
 }
 
 void selector_value_free(const selector_value_t* v) {
+    CAPI_ENTRY();
     if (v!=selector_value_unknown()) delete v;
 }
 
 void selector_value_dump(const selector_value_t* v) {
+    CAPI_ENTRY();
     std::cerr << *v;
 }
 
@@ -3,6 +3,7 @@
 // C Interface to selector library
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "selectors_export.h"
@@ -15,11 +16,20 @@ typedef struct selector_expression_t selector_expression_t;
 typedef struct selector_value_t selector_value_t;
 typedef struct selector_environment_t selector_environment_t;
 
+struct ArrowSchema;
+struct ArrowArray;
+
 SELECTORS_EXPORT const selector_expression_t* selector_expression(const char* exp);
 SELECTORS_EXPORT void selector_expression_free(const selector_expression_t* exp);
 SELECTORS_EXPORT bool selector_expression_eval(const selector_expression_t* exp, const selector_environment_t* env);
 SELECTORS_EXPORT const selector_value_t* selector_expression_value(const selector_expression_t* exp, const selector_environment_t* env);
 SELECTORS_EXPORT void selector_expression_dump(const selector_expression_t* exp);
+SELECTORS_EXPORT void selector_expression_profile(const selector_expression_t* exp, const selector_environment_t* const* envs, size_t count, size_t iterations);
+// Overwrite selection, which must hold (array->length+63)/64 words, with bit
+// i of selection[i/64] set just for each row i of an Arrow record batch that
+// exp matches (see SelectorArrow.h). false if the batch can't be read, when
+// selection is left alone.
+SELECTORS_EXPORT bool selector_expression_filter_arrow(const selector_expression_t* exp, const struct ArrowSchema* schema, const struct ArrowArray* array, uint64_t* selection);
 
 SELECTORS_EXPORT const selector_value_t* selector_value(const char* str);
 SELECTORS_EXPORT const selector_value_t* selector_value_unknown();